@@ -0,0 +1,853 @@
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <glm/glm.hpp>
+#include "evaluator.hpp"
+#include "surface.hpp"
+#include "funcsurface.hpp"
+#include "implicit.hpp"
+#include "decimate.hpp"
+#include "server.hpp"
+#include "cachedir.hpp"
+#include "mesh.hpp"
+#include "fastmath.hpp"
+#include "glstate.hpp"
+using namespace std;
+
+// Microbenchmarks for the parts of the program that don't need a display.
+// Every benchmark is run a number of times; for each run the time per unit of
+// work (token, formula, sample, vertex) is measured and the median and
+// variance over all runs are printed as tab-separated values.
+
+static int repeats = 15;
+static const char *filter = NULL;
+static volatile double sink;
+
+struct Formula
+{
+    const char *name;
+    string def;
+};
+
+// Aux variables every formula of the corpus may use:
+static const char *corpus_vars[] = { "u", "v", "U", "V", "R", "r" };
+
+static vector<Formula> make_corpus()
+{
+    vector<Formula> corpus;
+    Formula f;
+
+    // Examples from the README:
+    f.name = "sphere_x";  f.def = "cos(U) * sin(V)";  corpus.push_back(f);
+    f.name = "sphere_y";  f.def = "cos(V)";  corpus.push_back(f);
+    f.name = "torus_x";   f.def = "(R + r*cos(V)) * cos(U)";  corpus.push_back(f);
+    f.name = "torus_z";   f.def = "r*sin(V)";  corpus.push_back(f);
+    f.name = "whirly_x";  f.def = "cos(5*U) * (R + r*sin(V) + 2*r*cos(U))";  corpus.push_back(f);
+    f.name = "whirly_z";  f.def = ".2*r*cos(V) + 5*r*sin(U)";  corpus.push_back(f);
+    f.name = "whirly_g";  f.def = ".5 + .5*sin(2*U)";  corpus.push_back(f);
+
+    // Deep synthetic ones:
+    f.name = "nested_sin32";
+    f.def = "u";
+    for(int k=0; k<32; ++k) f.def = "sin(" + f.def + " + v)";
+    corpus.push_back(f);
+
+    f.name = "horner32";
+    f.def = "1";
+    for(int k=0; k<32; ++k) f.def = "(" + f.def + ")*u + .5";
+    corpus.push_back(f);
+
+    f.name = "ifelse16";
+    f.def = "v";
+    for(int k=16; k>0; --k)
+    {
+        stringstream ss;
+        ss << "u < " << (k / 17.0) << " ? " << k << "*sin(V) : (" << f.def << ")";
+        f.def = ss.str();
+    }
+    corpus.push_back(f);
+
+    // Piecewise ones, with costly arms:
+    f.name = "piecewise2";
+    f.def = "v < .5 ? exp(-4*u) * (sin(3*U)^2 + cos(5*V)^3) * tan(V/8) : abs(cos(2*U))^1.5 * exp(sin(V)) + sin(U*V)";
+    corpus.push_back(f);
+
+    f.name = "piecewise4";
+    f.def = "u < .25 ? sin(U)*cos(V)*exp(-v) + sin(2*U)^2 : u < .5 ? cos(3*V)*exp(sin(U)) - tan(v/2)"
+            " : u < .75 ? (sin(V)^2 + cos(U)^2)^.75 * exp(-u*v) : sin(5*U)*sin(5*V)*cos(U + V)";
+    corpus.push_back(f);
+
+    f.name = "pow_exp_tan";
+    f.def = "exp(-(u-.5)^2 * 4) * tan(V/4) + abs(cos(U))^1.5 - (u != v) * (u >= v)";
+    corpus.push_back(f);
+
+    return corpus;
+}
+
+static double now_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Runs fn `repeats` times and prints median and variance of the time per unit,
+// where each call of fn does `units` units of work.  Returns the median, or 0
+// if the benchmark is filtered out.
+template <typename F>
+static double run(const string& bench, const string& param, const char *unit, double units, F fn)
+{
+    const string full_name = bench + "/" + param;
+    if(filter && full_name.find(filter) == string::npos) return 0;
+
+    fn();  // warm up
+
+    vector<double> samples;
+    for(int k=0; k<repeats; ++k)
+    {
+        const double t0 = now_ns();
+        fn();
+        samples.push_back((now_ns() - t0) / units);
+    }
+
+    double mean = 0;
+    for(size_t k=0; k<samples.size(); ++k) mean += samples[k];
+    mean /= samples.size();
+
+    double variance = 0;
+    for(size_t k=0; k<samples.size(); ++k) variance += (samples[k] - mean) * (samples[k] - mean);
+    variance /= samples.size();
+
+    sort(samples.begin(), samples.end());
+    const size_t n = samples.size();
+    const double median = n % 2 ? samples[n / 2] : .5 * (samples[n / 2 - 1] + samples[n / 2]);
+
+    cout << bench << '\t' << param << '\t' << repeats << '\t' << unit << '\t'
+         << median << '\t' << variance << '\n';
+    cout.flush();
+    return median;
+}
+
+static void bench_tokenizer(const vector<Formula>& corpus)
+{
+    for(size_t f=0; f<corpus.size(); ++f)
+    {
+        const string& def = corpus[f].def;
+
+        size_t n_tokens = 0;
+        {
+            Tokenizer tokenizer(def);
+            while(tokenizer.read_token().type != Token::END) ++ n_tokens;
+        }
+
+        const int iters = 1000;
+        run("tokenize", corpus[f].name, "ns/token", 1.0 * iters * n_tokens, [&]()
+        {
+            for(int it=0; it<iters; ++it)
+            {
+                Tokenizer tokenizer(def);
+                while(tokenizer.read_token().type != Token::END);
+            }
+        });
+    }
+}
+
+static void bench_parser(const vector<Formula>& corpus, const Evaluator::varlist_t& varlist,
+                         const Evaluator::constmap_t& constmap)
+{
+    for(size_t f=0; f<corpus.size(); ++f)
+    {
+        const int iters = 200;
+        run("parse", corpus[f].name, "ns/formula", iters, [&]()
+        {
+            for(int it=0; it<iters; ++it)
+                Evaluator etor(corpus[f].def, varlist, constmap);
+        });
+    }
+}
+
+static void bench_evaluate(const vector<Formula>& corpus, const Evaluator::varlist_t& varlist,
+                           const Evaluator::constmap_t& constmap)
+{
+    // Precomputed variable sets covering the (u,v) domain:
+    const int n_sets = 4096;
+    vector<vector<double> > var_sets(n_sets, vector<double>(varlist.size()));
+    for(int k=0; k<n_sets; ++k)
+    {
+        vector<double>& vars = var_sets[k];
+        vars[0] = (k % 64) / 63.0;  // u
+        vars[1] = (k / 64) / 63.0;  // v
+        vars[2] = 2 * M_PI * vars[0];  // U
+        vars[3] = 2 * M_PI * vars[1];  // V
+        vars[4] = 1;  // R
+        vars[5] = .25;  // r
+    }
+
+    for(int fast=0; fast<2; ++fast)
+    {
+        for(size_t f=0; f<corpus.size(); ++f)
+        {
+            Evaluator etor(corpus[f].def, varlist, constmap);
+            etor.set_fast_math(fast);
+            run(fast ? "evaluate_fast" : "evaluate", corpus[f].name, "ns/sample", n_sets, [&]()
+            {
+                double sum = 0;
+                for(int k=0; k<n_sets; ++k) sum += etor.evaluate(var_sets[k]);
+                sink = sum;
+            });
+        }
+    }
+}
+
+// Prints how often each pair of consecutive operations occurs in the corpus,
+// most frequent first, as comments.  The superinstructions of the evaluator
+// are chosen from these.
+static void print_op_pairs(const vector<Formula>& corpus, const Evaluator::varlist_t& varlist,
+                           const Evaluator::constmap_t& constmap)
+{
+    if(filter && string("op_pairs").find(filter) == string::npos) return;
+
+    map<pair<Operation::op_t, Operation::op_t>, int> counts;
+    int n_pairs = 0;
+    for(size_t f=0; f<corpus.size(); ++f)
+    {
+        const Evaluator etor(corpus[f].def, varlist, constmap);
+        const vector<Operation>& ops = etor.get_operations();
+        for(size_t k=0; k+1<ops.size(); ++k)
+        {
+            ++ counts[make_pair(ops[k].op, ops[k + 1].op)];
+            ++ n_pairs;
+        }
+    }
+
+    vector<pair<int, string> > sorted;
+    for(map<pair<Operation::op_t, Operation::op_t>, int>::const_iterator it = counts.begin(); it != counts.end(); ++it)
+        sorted.push_back(make_pair(-it->second, string(Operation::get_name(it->first.first)) + "+" + Operation::get_name(it->first.second)));
+    sort(sorted.begin(), sorted.end());
+
+    cout << "# op pair\tcount\tshare\n";
+    for(size_t k=0; k<sorted.size() && k<16; ++k)
+        cout << "# " << sorted[k].second << '\t' << -sorted[k].first << '\t' << -100.0 * sorted[k].first / n_pairs << "%\n";
+}
+
+// Returns the distance between a and b in units in the last place.
+static double ulp_distance(double a, double b)
+{
+    if(std::isnan(a) || std::isnan(b)) return std::isnan(a) && std::isnan(b) ? 0 : HUGE_VAL;
+
+    // Map the bits to integers that are ordered like the numbers:
+    int64_t ia, ib;
+    memcpy(&ia, &a, sizeof(a));
+    memcpy(&ib, &b, sizeof(b));
+    if(ia < 0) ia = INT64_MIN - ia;
+    if(ib < 0) ib = INT64_MIN - ib;
+    return ia > ib ? static_cast<double>(uint64_t(ia) - uint64_t(ib)) : static_cast<double>(uint64_t(ib) - uint64_t(ia));
+}
+
+// One function of fastmath.hpp, compared against libm on a domain.
+struct FastMathCase
+{
+    const char *name;
+    double (*exact)(double, double);
+    double (*fast)(double, double);
+    double x_min, x_max, y_min, y_max;
+    bool y_integer;
+    double max_ulp;  // as documented in fastmath.hpp
+};
+
+static double libm_sin(double x, double) { return sin(x); }
+static double libm_cos(double x, double) { return cos(x); }
+static double libm_tan(double x, double) { return tan(x); }
+static double libm_exp(double x, double) { return exp(x); }
+static double libm_pow(double x, double y) { return pow(x, y); }
+static double fm_sin(double x, double) { return fast_sin(x); }
+static double fm_cos(double x, double) { return fast_cos(x); }
+static double fm_tan(double x, double) { return fast_tan(x); }
+static double fm_exp(double x, double) { return fast_exp(x); }
+static double fm_pow(double x, double y) { return fast_pow(x, y); }
+
+// Measures the error and speed of the fast-math functions.  Returns false if
+// an error exceeds the documented bound.
+static bool bench_fastmath()
+{
+    static const FastMathCase cases[] =
+    {
+        { "sin_pio4",  libm_sin, fm_sin, -M_PI_4, M_PI_4, 0, 0, false, 2 },
+        { "sin_pi",    libm_sin, fm_sin, -M_PI, M_PI, 0, 0, false, 2 },
+        { "sin_1e5",   libm_sin, fm_sin, -1e5, 1e5, 0, 0, false, 2 },
+        { "cos_pi",    libm_cos, fm_cos, -M_PI, M_PI, 0, 0, false, 2 },
+        { "cos_1e5",   libm_cos, fm_cos, -1e5, 1e5, 0, 0, false, 2 },
+        { "tan_pi",    libm_tan, fm_tan, -M_PI, M_PI, 0, 0, false, 4 },
+        { "tan_1e5",   libm_tan, fm_tan, -1e5, 1e5, 0, 0, false, 4 },
+        { "exp_1",     libm_exp, fm_exp, -1, 1, 0, 0, false, 1 },
+        { "exp_700",   libm_exp, fm_exp, -700, 700, 0, 0, false, 1 },
+        { "pow_int4",  libm_pow, fm_pow, -10, 10, -4, 4, true, 4 },
+        { "pow_int16", libm_pow, fm_pow, -4, 4, -16, 16, true, 16 },
+        { "pow_real1", libm_pow, fm_pow, 0, 10, -1, 1, false, 7 },
+        { "pow_real10", libm_pow, fm_pow, 0, 10, -10, 10, false, 50 },
+    };
+
+    bool ok = true;
+    const int n = 1 << 16;
+    vector<double> xs(n), ys(n);
+    for(size_t c=0; c<sizeof(cases) / sizeof(*cases); ++c)
+    {
+        const FastMathCase& fc = cases[c];
+
+        srand(1);
+        for(int k=0; k<n; ++k)
+        {
+            xs[k] = fc.x_min + (fc.x_max - fc.x_min) * rand() / RAND_MAX;
+            ys[k] = fc.y_min + (fc.y_max - fc.y_min) * rand() / RAND_MAX;
+            if(fc.y_integer) ys[k] = floor(ys[k] + .5);
+        }
+
+        double max_ulp = 0, sum_ulp = 0;
+        for(int k=0; k<n; ++k)
+        {
+            const double ulp = ulp_distance(fc.fast(xs[k], ys[k]), fc.exact(xs[k], ys[k]));
+            max_ulp = max(max_ulp, ulp);
+            sum_ulp += ulp;
+        }
+
+        const double t_exact = run("fastmath", string("libm_") + fc.name, "ns/call", n, [&]()
+        {
+            double sum = 0;
+            for(int k=0; k<n; ++k) sum += fc.exact(xs[k], ys[k]);
+            sink = sum;
+        });
+        const double t_fast = run("fastmath", string("fast_") + fc.name, "ns/call", n, [&]()
+        {
+            double sum = 0;
+            for(int k=0; k<n; ++k) sum += fc.fast(xs[k], ys[k]);
+            sink = sum;
+        });
+
+        if(t_exact > 0 && t_fast > 0)
+        {
+            cout << "# " << fc.name << ": max error " << max_ulp << " ulp (bound " << fc.max_ulp << "), mean "
+                 << sum_ulp / n << " ulp, speedup " << t_exact / t_fast << "\n";
+        }
+        if(max_ulp > fc.max_ulp)
+        {
+            cerr << "ERROR: fast " << fc.name << " is off by " << max_ulp << " ulp, more than documented\n";
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+static void make_surface(const string& name, Surface& surface)
+{
+    if(name == "sphere")
+    {
+        surface.add_aux("U=2*pi*u");
+        surface.add_aux("V=pi*v");
+        surface.set_formula('x', "cos(U) * sin(V)");
+        surface.set_formula('z', "sin(U) * sin(V)");
+        surface.set_formula('y', "cos(V)");
+    }
+    else if(name == "torus")
+    {
+        surface.add_aux("U=2*pi*u");
+        surface.add_aux("V=2*pi*v");
+        surface.add_aux("R=1");
+        surface.add_aux("r=.25");
+        surface.set_formula('x', "(R + r*cos(V)) * cos(U)");
+        surface.set_formula('y', "(R + r*cos(V)) * sin(U)");
+        surface.set_formula('z', "r*sin(V)");
+        surface.set_formula('r', ".5 + .5*cos(V)");
+    }
+    else if(name == "whirly")
+    {
+        surface.add_aux("U=2*pi*u");
+        surface.add_aux("V=2*pi*v");
+        surface.add_aux("R=1");
+        surface.add_aux("r=.25");
+        surface.set_formula('x', "cos(5*U) * (R + r*sin(V) + 2*r*cos(U))");
+        surface.set_formula('y', "sin(5*U) * (R + r*sin(V) + 2*r*cos(U))");
+        surface.set_formula('z', ".2*r*cos(V) + 5*r*sin(U)");
+        surface.set_formula('r', ".5 + .5*sin(U)");
+        surface.set_formula('g', ".5 + .5*sin(2*U)");
+        surface.set_formula('b', ".5 + .5*sin(5*U)");
+    }
+    surface.compile();
+}
+
+// Checks that the values of a swept variable (-A r=.1,.4 and such) reach the
+// grid exactly, also when set after compile() as for keyframes.
+static bool check_sweep_values()
+{
+    static const double values[] = { .1, .4, -.75, 1e-30, 12345.678 };
+
+    Surface surface;
+    surface.add_aux("r=0");
+    surface.set_formula('x', "r");
+    surface.compile();
+
+    bool ok = true;
+    for(size_t k=0; k<sizeof(values) / sizeof(*values); ++k)
+    {
+        Surface keyframe = surface;
+        keyframe.set_aux_value(0, values[k]);
+
+        vector<glm::vec3> positions(4 * 4), colors(2 * 2);
+        keyframe.eval_grid(2, 2, &positions[0], &colors[0]);
+        if(positions[5].x != float(values[k]))
+        {
+            cerr << "ERROR: swept variable set to " << values[k] << " evaluates to " << positions[5].x << "\n";
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// GL functions that only count their calls, for check_gl_state():
+static unsigned long n_gl_calls;
+static void GL_APIENTRY mock_use_program(GLuint) { ++ n_gl_calls; }
+static void GL_APIENTRY mock_bind_buffer(GLenum, GLuint) { ++ n_gl_calls; }
+static void GL_APIENTRY mock_attrib_array(GLuint) { ++ n_gl_calls; }
+static void GL_APIENTRY mock_attrib_pointer(GLuint, GLint, GLenum, GLboolean, GLsizei, const void*) { ++ n_gl_calls; }
+static void GL_APIENTRY mock_capability(GLenum) { ++ n_gl_calls; }
+static void GL_APIENTRY mock_polygon_offset(GLfloat, GLfloat) { ++ n_gl_calls; }
+static void GL_APIENTRY mock_uniform_matrix4(GLint, GLsizei, GLboolean, const GLfloat*) { ++ n_gl_calls; }
+
+// Checks that GLState forwards changes of the state, and skips and counts
+// calls that don't change it, without a GL context.
+static bool check_gl_state()
+{
+    GLDispatch gl;
+    gl.UseProgram = mock_use_program;
+    gl.BindBuffer = mock_bind_buffer;
+    gl.EnableVertexAttribArray = mock_attrib_array;
+    gl.DisableVertexAttribArray = mock_attrib_array;
+    gl.VertexAttribPointer = mock_attrib_pointer;
+    gl.Enable = mock_capability;
+    gl.Disable = mock_capability;
+    gl.PolygonOffset = mock_polygon_offset;
+    gl.UniformMatrix4fv = mock_uniform_matrix4;
+    GLState state(gl);
+
+    static const GLfloat matrix[16] = { 1, 0, 0, 0,  0, 1, 0, 0,  0, 0, 1, 0,  0, 0, 0, 1 };
+    const unsigned long n_changes = 9;  // of a pass below, with two attribute arrays
+
+    bool ok = true;
+    for(int pass=0; pass<2; ++pass)
+    {
+        n_gl_calls = 0;
+        state.use_program(3);
+        state.bind_buffer(GL_ARRAY_BUFFER, 5);
+        state.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 6);
+        state.set_attrib_arrays(1u << 0 | 1u << 2);
+        state.attrib_pointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+        state.set_capability(GL_CULL_FACE, true);
+        state.polygon_offset(1, 1);
+        state.uniform_matrix4(2, matrix);
+
+        // The first pass changes everything, the second nothing:
+        const GLState::Stats stats = state.take_stats();
+        const unsigned long expected_calls = pass == 0 ? n_changes : 0;
+        if(n_gl_calls != expected_calls || stats.issued != expected_calls || stats.elided != n_changes - expected_calls)
+        {
+            cerr << "ERROR: GLState pass " << (pass + 1) << " made " << n_gl_calls << " GL calls, counted "
+                 << stats.issued << " issued and " << stats.elided << " elided, expected " << expected_calls
+                 << " issued and " << (n_changes - expected_calls) << " elided\n";
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+static const char *surface_names[] = { "sphere", "torus", "whirly" };
+static const int grid_sizes[] = { 32, 64, 128, 256 };
+
+// Discards the vertex data of stream_grid().
+class NullSink : public VertexSink
+{
+public:
+    void write_rows(int, int, const glm::vec3*, const glm::vec3*, const glm::vec3* normals) { sink = normals[0].x; }
+};
+
+// Runs stream_grid() on a FunctionSurface, to compare with the interpreted
+// surface of the same name.
+template <class S>
+static void bench_function_surface(const string& name, S surface)
+{
+    for(int g=0; g<4; ++g)
+    {
+        const int res = grid_sizes[g];
+        stringstream param;
+        param << name << '_' << res << 'x' << res;
+
+        NullSink null_sink;
+        run("stream_compiled", param.str(), "ns/vertex", res * res, [&]()
+        {
+            stream_grid(surface, res, res, max(1, 16384 / res), null_sink);
+        });
+    }
+}
+
+static void bench_grid()
+{
+    for(int s=0; s<3; ++s)
+    {
+        Surface surface;
+        make_surface(surface_names[s], surface);
+
+        for(int g=0; g<4; ++g)
+        {
+            const int res = grid_sizes[g];
+            vector<glm::vec3> positions((res + 2) * (res + 2));
+            vector<glm::vec3> colors(res * res);
+
+            stringstream param;
+            param << surface_names[s] << '_' << res << 'x' << res;
+            run("grid", param.str(), "ns/vertex", res * res, [&]()
+            {
+                surface.eval_grid(res, res, &positions[0], &colors[0]);
+            });
+
+            // Evaluation and normals fused, as done by Graphics::load_scene:
+            NullSink null_sink;
+            run("stream", param.str(), "ns/vertex", res * res, [&]()
+            {
+                stream_grid(surface, res, res, max(1, 16384 / res), null_sink);
+            });
+        }
+    }
+}
+
+// The surfaces of make_surface() as C++ functions:
+static void bench_compiled_grid()
+{
+    bench_function_surface("sphere", make_function_surface(
+        [](double u, double v) { return cos(2*M_PI*u) * sin(M_PI*v); },
+        [](double, double v) { return cos(M_PI*v); },
+        [](double u, double v) { return sin(2*M_PI*u) * sin(M_PI*v); }));
+
+    bench_function_surface("torus", make_function_surface(
+        [](double u, double v) { return (1 + .25*cos(2*M_PI*v)) * cos(2*M_PI*u); },
+        [](double u, double v) { return (1 + .25*cos(2*M_PI*v)) * sin(2*M_PI*u); },
+        [](double, double v) { return .25*sin(2*M_PI*v); },
+        [](double, double v) { return .5 + .5*cos(2*M_PI*v); },
+        ConstantFunction(1), ConstantFunction(1)));
+
+    bench_function_surface("whirly", make_function_surface(
+        [](double u, double v) { return cos(10*M_PI*u) * (1 + .25*sin(2*M_PI*v) + .5*cos(2*M_PI*u)); },
+        [](double u, double v) { return sin(10*M_PI*u) * (1 + .25*sin(2*M_PI*v) + .5*cos(2*M_PI*u)); },
+        [](double u, double v) { return .05*cos(2*M_PI*v) + 1.25*sin(2*M_PI*u); },
+        [](double u, double) { return .5 + .5*sin(2*M_PI*u); },
+        [](double u, double) { return .5 + .5*sin(4*M_PI*u); },
+        [](double u, double) { return .5 + .5*sin(10*M_PI*u); }));
+}
+
+static void bench_mesh()
+{
+    for(int s=0; s<3; ++s)
+    {
+        Surface surface;
+        make_surface(surface_names[s], surface);
+
+        for(int g=0; g<4; ++g)
+        {
+            const int res = grid_sizes[g];
+            vector<glm::vec3> positions((res + 2) * (res + 2));
+            vector<glm::vec3> colors(res * res);
+            vector<glm::vec3> normals(res * res);
+            surface.eval_grid(res, res, &positions[0], &colors[0]);
+
+            stringstream param;
+            param << surface_names[s] << '_' << res << 'x' << res;
+            run("normals", param.str(), "ns/vertex", res * res, [&]()
+            {
+                calc_normals(&positions[0], res, res, &normals[0]);
+            });
+
+            // Turning the grid into a mesh and welding it, as done by gen_model:
+            GridArraySink grid(res, res);
+            stream_grid(surface, res, res, max(1, 16384 / res), grid);
+            run("weld", param.str(), "ns/vertex", res * res, [&]()
+            {
+                Mesh mesh;
+                append_grid(grid.get_vertices(), res, res, mesh);
+                weld_vertices(mesh, 1e-5f);
+            });
+
+            // Decimating the welded mesh to a tenth of its triangles:
+            Mesh welded;
+            append_grid(grid.get_vertices(), res, res, welded);
+            weld_vertices(welded, 1e-5f);
+            run("decimate", param.str(), "ns/triangle", welded.n_triangles(), [&]()
+            {
+                Mesh mesh = welded;
+                decimate_mesh(mesh, mesh.n_triangles() / 10, HUGE_VAL);
+            });
+        }
+    }
+
+    for(int g=0; g<4; ++g)
+    {
+        const int res = grid_sizes[g];
+        vector<uint16_t> strip(n_strip_elements(res, res));
+        vector<uint16_t> wire(n_wire_elements(res, res));
+
+        stringstream param;
+        param << res << 'x' << res;
+        run("indices", param.str(), "ns/vertex", res * res, [&]()
+        {
+            gen_strip_indices(res, res, &strip[0]);
+            gen_wire_indices(res, res, &wire[0]);
+        });
+    }
+
+    // A million-vertex sphere, with positions calculated directly:
+    {
+        const int res = 1024;
+        vector<glm::vec3> positions((res + 2) * (res + 2));
+        vector<glm::vec3> normals(res * res);
+        for(int j=-1; j<res+1; ++j)
+        {
+            for(int i=-1; i<res+1; ++i)
+            {
+                const double U = 2 * M_PI * i / (res - 1), V = M_PI * j / (res - 1);
+                positions[(i + 1) + (res + 2) * (j + 1)] = glm::vec3(cos(U) * sin(V), cos(V), sin(U) * sin(V));
+            }
+        }
+
+        const int n_threads = max(1u, std::thread::hardware_concurrency());
+        for(int t=1; t<=n_threads; t *= 2)
+        {
+            stringstream param;
+            param << "sphere_" << res << 'x' << res << "_t" << t;
+            run("normals", param.str(), "ns/vertex", res * res, [&]()
+            {
+                calc_normals(&positions[0], res, res, &normals[0], t);
+            });
+        }
+    }
+}
+
+static void bench_implicit()
+{
+    static const char *names[] = { "sphere", "torus", "blobs" };
+    static const char *defs[] =
+    {
+        "x^2 + y^2 + z^2 - 1",
+        "(x^2 + y^2 + z^2 + .75)^2 - 4*(x^2 + y^2)",
+        "x^4 + y^4 + z^4 - x^2 - y^2 - z^2 + .4"
+    };
+
+    for(int s=0; s<3; ++s)
+    {
+        ImplicitSurface surface;
+        surface.set_formula(defs[s]);
+
+        for(int depth=5; depth<=7; ++depth)
+        {
+            // Time per cell of the whole grid, most of which gets pruned:
+            const int res = 1 << depth;
+            stringstream param;
+            param << names[s] << '_' << res << '^' << 3;
+            Mesh mesh;
+            run("implicit", param.str(), "ns/cell", 1.0 * res * res * res, [&]()
+            {
+                surface.polygonize(depth, 2, mesh);
+            });
+        }
+    }
+}
+
+// Reads exactly size bytes from fd.  Returns false on failure.
+static bool read_all(int fd, void *data, size_t size)
+{
+    char *p = static_cast<char*>(data);
+    while(size > 0)
+    {
+        const ssize_t n = read(fd, p, size);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Sends a request to a MeshServer and reads the response into mesh_data.
+// Returns false on failure.
+static bool request_mesh(int fd, const string& request, vector<char>& mesh_data)
+{
+    if(write(fd, request.data(), request.length()) != ssize_t(request.length())) return false;
+
+    MeshHeader header;
+    if(!read_all(fd, &header, sizeof(header)) || header.error_length > 0) return false;
+    mesh_data.resize(3 * sizeof(glm::vec3) * header.n_vertices + 3 * sizeof(uint32_t) * header.n_triangles);
+    return read_all(fd, &mesh_data[0], mesh_data.size());
+}
+
+// Requests/s of a MeshServer with the given number of concurrent clients,
+// each on its own connection, with and without the mesh cache.  The latency
+// percentiles of each run are printed as comments.
+static void bench_server()
+{
+    char tmp_dir[] = "/tmp/paramplot-bench-XXXXXX";
+    if(!mkdtemp(tmp_dir))
+    {
+        cerr << "WARNING: Can't create a temporary directory, skipping the server benchmark\n";
+        return;
+    }
+    setenv("XDG_CACHE_HOME", tmp_dir, 1);
+    const string socket_path = string(tmp_dir) + "/socket";
+
+    const string request = "e U=2*pi*u\ne V=pi*v\nx cos(U) * sin(V)\nz sin(U) * sin(V)\ny cos(V)\nu 64\nv 64\n\n";
+    const int n_threads = max(1u, std::thread::hardware_concurrency());
+    for(int cached=0; cached<2; ++cached)
+    {
+        ServerSettings settings;
+        settings.mesh_cache_size = cached ? 64 << 20 : 0;
+        MeshServer server(settings);
+        try
+        {
+            server.listen(socket_path);
+        }
+        catch(const string& e)
+        {
+            cerr << "WARNING: " << e << ", skipping the server benchmark\n";
+            break;
+        }
+        std::thread server_thread(&MeshServer::run, &server);
+
+        for(int c=1; c<=2*n_threads; c *= 2)
+        {
+            const int n_requests = cached ? 500 : 20;  // per client and run
+            vector<double> latencies;
+            std::mutex latencies_mutex;
+
+            stringstream param;
+            param << "sphere_64x64_" << (cached ? "cached" : "uncached") << "_c" << c;
+            const double median = run("serve", param.str(), "ns/request", 1.0 * c * n_requests, [&]()
+            {
+                vector<std::thread> clients;
+                for(int t=0; t<c; ++t)
+                {
+                    clients.push_back(std::thread([&]()
+                    {
+                        sockaddr_un addr;
+                        memset(&addr, 0, sizeof(addr));
+                        addr.sun_family = AF_UNIX;
+                        strcpy(addr.sun_path, socket_path.c_str());
+                        const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+                        if(connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0)
+                        {
+                            cerr << "ERROR: Can't connect to the server: " << strerror(errno) << "\n";
+                            exit(1);
+                        }
+
+                        vector<char> mesh_data;
+                        vector<double> client_latencies;
+                        for(int k=0; k<n_requests; ++k)
+                        {
+                            const double t0 = now_ns();
+                            if(!request_mesh(fd, request, mesh_data))
+                            {
+                                cerr << "ERROR: Request to the server failed\n";
+                                exit(1);
+                            }
+                            client_latencies.push_back(now_ns() - t0);
+                        }
+                        close(fd);
+
+                        lock_guard<std::mutex> lock(latencies_mutex);
+                        latencies.insert(latencies.end(), client_latencies.begin(), client_latencies.end());
+                    }));
+                }
+                for(int t=0; t<c; ++t) clients[t].join();
+            });
+
+            if(median > 0)
+            {
+                sort(latencies.begin(), latencies.end());
+                const size_t n = latencies.size();
+                cout << "# serve/" << param.str() << ": " << (1e9 / median) << " requests/s, latency "
+                     << 1e-3 * latencies[n / 2] << " us median, " << 1e-3 * latencies[min(n - 1, n * 99 / 100)]
+                     << " us 99th percentile, " << 1e-3 * latencies[n - 1] << " us max\n";
+            }
+        }
+
+        server.stop();
+        server_thread.join();
+    }
+
+    // Clean up the mesh cache:
+    const string cache_dir = get_cache_dir("meshes");
+    evict_cache_files(cache_dir, ".mesh", 0);
+    rmdir(cache_dir.c_str());
+    rmdir((string(tmp_dir) + "/rpi-simple-paramplot").c_str());
+    rmdir(tmp_dir);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    while((opt = getopt(argc, argv, "hn:f:")) != -1)
+    {
+        switch(opt)
+        {
+        case 'n':
+            repeats = max(1, atoi(optarg));
+            break;
+
+        case 'f':
+            filter = optarg;
+            break;
+
+        default:
+            cout << "Usage: " << argv[0] << " [-n <repeats>] [-f <name filter>]\n";
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    Evaluator::varlist_t varlist(corpus_vars, corpus_vars + sizeof(corpus_vars) / sizeof(*corpus_vars));
+    Evaluator::constmap_t constmap;
+    constmap["pi"] = M_PI;
+    constmap["e"] = M_E;
+
+    const vector<Formula> corpus = make_corpus();
+
+    cout << "# benchmark\tparam\trepeats\tunit\tmedian\tvariance\n";
+    try
+    {
+        bench_tokenizer(corpus);
+        bench_parser(corpus, varlist, constmap);
+        print_op_pairs(corpus, varlist, constmap);
+        bench_evaluate(corpus, varlist, constmap);
+        bench_grid();
+        bench_compiled_grid();
+        bench_mesh();
+        bench_implicit();
+        bench_server();
+        if(!check_sweep_values()) return 1;
+        if(!check_gl_state()) return 1;
+        if(!bench_fastmath()) return 1;
+    }
+    catch(const string& e)
+    {
+        cerr << "PARSE ERROR: " << e << "\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "cachedir.hpp"
+using namespace std;
+
+bool make_dirs(const string& path)
+{
+    for(size_t pos = 1; pos != string::npos; ++pos)
+    {
+        pos = path.find('/', pos);
+        const string part = path.substr(0, pos);
+        if(mkdir(part.c_str(), 0755) != 0 && errno != EEXIST) return false;
+        if(pos == string::npos) break;
+    }
+    return true;
+}
+
+string get_cache_dir(const string& name)
+{
+    string dir;
+    if(const char *xdg_cache = getenv("XDG_CACHE_HOME"))
+        dir = xdg_cache;
+    else if(const char *home = getenv("HOME"))
+        dir = string(home) + "/.cache";
+    else
+        return "";
+    dir += "/rpi-simple-paramplot/" + name;
+
+    if(!make_dirs(dir))
+    {
+        cerr << "WARNING: Can't create cache directory \"" << dir << "\": " << strerror(errno) << "\n";
+        return "";
+    }
+    return dir;
+}
+
+void evict_cache_files(const string& dir, const string& suffix, size_t max_size)
+{
+    DIR *d = opendir(dir.c_str());
+    if(!d) return;
+
+    // Find all entries, with their last use and size:
+    struct Entry
+    {
+        double last_use;  // modification time, in seconds
+        size_t size;
+        string path;
+
+        bool operator<(const Entry& other) const { return last_use < other.last_use; }
+    };
+    vector<Entry> entries;
+    size_t total_size = 0;
+    while(const dirent *ent = readdir(d))
+    {
+        const string name = ent->d_name;
+        if(name.length() <= suffix.length() || name.compare(name.length() - suffix.length(), string::npos, suffix) != 0)
+            continue;
+
+        Entry entry;
+        entry.path = dir + "/" + name;
+        struct stat st;
+        if(stat(entry.path.c_str(), &st) != 0) continue;
+        entry.last_use = st.st_mtim.tv_sec + 1e-9 * st.st_mtim.tv_nsec;
+        entry.size = st.st_size;
+        entries.push_back(entry);
+        total_size += entry.size;
+    }
+    closedir(d);
+
+    // Remove the least recently used ones:
+    sort(entries.begin(), entries.end());
+    for(size_t k=0; k<entries.size() && total_size > max_size; ++k)
+    {
+        if(remove(entries[k].path.c_str()) == 0) total_size -= entries[k].size;
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef CACHEDIR_HPP
+#define CACHEDIR_HPP
+
+#include <string>
+
+// Creates directory path and all its parents.  Returns false on failure.
+bool make_dirs(const std::string& path);
+
+// Returns the cache directory rpi-simple-paramplot/<name> below
+// $XDG_CACHE_HOME or ~/.cache, creating it if necessary.  Returns an empty
+// string (after printing a warning) if it can't be created.
+std::string get_cache_dir(const std::string& name);
+
+// Removes the least recently modified files with the given suffix from dir
+// until the remaining ones take at most max_size bytes.
+void evict_cache_files(const std::string& dir, const std::string& suffix, size_t max_size);
+
+#endif  // CACHEDIR_HPP
@@ -0,0 +1,129 @@
+#include <cerrno>
+#include <cmath>
+#include <time.h>
+#include "camera.hpp"
+using namespace std;
+using namespace glm;
+
+static const double step_rate = 120;  // steps per second
+static const float damping = 13.4;  // velocities shrink by exp(-damping) per second
+static const float key_speed_angle = 120;  // degrees per second, with a key held down
+static const float key_speed_z = 4.8;  // units per second, with a key held down
+static const float eps_angle = 0.06, eps_z = 6e-4;  // velocities below these count as rest
+
+// Returns the current time of a monotonic clock in seconds.
+static double get_time()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// Sleeps until the given time of the monotonic clock.
+static void sleep_until(double t)
+{
+    timespec ts;
+    ts.tv_sec = static_cast<time_t>(t);
+    ts.tv_nsec = static_cast<long>((t - ts.tv_sec) * 1e9);
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+CameraSimulation::CameraSimulation(const Camera& camera, const callback_t& on_update)
+ : on_update(on_update), snapshot(camera),
+   push_phi(0), push_theta(0), push_roll(0), push_z(0), keys(0), stopping(false),
+   camera(camera), v_phi(0), v_theta(0), v_roll(0), v_z(0)
+{
+    snapshot.publish(camera);
+    thread = std::thread(&CameraSimulation::run, this);
+}
+
+CameraSimulation::~CameraSimulation()
+{
+    {
+        lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    input.notify_one();
+    thread.join();
+}
+
+void CameraSimulation::push(float v_phi, float v_theta, float v_roll, float v_z)
+{
+    {
+        lock_guard<std::mutex> lock(mutex);
+        push_phi += v_phi;
+        push_theta += v_theta;
+        push_roll += v_roll;
+        push_z += v_z;
+    }
+    input.notify_one();
+}
+
+void CameraSimulation::set_keys(unsigned keys)
+{
+    {
+        lock_guard<std::mutex> lock(mutex);
+        if(keys == this->keys) return;
+        this->keys = keys;
+    }
+    input.notify_one();
+}
+
+void CameraSimulation::run()
+{
+    const float dt = 1 / step_rate;
+    const float damp = exp(-damping * dt);
+    // Keys accelerate so that the velocity settles at the key speed:
+    const float key_accel_angle = key_speed_angle * (1 - damp) / damp;
+    const float key_accel_z = key_speed_z * (1 - damp) / damp;
+
+    double next_step = get_time();
+    for(;;)
+    {
+        unsigned held;
+        {
+            unique_lock<std::mutex> lock(mutex);
+
+            // Sleep while nothing moves:
+            const bool resting = v_phi == 0 && v_theta == 0 && v_roll == 0 && v_z == 0;
+            while(!stopping && resting && keys == 0 && push_phi == 0 && push_theta == 0 && push_roll == 0 && push_z == 0)
+            {
+                input.wait(lock);
+                next_step = get_time();
+            }
+            if(stopping) return;
+
+            v_phi += push_phi;
+            v_theta += push_theta;
+            v_roll += push_roll;
+            v_z += push_z;
+            push_phi = push_theta = push_roll = push_z = 0;
+            held = keys;
+        }
+
+        if(held & CAM_KEY_RIGHT)   v_phi   += key_accel_angle;
+        if(held & CAM_KEY_LEFT)    v_phi   -= key_accel_angle;
+        if(held & CAM_KEY_DOWN)    v_theta += key_accel_angle;
+        if(held & CAM_KEY_UP)      v_theta -= key_accel_angle;
+        if(held & CAM_KEY_BACK)    v_z     += key_accel_z;
+        if(held & CAM_KEY_FORWARD) v_z     -= key_accel_z;
+
+        // Apply the movement:
+        const float rad = M_PI / 180 * dt;
+        camera.orient = normalize(cross(quat(vec3(rad * v_theta, rad * v_phi, -rad * v_roll)), camera.orient));
+        camera.pos_z = clamp(camera.pos_z + dt * v_z, 0.f, 100.f);
+        if(snapshot.publish(camera) && on_update) on_update();
+
+        // Dampen it, and stop when it's too slow to see:
+        v_phi *= damp;
+        v_theta *= damp;
+        v_roll *= damp;
+        v_z *= damp;
+        if(fabs(v_phi) < eps_angle && fabs(v_theta) < eps_angle && fabs(v_roll) < eps_angle && fabs(v_z) < eps_z)
+            v_phi = v_theta = v_roll = v_z = 0;
+
+        // Don't try to catch up with steps missed by more than one interval:
+        next_step = max(next_step + dt, get_time() - dt);
+        sleep_until(next_step);
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef CAMERA_HPP
+#define CAMERA_HPP
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "snapshot.hpp"
+
+// The camera looks at the origin from distance pos_z, turned by orient.
+struct Camera
+{
+    Camera() : orient(glm::vec3(0.f, 0.f, 0.f)), pos_z(7) {}
+
+    glm::quat orient;
+    float pos_z;
+};
+
+// Camera keys, for CameraSimulation::set_keys():
+enum
+{
+    CAM_KEY_LEFT = 1, CAM_KEY_RIGHT = 2, CAM_KEY_UP = 4, CAM_KEY_DOWN = 8,
+    CAM_KEY_FORWARD = 16, CAM_KEY_BACK = 32
+};
+
+// Moves the camera on a thread of its own, in fixed time steps, so that its
+// speed and damping don't depend on the frame rate and a slow frame doesn't
+// hold it up.  Input comes from the main thread, as SDL only delivers events
+// there.  After every step the camera is published through a Snapshot; while
+// nothing moves, the thread sleeps.
+class CameraSimulation
+{
+public:
+    typedef std::function<void()> callback_t;
+
+    // on_update is called from the simulation thread when a new camera is
+    // published and the previous one was already taken.
+    CameraSimulation(const Camera& camera, const callback_t& on_update);
+    ~CameraSimulation();
+
+    // Adds to the angular velocities (in degrees per second) and to the
+    // velocity along the view axis (in units per second).
+    void push(float v_phi, float v_theta, float v_roll, float v_z);
+
+    // Sets the camera keys which are held down (CAM_KEY_* flags).  They
+    // accelerate the camera in every step.
+    void set_keys(unsigned keys);
+
+    // If the camera moved since the last call, stores it in camera and
+    // returns true.  Must only be called from one thread.
+    bool take_camera(Camera& camera) { return snapshot.take(camera); }
+
+private:
+    CameraSimulation(const CameraSimulation&);
+    CameraSimulation& operator=(const CameraSimulation&);
+
+    void run();
+
+    callback_t on_update;
+    Snapshot<Camera> snapshot;
+
+    // Input from the main thread, protected by mutex:
+    float push_phi, push_theta, push_roll, push_z;
+    unsigned keys;
+    bool stopping;
+    std::mutex mutex;
+    std::condition_variable input;
+
+    // State of the simulation thread:
+    Camera camera;
+    float v_phi, v_theta, v_roll, v_z;
+    std::thread thread;
+};
+
+#endif  // CAMERA_HPP
@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <GLES2/gl2.h>
+#include "capture.hpp"
+#include "cachedir.hpp"
+#include "exceptions.hpp"
+using namespace std;
+
+static const int n_buffers = 8;
+
+FrameCapture::FrameCapture(const string& path, int width, int height, int fps)
+  : path(path), width(width), height(height), video(NULL), n_frames(0), stopping(false), next_write(0), failed(false)
+{
+    const string suffix = ".y4m";
+    y4m = path.size() >= suffix.size() && path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0;
+    if(y4m)
+    {
+        video = fopen(path.c_str(), "wb");
+        if(!video) throw SysException(path);
+        // 4:2:0 chroma with full range JPEG coefficients:
+        fprintf(video, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, fps);
+    }
+    else if(!make_dirs(path))
+        throw SysException(path);
+
+    buffers.resize(n_buffers);
+    for(int b=0; b<n_buffers; ++b)
+    {
+        buffers[b].resize(4 * width * height);
+        free_buffers.push_back(b);
+    }
+
+    // Leave a core for rendering:
+    const unsigned n_workers = max(1u, thread::hardware_concurrency() / 2);
+    for(unsigned k=0; k<n_workers; ++k)
+        workers.push_back(thread(&FrameCapture::run_worker, this));
+}
+
+FrameCapture::~FrameCapture()
+{
+    {
+        lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    queued.notify_all();
+    for(size_t k=0; k<workers.size(); ++k) workers[k].join();
+
+    if(video && fclose(video) != 0 && !failed)
+        cerr << "WARNING: Can't write \"" << path << "\": " << strerror(errno) << "\n";
+}
+
+void FrameCapture::grab()
+{
+    int b;
+    {
+        lock_guard<std::mutex> lock(mutex);
+        if(free_buffers.empty())
+        {
+            ++ stats.n_dropped;
+            return;
+        }
+        b = free_buffers.back();
+        free_buffers.pop_back();
+    }
+
+    // (GL ES 2 has no pixel buffer objects, so this waits for the frame to
+    // be finished, but not for anything else.)
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, &buffers[b][0]);
+
+    {
+        lock_guard<std::mutex> lock(mutex);
+        queue.push_back(make_pair(b, n_frames++));
+        stats.max_queued = max(stats.max_queued, queue.size());
+    }
+    queued.notify_one();
+}
+
+FrameCapture::Stats FrameCapture::take_stats()
+{
+    lock_guard<std::mutex> lock(mutex);
+    const Stats s = stats;
+    stats = Stats();
+    stats.max_queued = queue.size();
+    return s;
+}
+
+void FrameCapture::run_worker()
+{
+    vector<uint8_t> out;
+    for(;;)
+    {
+        pair<int, unsigned long> frame;
+        {
+            unique_lock<std::mutex> lock(mutex);
+            while(queue.empty() && !stopping) queued.wait(lock);
+            if(queue.empty()) return;
+            frame = queue.front();
+            queue.pop_front();
+        }
+
+        if(y4m)
+            encode_y4m(&buffers[frame.first][0], out);
+        else
+            encode_ppm(&buffers[frame.first][0], out);
+
+        {
+            lock_guard<std::mutex> lock(mutex);
+            free_buffers.push_back(frame.first);
+        }
+
+        write(frame.second, out);
+    }
+}
+
+void FrameCapture::encode_ppm(const uint8_t* frame, vector<uint8_t>& out) const
+{
+    char header[64];
+    const int header_size = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+    out.assign(header, header + header_size);
+    out.resize(header_size + 3 * width * height);
+
+    uint8_t *dst = &out[header_size];
+    for(int y=height-1; y>=0; --y)
+    {
+        const uint8_t *src = frame + 4 * width * y;
+        for(int x=0; x<width; ++x, src+=4, dst+=3)
+        {
+            dst[0] = src[0];
+            dst[1] = src[1];
+            dst[2] = src[2];
+        }
+    }
+}
+
+void FrameCapture::encode_y4m(const uint8_t* frame, vector<uint8_t>& out) const
+{
+    static const char header[] = "FRAME\n";
+    const int cw = (width + 1) / 2, ch = (height + 1) / 2;
+    out.assign(header, header + sizeof(header) - 1);
+    out.resize(out.size() + width * height + 2 * cw * ch);
+    uint8_t *luma = &out[sizeof(header) - 1], *cb = luma + width * height, *cr = cb + cw * ch;
+
+    for(int y=0; y<height; ++y)
+    {
+        const uint8_t *src = frame + 4 * width * (height - 1 - y);
+        for(int x=0; x<width; ++x, src+=4)
+            luma[width * y + x] = uint8_t(.299f * src[0] + .587f * src[1] + .114f * src[2] + .5f);
+    }
+
+    // Average the colors of each 2x2 block (clamped at odd edges):
+    for(int cy=0; cy<ch; ++cy)
+    {
+        for(int cx=0; cx<cw; ++cx)
+        {
+            float r = 0, g = 0, b = 0;
+            for(int k=0; k<4; ++k)
+            {
+                const int x = min(2 * cx + (k & 1), width - 1), y = min(2 * cy + (k >> 1), height - 1);
+                const uint8_t *src = frame + 4 * (width * (height - 1 - y) + x);
+                r += src[0];
+                g += src[1];
+                b += src[2];
+            }
+            r *= .25f;  g *= .25f;  b *= .25f;
+            cb[cw * cy + cx] = uint8_t(128.5f - .168736f * r - .331264f * g + .5f * b);
+            cr[cw * cy + cx] = uint8_t(128.5f + .5f * r - .418688f * g - .081312f * b);
+        }
+    }
+}
+
+void FrameCapture::write(unsigned long number, const vector<uint8_t>& data)
+{
+    bool ok = true;
+    if(y4m)
+    {
+        unique_lock<std::mutex> lock(write_mutex);
+        while(next_write != number) written.wait(lock);
+        ok = !failed && fwrite(&data[0], 1, data.size(), video) == data.size();
+        ++ next_write;
+        written.notify_all();
+    }
+    else
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "/frame%06lu.ppm", number);
+        const string filename = path + name;
+        FILE *file = fopen(filename.c_str(), "wb");
+        ok = file && fwrite(&data[0], 1, data.size(), file) == data.size();
+        if(file && fclose(file) != 0) ok = false;
+    }
+
+    lock_guard<std::mutex> lock(write_mutex);
+    if(ok)
+    {
+        lock_guard<std::mutex> stats_lock(mutex);
+        ++ stats.n_written;
+    }
+    else if(!failed)
+    {
+        // Only warn once:
+        failed = true;
+        cerr << "WARNING: Can't write captured frames to \"" << path << "\": " << strerror(errno) << "\n";
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef CAPTURE_HPP
+#define CAPTURE_HPP
+
+#include <cinttypes>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Records the rendered frames, for demos.  The render thread only reads each
+// frame back into one of a ring of buffers; converting and writing it is up
+// to worker threads, so compression and disk I/O never hold up rendering.
+// When all buffers are waiting for the workers, frames are dropped (and
+// counted) instead.
+class FrameCapture
+{
+public:
+    // Numbers of frames since the last take_stats().
+    struct Stats
+    {
+        Stats() : n_written(0), n_dropped(0), max_queued(0) {}
+        unsigned long n_written, n_dropped;
+        size_t max_queued;  // most frames waiting for a worker at once
+    };
+
+    // Writes frames of width*height pixels to path: as a YUV4MPEG2 video at
+    // fps frames per second if it ends in ".y4m", otherwise as numbered PPM
+    // images into the directory path, which is created if necessary.  Throws
+    // SysException on failure.
+    FrameCapture(const std::string& path, int width, int height, int fps);
+    // Writes the queued frames and stops the workers.
+    ~FrameCapture();
+
+    // Reads the current frame from the bound framebuffer (before it is
+    // swapped) and queues it.
+    void grab();
+
+    Stats take_stats();
+    unsigned long get_n_frames() const { return n_frames; }
+
+private:
+    FrameCapture(const FrameCapture&);
+    FrameCapture& operator=(const FrameCapture&);
+
+    void run_worker();
+    // Converts frame (RGBA, bottom row first) to the output format.
+    void encode_ppm(const uint8_t* frame, std::vector<uint8_t>& out) const;
+    void encode_y4m(const uint8_t* frame, std::vector<uint8_t>& out) const;
+    void write(unsigned long number, const std::vector<uint8_t>& data);
+
+    std::string path;
+    bool y4m;
+    int width, height;
+    FILE *video;  // if y4m
+
+    std::vector<std::vector<uint8_t> > buffers;
+    std::vector<int> free_buffers;
+    std::deque<std::pair<int, unsigned long> > queue;  // buffers with frame numbers, oldest first
+    unsigned long n_frames;  // grabbed so far, and the number of the next one
+    bool stopping;
+    Stats stats;
+    std::mutex mutex;
+    std::condition_variable queued;
+
+    // Video frames must be written in order, so each worker waits for the
+    // previous frame (without holding up grab()):
+    unsigned long next_write;
+    bool failed;
+    std::mutex write_mutex;
+    std::condition_variable written;
+
+    std::vector<std::thread> workers;
+};
+
+#endif  // CAPTURE_HPP
@@ -0,0 +1,25 @@
+attribute vec4 pos;
+attribute vec3 col;
+attribute vec3 norm;
+
+uniform mat4 mat_modelview;
+uniform mat4 mat_projection;
+
+varying vec3 color;
+
+// The lighting of shiny.fs, per vertex.
+void main()
+{
+    vec4 cam_pos = mat_modelview * pos;
+    gl_Position = mat_projection * cam_pos;
+
+    vec3 position = cam_pos.xyz;
+    vec3 normal = normalize(mat3(mat_modelview) * norm);
+    const vec3 light_pos = vec3(0, 0, 0);
+    vec3 to_light_norm = normalize(light_pos - position);
+    vec3 half_vec = normalize(normalize(-position) + to_light_norm);
+
+    // Ambient, diffuse and specular:
+    color = col * (0.01 + 0.3 * abs(dot(normal, to_light_norm))
+                        + 0.7 * pow(abs(dot(normal, half_vec)), 10.0));
+}
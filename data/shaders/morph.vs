@@ -0,0 +1,22 @@
+attribute vec4 pos0, pos1;
+attribute vec3 col0, col1;
+attribute vec3 norm0, norm1;
+
+uniform mat4 mat_modelview;
+uniform mat4 mat_projection;
+uniform float blend;  // from keyframe 0 to 1
+
+varying vec3 position;
+varying vec3 color;
+varying vec3 transf_normal;
+
+// shiny.vs for a vertex between two keyframes.
+void main()
+{
+    vec4 cam_pos = mat_modelview * mix(pos0, pos1, blend);
+    gl_Position = mat_projection * cam_pos;
+
+    position = cam_pos.xyz;
+    color = mix(col0, col1, blend);
+    transf_normal = mat3(mat_modelview) * mix(norm0, norm1, blend);
+}
@@ -0,0 +1,12 @@
+precision mediump float;
+
+uniform sampler2D tex;
+uniform vec2 tex_max;
+
+varying vec2 tex_coord;
+
+void main()
+{
+    // Don't filter in texels outside of the rendered part:
+    gl_FragColor = texture2D(tex, min(tex_coord, tex_max));
+}
@@ -0,0 +1,11 @@
+attribute vec2 pos;
+
+uniform vec2 tex_scale;
+
+varying vec2 tex_coord;
+
+void main()
+{
+    gl_Position = vec4(pos, 0, 1);
+    tex_coord = (.5 * pos + .5) * tex_scale;
+}
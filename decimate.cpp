@@ -0,0 +1,531 @@
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+#include "decimate.hpp"
+using namespace std;
+using namespace glm;
+
+namespace {
+
+// The sum of the squared distances of a point from a set of planes, as a
+// symmetric 4x4 matrix Q, so that the error of p is (p,1)^T Q (p,1).
+struct Quadric
+{
+    Quadric() { fill(q, q + 10, 0.0); }
+
+    // Adds the plane through p with unit normal n.
+    void add_plane(const dvec3& n, const dvec3& p)
+    {
+        const double v[4] = { n.x, n.y, n.z, -dot(n, p) };
+        int k = 0;
+        for(int i=0; i<4; ++i)
+        {
+            for(int j=i; j<4; ++j) q[k ++] += v[i] * v[j];
+        }
+    }
+
+    Quadric& operator+=(const Quadric& other)
+    {
+        for(int k=0; k<10; ++k) q[k] += other.q[k];
+        return *this;
+    }
+
+    double error(const dvec3& p) const
+    {
+        const double e = q[0] * p.x * p.x + 2 * q[1] * p.x * p.y + 2 * q[2] * p.x * p.z + 2 * q[3] * p.x
+                       + q[4] * p.y * p.y + 2 * q[5] * p.y * p.z + 2 * q[6] * p.y
+                       + q[7] * p.z * p.z + 2 * q[8] * p.z + q[9];
+        return max(e, 0.0);  // against rounding
+    }
+
+    // Finds the point of least error.  Returns false if there is no unique
+    // one, as within a flat region.
+    bool minimize(dvec3& p) const
+    {
+        // Solve A p = b by Cramer's rule:
+        const double a00 = q[0], a01 = q[1], a02 = q[2], a11 = q[4], a12 = q[5], a22 = q[7];
+        const double b0 = -q[3], b1 = -q[6], b2 = -q[8];
+        const double c00 = a11 * a22 - a12 * a12, c01 = a02 * a12 - a01 * a22, c02 = a01 * a12 - a02 * a11;
+        const double det = a00 * c00 + a01 * c01 + a02 * c02;
+        const double trace = a00 + a11 + a22;
+        if(!(fabs(det) > 1e-6 * trace * trace * trace)) return false;
+
+        const double c11 = a00 * a22 - a02 * a02, c12 = a01 * a02 - a00 * a12, c22 = a00 * a11 - a01 * a01;
+        p = dvec3(c00 * b0 + c01 * b1 + c02 * b2,
+                  c01 * b0 + c11 * b1 + c12 * b2,
+                  c02 * b0 + c12 * b1 + c22 * b2) / det;
+        return true;
+    }
+
+    double q[10];  // xx, xy, xz, xw, yy, yz, yw, zz, zw, ww
+};
+
+// A planned edge collapse, which merges vertex remove into vertex keep.
+struct Collapse
+{
+    double cost;
+    uint32_t keep, remove;
+    uint32_t keep_version, remove_version;  // to recognize outdated plans
+    vec3 position;  // of the merged vertex
+    float t;  // where its color and normal are taken, from keep (0) to remove (1)
+
+    // For a queue with the cheapest collapse on top:
+    bool operator<(const Collapse& other) const { return cost > other.cost; }
+};
+
+// Returns the distance of p from the triangle (a, b, c).
+double triangle_distance(const dvec3& p, const dvec3& a, const dvec3& b, const dvec3& c)
+{
+    // Find the closest point by the region of the triangle p projects to
+    // (from Ericson, "Real-Time Collision Detection"):
+    const dvec3 ab = b - a, ac = c - a, ap = p - a;
+    const double d1 = dot(ab, ap), d2 = dot(ac, ap);
+    if(d1 <= 0 && d2 <= 0) return length(ap);
+
+    const dvec3 bp = p - b;
+    const double d3 = dot(ab, bp), d4 = dot(ac, bp);
+    if(d3 >= 0 && d4 <= d3) return length(bp);
+
+    const double vc = d1 * d4 - d3 * d2;
+    if(vc <= 0 && d1 >= 0 && d3 <= 0) return length(p - (a + d1 / (d1 - d3) * ab));
+
+    const dvec3 cp = p - c;
+    const double d5 = dot(ab, cp), d6 = dot(ac, cp);
+    if(d6 >= 0 && d5 <= d6) return length(cp);
+
+    const double vb = d5 * d2 - d1 * d6;
+    if(vb <= 0 && d2 >= 0 && d6 <= 0) return length(p - (a + d2 / (d2 - d6) * ac));
+
+    const double va = d3 * d6 - d5 * d4;
+    if(va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) return length(p - (b + (d4 - d3) / ((d4 - d3) + (d5 - d6)) * (c - b)));
+
+    const double denom = va + vb + vc;
+    if(!(denom > 0)) return length(ap);  // degenerate triangle
+    return length(p - (a + ab * (vb / denom) + ac * (vc / denom)));
+}
+
+// Returns the largest distance of any of points from the triangles of mesh.
+double max_distance(const vector<vec3>& points, const Mesh& mesh)
+{
+    // Put the triangles into the cells of a uniform grid, about one per cell:
+    dvec3 lo(HUGE_VAL), hi(-HUGE_VAL);
+    for(size_t k=0; k<mesh.triangles.size(); ++k)
+    {
+        const dvec3 p(mesh.positions[mesh.triangles[k]]);
+        if(!std::isfinite(p.x + p.y + p.z)) continue;
+        lo = glm::min(lo, p);
+        hi = glm::max(hi, p);
+    }
+    if(!(lo.x <= hi.x)) return 0;
+
+    const double extent = std::max(hi.x - lo.x, std::max(hi.y - lo.y, hi.z - lo.z));
+    const double cell_size = std::max(extent / ceil(cbrt(double(mesh.n_triangles()))), 1e-6 * extent + 1e-30);
+    int dims[3];
+    for(int a=0; a<3; ++a) dims[a] = std::max(1, int(ceil((hi[a] - lo[a]) / cell_size)));
+
+    vector<vector<uint32_t> > cells(size_t(dims[0]) * dims[1] * dims[2]);
+    struct Grid
+    {
+        const dvec3& lo;
+        double cell_size;
+        const int *dims;
+
+        int coord(double x, int a) const { return glm::clamp(int(floor((x - lo[a]) / cell_size)), 0, dims[a] - 1); }
+        size_t index(int x, int y, int z) const { return x + size_t(dims[0]) * (y + size_t(dims[1]) * z); }
+
+        double box_distance(const dvec3& p, int x, int y, int z) const
+        {
+            const dvec3 box_lo = lo + cell_size * dvec3(x, y, z);
+            const dvec3 d = glm::max(glm::max(box_lo - p, p - (box_lo + dvec3(cell_size))), dvec3(0));
+            return length(d);
+        }
+    } grid = { lo, cell_size, dims };
+
+    for(uint32_t t=0; t<mesh.n_triangles(); ++t)
+    {
+        dvec3 tlo(HUGE_VAL), thi(-HUGE_VAL);
+        for(int c=0; c<3; ++c)
+        {
+            tlo = glm::min(tlo, dvec3(mesh.positions[mesh.triangles[3 * t + c]]));
+            thi = glm::max(thi, dvec3(mesh.positions[mesh.triangles[3 * t + c]]));
+        }
+        if(!std::isfinite(tlo.x + tlo.y + tlo.z + thi.x + thi.y + thi.z)) continue;
+        for(int z = grid.coord(tlo.z, 2); z <= grid.coord(thi.z, 2); ++z)
+            for(int y = grid.coord(tlo.y, 1); y <= grid.coord(thi.y, 1); ++y)
+                for(int x = grid.coord(tlo.x, 0); x <= grid.coord(thi.x, 0); ++x)
+                    cells[grid.index(x, y, z)].push_back(t);
+    }
+
+    // Search the cells around each point in growing shells, until no
+    // triangle outside can be closer than the closest one found:
+    vector<size_t> last_query(mesh.n_triangles(), size_t(-1));
+    double max_dist = 0;
+    for(size_t k=0; k<points.size(); ++k)
+    {
+        const dvec3 p(points[k]);
+        if(!std::isfinite(p.x + p.y + p.z)) continue;
+
+        const int cx = grid.coord(p.x, 0), cy = grid.coord(p.y, 1), cz = grid.coord(p.z, 2);
+        const int max_r = std::max(dims[0], std::max(dims[1], dims[2]));
+        double dist = HUGE_VAL;
+        for(int r=0; r<=max_r && dist > (r - 1) * cell_size; ++r)
+        {
+            for(int z = std::max(cz - r, 0); z <= std::min(cz + r, dims[2] - 1); ++z)
+            {
+                for(int y = std::max(cy - r, 0); y <= std::min(cy + r, dims[1] - 1); ++y)
+                {
+                    for(int x = std::max(cx - r, 0); x <= std::min(cx + r, dims[0] - 1); ++x)
+                    {
+                        // Only the shell, the inside was searched before, and
+                        // only cells that may contain something closer:
+                        if(abs(x - cx) != r && abs(y - cy) != r && abs(z - cz) != r) continue;
+                        if(grid.box_distance(p, x, y, z) >= dist) continue;
+
+                        const vector<uint32_t>& cell = cells[grid.index(x, y, z)];
+                        for(size_t i=0; i<cell.size(); ++i)
+                        {
+                            const uint32_t t = cell[i];
+                            if(last_query[t] == k) continue;
+                            last_query[t] = k;
+                            const uint32_t *tri = &mesh.triangles[3 * t];
+                            dist = std::min(dist, triangle_distance(p, dvec3(mesh.positions[tri[0]]),
+                                                                    dvec3(mesh.positions[tri[1]]),
+                                                                    dvec3(mesh.positions[tri[2]])));
+                        }
+                    }
+                }
+            }
+        }
+        if(dist < HUGE_VAL) max_dist = std::max(max_dist, dist);
+    }
+    return max_dist;
+}
+
+class Decimator
+{
+public:
+    explicit Decimator(Mesh& mesh);
+
+    // Collapses edges until the limits are reached.
+    void run(size_t max_triangles, double max_error);
+
+    // Writes the remaining vertices and triangles back to the mesh.
+    void finish();
+
+private:
+    // Plans the collapse of the edge between a and b.  Returns false if it
+    // must not be collapsed.
+    bool plan(uint32_t a, uint32_t b, Collapse& collapse) const;
+    bool is_allowed(const Collapse& collapse) const;
+    void apply(const Collapse& collapse);
+
+    // Returns the vertices sharing a triangle with v.
+    void get_neighbors(uint32_t v, vector<uint32_t>& neighbors) const;
+    void push_edges(uint32_t v, bool only_higher);
+    void rebuild_queue();
+
+    Mesh& mesh;
+    double color_scale;  // distance equivalent of a color difference of 1
+    size_t n_triangles;
+    vector<Quadric> quadrics;
+    vector<vector<uint32_t> > vertex_triangles;  // may contain removed triangles
+    vector<bool> triangle_removed, vertex_removed, boundary;
+    vector<uint32_t> version;  // of each vertex, counted up when it changes
+
+    priority_queue<Collapse> queue;
+    size_t max_queue_size;  // rebuilt when it grows larger, as outdated plans pile up
+};
+
+Decimator::Decimator(Mesh& mesh)
+  : mesh(mesh), n_triangles(mesh.n_triangles()), quadrics(mesh.positions.size()),
+    vertex_triangles(mesh.positions.size()), triangle_removed(mesh.n_triangles()),
+    vertex_removed(mesh.positions.size()), boundary(mesh.positions.size()),
+    version(mesh.positions.size())
+{
+    vec3 lo(HUGE_VALF), hi(-HUGE_VALF);
+    for(size_t v=0; v<mesh.positions.size(); ++v)
+    {
+        const vec3& p = mesh.positions[v];
+        if(std::isfinite(p.x + p.y + p.z))
+        {
+            lo = glm::min(lo, p);
+            hi = glm::max(hi, p);
+        }
+    }
+    color_scale = lo.x <= hi.x ? 1e-2 * length(hi - lo) : 0;
+
+    // Count the triangles of each edge (by pair of vertices, lower first):
+    const uint64_t n_verts = mesh.positions.size();
+    unordered_map<uint64_t, int> edge_count;
+    for(size_t t=0; t<n_triangles; ++t)
+    {
+        const uint32_t *tri = &mesh.triangles[3 * t];
+        for(int k=0; k<3; ++k)
+        {
+            vertex_triangles[tri[k]].push_back(t);
+            const uint32_t a = min(tri[k], tri[(k + 1) % 3]), b = max(tri[k], tri[(k + 1) % 3]);
+            ++ edge_count[a * n_verts + b];
+        }
+
+        // Add the plane of the triangle to its vertices:
+        const dvec3 p0(mesh.positions[tri[0]]), p1(mesh.positions[tri[1]]), p2(mesh.positions[tri[2]]);
+        const dvec3 normal = cross(p1 - p0, p2 - p0);
+        const double len = length(normal);
+        if(!(len > 0) || std::isinf(len)) continue;
+        Quadric plane;
+        plane.add_plane(normal / len, p0);
+        for(int k=0; k<3; ++k) quadrics[tri[k]] += plane;
+    }
+
+    // Vertices on edges with one triangle (or more than two) stay in place:
+    for(unordered_map<uint64_t, int>::const_iterator it = edge_count.begin(); it != edge_count.end(); ++it)
+    {
+        if(it->second == 2) continue;
+        boundary[it->first / n_verts] = true;
+        boundary[it->first % n_verts] = true;
+    }
+
+    rebuild_queue();
+}
+
+void Decimator::get_neighbors(uint32_t v, vector<uint32_t>& neighbors) const
+{
+    neighbors.clear();
+    for(size_t k=0; k<vertex_triangles[v].size(); ++k)
+    {
+        const uint32_t t = vertex_triangles[v][k];
+        if(triangle_removed[t]) continue;
+        for(int c=0; c<3; ++c)
+        {
+            const uint32_t w = mesh.triangles[3 * t + c];
+            if(w != v) neighbors.push_back(w);
+        }
+    }
+    sort(neighbors.begin(), neighbors.end());
+    neighbors.erase(unique(neighbors.begin(), neighbors.end()), neighbors.end());
+}
+
+bool Decimator::plan(uint32_t a, uint32_t b, Collapse& collapse) const
+{
+    if(boundary[a] && boundary[b]) return false;
+
+    const Quadric& qa = quadrics[a];
+    Quadric q = quadrics[b];
+    q += qa;
+
+    // Collapse onto a boundary vertex, or else onto the point of least error
+    // if it is near the edge, or else onto the best of the ends and the
+    // midpoint:
+    const dvec3 pa(mesh.positions[a]), pb(mesh.positions[b]);
+    dvec3 p = pa;
+    double t = 0;
+    if(boundary[a] || boundary[b])
+    {
+        if(boundary[b]) swap(a, b);
+        p = dvec3(mesh.positions[a]);
+        t = 0;
+    }
+    else if(q.minimize(p) && length(p - (pa + pb) * .5) <= length(pb - pa))
+    {
+        t = clamp(dot(p - pa, pb - pa) / max(dot(pb - pa, pb - pa), 1e-300), 0.0, 1.0);
+    }
+    else
+    {
+        const double candidates[3] = { 0, .5, 1 };
+        double best = HUGE_VAL;
+        for(int k=0; k<3; ++k)
+        {
+            const dvec3 pk = pa + candidates[k] * (pb - pa);
+            const double e = q.error(pk);
+            if(e < best)
+            {
+                best = e;
+                p = pk;
+                t = candidates[k];
+            }
+        }
+    }
+
+    const double color_change = color_scale * max(t, 1 - t) * length(mesh.colors[a] - mesh.colors[b]);
+    collapse.cost = q.error(p) + color_change * color_change;
+    if(!(collapse.cost < HUGE_VAL)) return false;  // with NaN or infinite positions
+    collapse.keep = a;
+    collapse.remove = b;
+    collapse.keep_version = version[a];
+    collapse.remove_version = version[b];
+    collapse.position = vec3(p);
+    collapse.t = t;
+    return true;
+}
+
+bool Decimator::is_allowed(const Collapse& collapse) const
+{
+    const uint32_t a = collapse.keep, b = collapse.remove;
+
+    // The vertices may only have the vertices opposite their common edge in
+    // common, or the mesh would fold onto itself:
+    vector<uint32_t> na, nb, common;
+    get_neighbors(a, na);
+    get_neighbors(b, nb);
+    set_intersection(na.begin(), na.end(), nb.begin(), nb.end(), back_inserter(common));
+    size_t n_shared = 0;
+    for(size_t k=0; k<vertex_triangles[a].size(); ++k)
+    {
+        const uint32_t t = vertex_triangles[a][k];
+        if(triangle_removed[t]) continue;
+        const uint32_t *tri = &mesh.triangles[3 * t];
+        if(tri[0] == b || tri[1] == b || tri[2] == b) ++ n_shared;
+    }
+    if(n_shared == 0 || common.size() != n_shared) return false;
+
+    // No remaining triangle may flip over:
+    const uint32_t ends[2] = { a, b };
+    for(int e=0; e<2; ++e)
+    {
+        const uint32_t v = ends[e];
+        for(size_t k=0; k<vertex_triangles[v].size(); ++k)
+        {
+            const uint32_t t = vertex_triangles[v][k];
+            if(triangle_removed[t]) continue;
+            const uint32_t *tri = &mesh.triangles[3 * t];
+            if((tri[0] == a || tri[1] == a || tri[2] == a) && (tri[0] == b || tri[1] == b || tri[2] == b)) continue;
+
+            vec3 p[3];
+            for(int c=0; c<3; ++c) p[c] = tri[c] == v ? collapse.position : mesh.positions[tri[c]];
+            const vec3 old_normal = cross(mesh.positions[tri[1]] - mesh.positions[tri[0]],
+                                          mesh.positions[tri[2]] - mesh.positions[tri[0]]);
+            const vec3 new_normal = cross(p[1] - p[0], p[2] - p[0]);
+            if(!(dot(old_normal, new_normal) > 0)) return false;
+        }
+    }
+    return true;
+}
+
+void Decimator::apply(const Collapse& collapse)
+{
+    const uint32_t a = collapse.keep, b = collapse.remove;
+    const float t = collapse.t;
+
+    mesh.positions[a] = collapse.position;
+    mesh.colors[a] = mix(mesh.colors[a], mesh.colors[b], t);
+    const vec3 normal = mix(mesh.normals[a], mesh.normals[b], t);
+    if(length(normal) > 0) mesh.normals[a] = normalize(normal);
+    quadrics[a] += quadrics[b];
+
+    // Remove the triangles of the edge and move the others of b to a:
+    for(size_t k=0; k<vertex_triangles[b].size(); ++k)
+    {
+        const uint32_t t = vertex_triangles[b][k];
+        if(triangle_removed[t]) continue;
+        uint32_t *tri = &mesh.triangles[3 * t];
+        if(tri[0] == a || tri[1] == a || tri[2] == a)
+        {
+            triangle_removed[t] = true;
+            -- n_triangles;
+            continue;
+        }
+        for(int c=0; c<3; ++c)
+        {
+            if(tri[c] == b) tri[c] = a;
+        }
+        vertex_triangles[a].push_back(t);
+    }
+
+    vector<uint32_t>& tris = vertex_triangles[a];
+    size_t n = 0;
+    for(size_t k=0; k<tris.size(); ++k)
+    {
+        if(!triangle_removed[tris[k]]) tris[n ++] = tris[k];
+    }
+    tris.resize(n);
+    vector<uint32_t>().swap(vertex_triangles[b]);
+
+    vertex_removed[b] = true;
+    ++ version[a];
+
+    push_edges(a, false);
+}
+
+void Decimator::push_edges(uint32_t v, bool only_higher)
+{
+    vector<uint32_t> neighbors;
+    get_neighbors(v, neighbors);
+    for(size_t k=0; k<neighbors.size(); ++k)
+    {
+        if(only_higher && neighbors[k] < v) continue;
+        Collapse collapse;
+        if(plan(v, neighbors[k], collapse)) queue.push(collapse);
+    }
+}
+
+void Decimator::rebuild_queue()
+{
+    queue = priority_queue<Collapse>();
+    for(uint32_t v=0; v<mesh.positions.size(); ++v)
+    {
+        if(!vertex_removed[v]) push_edges(v, true);
+    }
+    max_queue_size = max<size_t>(2 * queue.size(), 1024);
+}
+
+void Decimator::run(size_t max_triangles, double max_error)
+{
+    const double max_cost = max_error * max_error;
+    while(n_triangles > max_triangles && !queue.empty())
+    {
+        const Collapse collapse = queue.top();
+        queue.pop();
+        if(vertex_removed[collapse.keep] || vertex_removed[collapse.remove]
+           || version[collapse.keep] != collapse.keep_version || version[collapse.remove] != collapse.remove_version)
+        {
+            continue;
+        }
+        if(collapse.cost > max_cost) break;
+        if(!is_allowed(collapse)) continue;
+
+        apply(collapse);
+        if(queue.size() > max_queue_size) rebuild_queue();
+    }
+}
+
+void Decimator::finish()
+{
+    Mesh out;
+    vector<uint32_t> new_idx(mesh.positions.size());
+    for(size_t v=0; v<mesh.positions.size(); ++v)
+    {
+        if(vertex_removed[v]) continue;
+        new_idx[v] = out.positions.size();
+        out.positions.push_back(mesh.positions[v]);
+        out.colors.push_back(mesh.colors[v]);
+        out.normals.push_back(mesh.normals[v]);
+    }
+    for(size_t t=0; t<triangle_removed.size(); ++t)
+    {
+        if(triangle_removed[t]) continue;
+        for(int c=0; c<3; ++c) out.triangles.push_back(new_idx[mesh.triangles[3 * t + c]]);
+    }
+    swap(mesh, out);
+}
+
+}  // namespace
+
+DecimateStats decimate_mesh(Mesh& mesh, size_t max_triangles, double max_error)
+{
+    DecimateStats stats;
+    stats.n_triangles_before = mesh.n_triangles();
+    stats.n_vertices_before = mesh.positions.size();
+
+    const vector<vec3> original_positions = mesh.positions;
+    Decimator decimator(mesh);
+    decimator.run(max_triangles, max_error);
+    decimator.finish();
+    stats.max_deviation = max_distance(original_positions, mesh);
+
+    stats.n_triangles_after = mesh.n_triangles();
+    stats.n_vertices_after = mesh.positions.size();
+    return stats;
+}
@@ -0,0 +1,23 @@
+#ifndef DECIMATE_HPP
+#define DECIMATE_HPP
+
+#include "mesh.hpp"
+
+// Result of decimate_mesh().
+struct DecimateStats
+{
+    size_t n_triangles_before, n_triangles_after;
+    size_t n_vertices_before, n_vertices_after;
+    double max_deviation;  // largest distance of an original vertex from the simplified mesh
+};
+
+// Simplifies mesh by collapsing edges, cheapest first by the quadric error
+// metric (Garland & Heckbert), until it has at most max_triangles triangles
+// or the next collapse would move the surface by more than max_error.  Flat
+// regions go first.  Boundary edges are kept as they are, colors and normals
+// are interpolated along the collapsed edges, and collapses which would blend
+// different colors are penalized as if a color difference of 1 moved the
+// surface by 1% of the mesh size.  Takes O(n log n) time for n triangles.
+DecimateStats decimate_mesh(Mesh& mesh, size_t max_triangles, double max_error);
+
+#endif  // DECIMATE_HPP
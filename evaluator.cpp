@@ -3,8 +3,8 @@
 #include <cmath>
 #include <iostream>
 #include <sstream>
-#include <stack>
 #include "evaluator.hpp"
+#include "fastmath.hpp"
 using namespace std;
 
 Token Tokenizer::read_token()
@@ -159,137 +159,657 @@ Evaluator::Evaluator(const std::string& formula, const varlist_t& varlist, const
         msg << "at position " << tokenizer.get_pos_tokstart() << ": " << e;
         throw msg.str();
     }
+
+    compile();
+}
+
+const char *Operation::get_name(op_t op)
+{
+    static const char *const names[] =
+    {
+        "PUSH_NUM", "PUSH_VAR",
+        "EQ", "NEQ", "LT", "LE", "GE", "GT",
+        "IFELSE",
+        "ADD", "SUB", "MUL", "DIV",
+        "POW", "NEG", "ABS",
+        "SIN", "COS", "TAN",
+        "EXP",
+        "FAST_POW", "FAST_SIN", "FAST_COS", "FAST_TAN", "FAST_EXP",
+        "PUSH_VAR_MUL", "PUSH_NUM_MUL", "PUSH_VAR_ADD", "PUSH_NUM_ADD", "MUL_ADD",
+        "PUSH_VAR_SIN", "PUSH_VAR_COS", "PUSH_VAR_FAST_SIN", "PUSH_VAR_FAST_COS",
+        "JUMP", "JUMP_IF_ZERO", "RETURN"
+    };
+    static_assert(sizeof(names) / sizeof(*names) == Operation::RETURN + 1, "missing operation names");
+
+    return names[op];
 }
 
-double Evaluator::evaluate(const std::vector<double>& vars)
+// Returns the superinstruction doing a followed by b, or RETURN if there is
+// none.  The pairs are the most frequent ones in the formulas of the
+// benchmark corpus (see paramplot-bench -f op_pairs).
+static Operation::op_t fuse(Operation::op_t a, Operation::op_t b)
 {
-    stack<double, vector<double> > value_stack;
+    switch(a)
+    {
+    case Operation::PUSH_VAR:
+        switch(b)
+        {
+        case Operation::MUL: return Operation::PUSH_VAR_MUL;
+        case Operation::ADD: return Operation::PUSH_VAR_ADD;
+        case Operation::SIN: return Operation::PUSH_VAR_SIN;
+        case Operation::COS: return Operation::PUSH_VAR_COS;
+        case Operation::FAST_SIN: return Operation::PUSH_VAR_FAST_SIN;
+        case Operation::FAST_COS: return Operation::PUSH_VAR_FAST_COS;
+        default: return Operation::RETURN;
+        }
+
+    case Operation::PUSH_NUM:
+        switch(b)
+        {
+        case Operation::MUL: return Operation::PUSH_NUM_MUL;
+        case Operation::ADD: return Operation::PUSH_NUM_ADD;
+        default: return Operation::RETURN;
+        }
+
+    case Operation::MUL:
+        return b == Operation::ADD ? Operation::MUL_ADD : Operation::RETURN;
+
+    default:
+        return Operation::RETURN;
+    }
+}
+
+// Returns the number of values op takes from the stack.
+static int get_n_operands(Operation::op_t op)
+{
+    switch(op)
+    {
+    case Operation::PUSH_NUM:
+    case Operation::PUSH_VAR:
+        return 0;
+
+    case Operation::IFELSE:
+        return 3;
+
+    case Operation::EQ:  case Operation::NEQ:
+    case Operation::LT:  case Operation::LE:
+    case Operation::GE:  case Operation::GT:
+    case Operation::ADD: case Operation::SUB:
+    case Operation::MUL: case Operation::DIV:
+    case Operation::POW: case Operation::FAST_POW:
+        return 2;
+
+    default:
+        return 1;
+    }
+}
+
+void Evaluator::compile()
+{
+    // Find the operands of every ?:.  starts holds the index of the first
+    // operation of each value on the stack; the IFELSE at index k of op_list
+    // gets jump_if_zero_at[t] = k and jump_at[e] = k, where t and e are the
+    // starts of its second and third operand:
+    const size_t n = op_list.size();
+    vector<int> jump_if_zero_at(n, -1), jump_at(n, -1);
+    vector<size_t> starts;
+    max_depth = 0;
+    for(size_t k=0; k<n; ++k)
+    {
+        const int n_operands = get_n_operands(op_list[k].op);
+        const size_t start = n_operands > 0 ? starts[starts.size() - n_operands] : k;
+        if(op_list[k].op == Operation::IFELSE)
+        {
+            jump_if_zero_at[starts[starts.size() - 2]] = k;
+            jump_at[starts.back()] = k;
+        }
+        starts.resize(starts.size() - n_operands);
+        starts.push_back(start);
+        max_depth = max(max_depth, int(starts.size()));
+    }
+
+    // Translate a ? b : c to
+    //         a  JUMP_IF_ZERO else  b  JUMP end
+    //   else: c
+    //   end:
+    // so that only one of b and c is evaluated:
+    vector<Operation> linear;
+    vector<size_t> jump_if_zero_pos(n), jump_pos(n);  // in linear, by index of the IFELSE
+    for(size_t k=0; k<n; ++k)
+    {
+        if(jump_if_zero_at[k] >= 0)
+        {
+            jump_if_zero_pos[jump_if_zero_at[k]] = linear.size();
+            linear.push_back(Operation(Operation::JUMP_IF_ZERO));
+        }
+        if(jump_at[k] >= 0)
+        {
+            jump_pos[jump_at[k]] = linear.size();
+            linear.push_back(Operation(Operation::JUMP));
+            linear[jump_if_zero_pos[jump_at[k]]].target = linear.size();
+        }
+
+        if(op_list[k].op == Operation::IFELSE)
+            linear[jump_pos[k]].target = linear.size();
+        else
+            linear.push_back(op_list[k]);
+    }
+    linear.push_back(Operation(Operation::RETURN));
+
+    // Replace pairs of operations by superinstructions, from left to right,
+    // unless something jumps to the second one.  The operand of a
+    // superinstruction is the one of the push:
+    vector<bool> is_target(linear.size());
+    for(size_t k=0; k<linear.size(); ++k)
+    {
+        if(linear[k].op == Operation::JUMP || linear[k].op == Operation::JUMP_IF_ZERO) is_target[linear[k].target] = true;
+    }
+
+    vector<int> new_pos(linear.size());
+    code.clear();
+    for(size_t k=0; k<linear.size(); ++k)
+    {
+        new_pos[k] = code.size();
+        code.push_back(linear[k]);
+        const Operation::op_t fused = k + 1 < linear.size() && !is_target[k + 1] ? fuse(linear[k].op, linear[k + 1].op)
+                                                                                 : Operation::RETURN;
+        if(fused != Operation::RETURN)
+        {
+            code.back().op = fused;
+            ++ k;
+        }
+    }
+
+    for(size_t k=0; k<code.size(); ++k)
+    {
+        if(code[k].op == Operation::JUMP || code[k].op == Operation::JUMP_IF_ZERO) code[k].target = new_pos[code[k].target];
+    }
+}
+
+// The loop of the interpreter is threaded if the compiler supports computed
+// goto (GCC and Clang do): every operation jumps directly to the next one,
+// which is much easier on the branch predictor than a single switch.
+// Elsewhere each operation goes through the switch again.
+#ifdef __GNUC__
+#define OP(name) case Operation::name: op_##name
+#define NEXT goto *dispatch_table[(++ ip)->op]
+#define JUMP_TO(pos) ip = &code[pos]; goto *dispatch_table[ip->op]
+#else
+#define OP(name) case Operation::name
+#define NEXT ++ ip; continue
+#define JUMP_TO(pos) ip = &code[pos]; continue
+#endif
+
+double Evaluator::evaluate(const std::vector<double>& vars) const
+{
+#ifdef __GNUC__
+    static const void *const dispatch_table[] =
+    {
+        &&op_PUSH_NUM, &&op_PUSH_VAR,
+        &&op_EQ, &&op_NEQ, &&op_LT, &&op_LE, &&op_GE, &&op_GT,
+        &&op_IFELSE,
+        &&op_ADD, &&op_SUB, &&op_MUL, &&op_DIV,
+        &&op_POW, &&op_NEG, &&op_ABS,
+        &&op_SIN, &&op_COS, &&op_TAN,
+        &&op_EXP,
+        &&op_FAST_POW, &&op_FAST_SIN, &&op_FAST_COS, &&op_FAST_TAN, &&op_FAST_EXP,
+        &&op_PUSH_VAR_MUL, &&op_PUSH_NUM_MUL, &&op_PUSH_VAR_ADD, &&op_PUSH_NUM_ADD, &&op_MUL_ADD,
+        &&op_PUSH_VAR_SIN, &&op_PUSH_VAR_COS, &&op_PUSH_VAR_FAST_SIN, &&op_PUSH_VAR_FAST_COS,
+        &&op_JUMP, &&op_JUMP_IF_ZERO, &&op_RETURN
+    };
+    static_assert(sizeof(dispatch_table) / sizeof(*dispatch_table) == Operation::RETURN + 1,
+                  "missing operations in the dispatch table");
+#endif
+
+    // The value stack grows upwards from stack, sp points above the top:
+    double small_stack[64];
+    vector<double> big_stack;
+    double *sp = small_stack;
+    if(max_depth > 64)
+    {
+        big_stack.resize(max_depth);
+        sp = &big_stack[0];
+    }
+
+    const double *v = vars.empty() ? NULL : &vars[0];
+    const Operation *ip = &code[0];
+
+    for(;;)
+    {
+        switch(ip->op)
+        {
+        OP(PUSH_NUM):
+            *sp++ = ip->num;
+            NEXT;
+
+        OP(PUSH_VAR):
+            *sp++ = v[ip->var_idx];
+            NEXT;
+
+
+        OP(EQ):
+            -- sp;  sp[-1] = sp[-1] == sp[0];
+            NEXT;
+
+        OP(NEQ):
+            -- sp;  sp[-1] = sp[-1] != sp[0];
+            NEXT;
+
+        OP(LT):
+            -- sp;  sp[-1] = sp[-1] < sp[0];
+            NEXT;
+
+        OP(LE):
+            -- sp;  sp[-1] = sp[-1] <= sp[0];
+            NEXT;
+
+        OP(GE):
+            -- sp;  sp[-1] = sp[-1] >= sp[0];
+            NEXT;
+
+        OP(GT):
+            -- sp;  sp[-1] = sp[-1] > sp[0];
+            NEXT;
+
+
+        OP(IFELSE):
+            sp -= 2;  sp[-1] = sp[-1] ? sp[0] : sp[1];
+            NEXT;
+
+
+        OP(ADD):
+            -- sp;  sp[-1] = sp[-1] + sp[0];
+            NEXT;
+
+        OP(SUB):
+            -- sp;  sp[-1] = sp[-1] - sp[0];
+            NEXT;
+
+        OP(MUL):
+            -- sp;  sp[-1] = sp[-1] * sp[0];
+            NEXT;
+
+        OP(DIV):
+            -- sp;  sp[-1] = sp[-1] / sp[0];
+            NEXT;
+
+        OP(POW):
+            -- sp;  sp[-1] = pow(sp[-1], sp[0]);
+            NEXT;
+
+        OP(NEG):
+            sp[-1] = -sp[-1];
+            NEXT;
+
+        OP(ABS):
+            sp[-1] = fabs(sp[-1]);
+            NEXT;
+
+        OP(SIN):
+            sp[-1] = sin(sp[-1]);
+            NEXT;
+
+        OP(COS):
+            sp[-1] = cos(sp[-1]);
+            NEXT;
+
+        OP(TAN):
+            sp[-1] = tan(sp[-1]);
+            NEXT;
+
+        OP(EXP):
+            sp[-1] = exp(sp[-1]);
+            NEXT;
+
+
+        OP(FAST_POW):
+            -- sp;  sp[-1] = fast_pow(sp[-1], sp[0]);
+            NEXT;
+
+        OP(FAST_SIN):
+            sp[-1] = fast_sin(sp[-1]);
+            NEXT;
+
+        OP(FAST_COS):
+            sp[-1] = fast_cos(sp[-1]);
+            NEXT;
+
+        OP(FAST_TAN):
+            sp[-1] = fast_tan(sp[-1]);
+            NEXT;
+
+        OP(FAST_EXP):
+            sp[-1] = fast_exp(sp[-1]);
+            NEXT;
+
+
+        OP(PUSH_VAR_MUL):
+            sp[-1] = sp[-1] * v[ip->var_idx];
+            NEXT;
+
+        OP(PUSH_NUM_MUL):
+            sp[-1] = sp[-1] * ip->num;
+            NEXT;
+
+        OP(PUSH_VAR_ADD):
+            sp[-1] = sp[-1] + v[ip->var_idx];
+            NEXT;
+
+        OP(PUSH_NUM_ADD):
+            sp[-1] = sp[-1] + ip->num;
+            NEXT;
+
+        // Only rounded once where the hardware has a fused multiply-add, so
+        // that results don't change elsewhere (and fma() isn't emulated):
+        OP(MUL_ADD):
+            sp -= 2;
+#ifdef FP_FAST_FMA
+            sp[-1] = fma(sp[0], sp[1], sp[-1]);
+#else
+            sp[-1] = sp[-1] + sp[0] * sp[1];
+#endif
+            NEXT;
+
+        OP(PUSH_VAR_SIN):
+            *sp++ = sin(v[ip->var_idx]);
+            NEXT;
+
+        OP(PUSH_VAR_COS):
+            *sp++ = cos(v[ip->var_idx]);
+            NEXT;
+
+        OP(PUSH_VAR_FAST_SIN):
+            *sp++ = fast_sin(v[ip->var_idx]);
+            NEXT;
+
+        OP(PUSH_VAR_FAST_COS):
+            *sp++ = fast_cos(v[ip->var_idx]);
+            NEXT;
+
+
+        OP(JUMP):
+            JUMP_TO(ip->target);
+
+        // Like IFELSE, anything but 0 (even NaN) is true:
+        OP(JUMP_IF_ZERO):
+            -- sp;
+            if(*sp == 0)
+            {
+                JUMP_TO(ip->target);
+            }
+            NEXT;
+
+        OP(RETURN):
+            return sp[-1];
+        }
+    }
+}
+
+#undef OP
+#undef NEXT
+#undef JUMP_TO
+
+void Evaluator::set_fast_math(bool fast)
+{
+    static const Operation::op_t exact_ops[] = { Operation::POW, Operation::SIN, Operation::COS, Operation::TAN, Operation::EXP };
+    static const Operation::op_t fast_ops[] = { Operation::FAST_POW, Operation::FAST_SIN, Operation::FAST_COS,
+                                                Operation::FAST_TAN, Operation::FAST_EXP };
+
+    const Operation::op_t *from = fast ? exact_ops : fast_ops, *to = fast ? fast_ops : exact_ops;
+    for(size_t k=0; k<op_list.size(); ++k)
+    {
+        for(int f=0; f<5; ++f)
+        {
+            if(op_list[k].op == from[f]) op_list[k].op = to[f];
+        }
+    }
+    compile();
+}
+
+// Interval arithmetic:
+
+static const Interval everything(-HUGE_VAL, HUGE_VAL);
+
+// Returns the smallest interval containing the given values (or everything if
+// one of them is NaN).
+static Interval bounds(const double *values, int n)
+{
+    Interval r(values[0]);
+    for(int k=0; k<n; ++k)
+    {
+        if(std::isnan(values[k])) return everything;
+        r.lo = min(r.lo, values[k]);
+        r.hi = max(r.hi, values[k]);
+    }
+    return r;
+}
+
+static Interval hull(const Interval& a, const Interval& b)
+{
+    const double values[4] = { a.lo, a.hi, b.lo, b.hi };
+    return bounds(values, 4);
+}
+
+// Result of a comparison that is known to be true, false or either.
+static Interval truth(bool surely_true, bool surely_false)
+{
+    if(surely_true) return Interval(1);
+    if(surely_false) return Interval(0);
+    return Interval(0, 1);
+}
+
+static Interval mul(const Interval& a, const Interval& b)
+{
+    const double values[4] = { a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi };
+    return bounds(values, 4);
+}
+
+static Interval div(const Interval& a, const Interval& b)
+{
+    if(b.contains(0)) return everything;
+    return mul(a, Interval(1 / b.hi, 1 / b.lo));
+}
+
+static Interval pow(const Interval& a, const Interval& b)
+{
+    // Integer exponents allow negative bases:
+    if(b.lo == b.hi && b.lo == floor(b.lo))
+    {
+        const double n = b.lo;
+        if(n < 0 && a.contains(0)) return everything;
+
+        const double values[2] = { pow(a.lo, n), pow(a.hi, n) };
+        Interval r = bounds(values, 2);
+        if(n > 0 && fmod(n, 2) == 0 && a.contains(0)) r.lo = 0;
+        return r;
+    }
+
+    // Otherwise pow() is monotonic in each argument for positive bases:
+    if(a.lo > 0 || (a.lo == 0 && b.lo > 0))
+    {
+        const double values[4] = { pow(a.lo, b.lo), pow(a.lo, b.hi), pow(a.hi, b.lo), pow(a.hi, b.hi) };
+        return bounds(values, 4);
+    }
+
+    return everything;
+}
+
+static Interval abs(const Interval& a)
+{
+    if(a.contains(0)) return Interval(0, max(-a.lo, a.hi));
+    return a.lo > 0 ? a : Interval(-a.hi, -a.lo);
+}
+
+// Returns whether lo <= x0 + k*period <= hi for some integer k.
+static bool contains_periodic(const Interval& a, double x0, double period)
+{
+    return x0 + ceil((a.lo - x0) / period) * period <= a.hi;
+}
+
+static Interval sin(const Interval& a)
+{
+    if(!(a.hi - a.lo < 2 * M_PI)) return Interval(-1, 1);
+
+    const double values[2] = { sin(a.lo), sin(a.hi) };
+    Interval r = bounds(values, 2);
+    if(contains_periodic(a, M_PI / 2, 2 * M_PI)) r.hi = 1;
+    if(contains_periodic(a, -M_PI / 2, 2 * M_PI)) r.lo = -1;
+    return r;
+}
+
+static Interval cos(const Interval& a)
+{
+    return sin(Interval(a.lo + M_PI / 2, a.hi + M_PI / 2));
+}
+
+static Interval tan(const Interval& a)
+{
+    if(!(a.hi - a.lo < M_PI) || contains_periodic(a, M_PI / 2, M_PI)) return everything;
+    return Interval(tan(a.lo), tan(a.hi));
+}
+
+Interval Evaluator::evaluate(const std::vector<Interval>& vars) const
+{
+    vector<Interval> value_stack;
 
     typedef vector<Operation>::const_iterator IT;
 
     for(IT it = op_list.begin(); it != op_list.end(); ++it)
     {
-        double a, b, c;
+        Interval a, b, c;
+
+        // Pop the operands:
+        switch(it->op)
+        {
+        case Operation::PUSH_NUM:
+        case Operation::PUSH_VAR:
+            break;
+
+        case Operation::IFELSE:
+            c = value_stack.back();  value_stack.pop_back();
+            // Fall through
+
+        case Operation::EQ:  case Operation::NEQ:
+        case Operation::LT:  case Operation::LE:
+        case Operation::GE:  case Operation::GT:
+        case Operation::ADD: case Operation::SUB:
+        case Operation::MUL: case Operation::DIV:
+        case Operation::POW: case Operation::FAST_POW:
+            b = value_stack.back();  value_stack.pop_back();
+            // Fall through
+
+        default:
+            a = value_stack.back();  value_stack.pop_back();
+            break;
+        }
 
         switch(it->op)
         {
         case Operation::PUSH_NUM:
-            value_stack.push(it->num);
+            value_stack.push_back(Interval(it->num));
             break;
-                
+
         case Operation::PUSH_VAR:
-            value_stack.push(vars[it->var_idx]);
+            value_stack.push_back(vars[it->var_idx]);
             break;
-            
+
 
         case Operation::EQ:
-            b = value_stack.top();  value_stack.pop();
-            a = value_stack.top();  value_stack.pop();
-            value_stack.push(a == b);
+            value_stack.push_back(truth(a.lo == a.hi && b.lo == b.hi && a.lo == b.lo, a.hi < b.lo || b.hi < a.lo));
             break;
 
         case Operation::NEQ:
-            b = value_stack.top();  value_stack.pop();
-            a = value_stack.top();  value_stack.pop();
-            value_stack.push(a != b);
+            value_stack.push_back(truth(a.hi < b.lo || b.hi < a.lo, a.lo == a.hi && b.lo == b.hi && a.lo == b.lo));
             break;
 
         case Operation::LT:
-            b = value_stack.top();  value_stack.pop();
-            a = value_stack.top();  value_stack.pop();
-            value_stack.push(a < b);
+            value_stack.push_back(truth(a.hi < b.lo, a.lo >= b.hi));
             break;
 
         case Operation::LE:
-            b = value_stack.top();  value_stack.pop();
-            a = value_stack.top();  value_stack.pop();
-            value_stack.push(a <= b);
+            value_stack.push_back(truth(a.hi <= b.lo, a.lo > b.hi));
             break;
 
         case Operation::GE:
-            b = value_stack.top();  value_stack.pop();
-            a = value_stack.top();  value_stack.pop();
-            value_stack.push(a >= b);
+            value_stack.push_back(truth(a.lo >= b.hi, a.hi < b.lo));
             break;
 
         case Operation::GT:
-            b = value_stack.top();  value_stack.pop();
-            a = value_stack.top();  value_stack.pop();
-            value_stack.push(a > b);
+            value_stack.push_back(truth(a.lo > b.hi, a.hi <= b.lo));
             break;
-            
+
 
         case Operation::IFELSE:
-            c = value_stack.top();  value_stack.pop();
-            b = value_stack.top();  value_stack.pop();
-            a = value_stack.top();  value_stack.pop();
-            value_stack.push(a ? b : c);
+            if(!a.contains(0))
+                value_stack.push_back(b);
+            else if(a.lo == 0 && a.hi == 0)
+                value_stack.push_back(c);
+            else
+                value_stack.push_back(hull(b, c));
             break;
 
 
         case Operation::ADD:
-            b = value_stack.top();  value_stack.pop();
-            a = value_stack.top();  value_stack.pop();
-            value_stack.push(a + b);
+            {
+                const double values[2] = { a.lo + b.lo, a.hi + b.hi };
+                value_stack.push_back(bounds(values, 2));
+            }
             break;
 
         case Operation::SUB:
-            b = value_stack.top();  value_stack.pop();
-            a = value_stack.top();  value_stack.pop();
-            value_stack.push(a - b);
+            {
+                const double values[2] = { a.lo - b.hi, a.hi - b.lo };
+                value_stack.push_back(bounds(values, 2));
+            }
             break;
-            
+
         case Operation::MUL:
-            b = value_stack.top();  value_stack.pop();
-            a = value_stack.top();  value_stack.pop();
-            value_stack.push(a * b);
+            value_stack.push_back(mul(a, b));
             break;
-            
+
         case Operation::DIV:
-            b = value_stack.top();  value_stack.pop();
-            a = value_stack.top();  value_stack.pop();
-            value_stack.push(a / b);
+            value_stack.push_back(div(a, b));
             break;
-            
+
         case Operation::POW:
-            b = value_stack.top();  value_stack.pop();
-            a = value_stack.top();  value_stack.pop();
-            value_stack.push(pow(a, b));
+        case Operation::FAST_POW:
+            value_stack.push_back(pow(a, b));
             break;
-            
+
         case Operation::NEG:
-            a = value_stack.top();  value_stack.pop();
-            value_stack.push(-a);
+            value_stack.push_back(Interval(-a.hi, -a.lo));
             break;
-            
+
         case Operation::ABS:
-            a = value_stack.top();  value_stack.pop();
-            value_stack.push(abs(a));
+            value_stack.push_back(abs(a));
             break;
-            
+
         case Operation::SIN:
-            a = value_stack.top();  value_stack.pop();
-            value_stack.push(sin(a));
+        case Operation::FAST_SIN:
+            value_stack.push_back(sin(a));
             break;
-            
+
         case Operation::COS:
-            a = value_stack.top();  value_stack.pop();
-            value_stack.push(cos(a));
+        case Operation::FAST_COS:
+            value_stack.push_back(cos(a));
             break;
-            
+
         case Operation::TAN:
-            a = value_stack.top();  value_stack.pop();
-            value_stack.push(tan(a));
+        case Operation::FAST_TAN:
+            value_stack.push_back(tan(a));
             break;
-            
+
         case Operation::EXP:
-            a = value_stack.top();  value_stack.pop();
-            value_stack.push(exp(a));
+        case Operation::FAST_EXP:
+            value_stack.push_back(Interval(exp(a.lo), exp(a.hi)));
+            break;
+
+        default:  // superinstructions, which op_list doesn't contain
             break;
         }
     }
 
-    return value_stack.top();
+    return value_stack.back();
 }
 
 void Evaluator::parse_expr()
@@ -56,18 +56,42 @@ struct Operation
         ADD, SUB, MUL, DIV,
         POW, NEG, ABS,
         SIN, COS, TAN,
-        EXP
+        EXP,
+        // Approximations from fastmath.hpp:
+        FAST_POW, FAST_SIN, FAST_COS, FAST_TAN, FAST_EXP,
+        // Superinstructions and jumps, which only appear in the compiled
+        // code of Evaluator (see Evaluator::compile()):
+        PUSH_VAR_MUL, PUSH_NUM_MUL, PUSH_VAR_ADD, PUSH_NUM_ADD, MUL_ADD,
+        PUSH_VAR_SIN, PUSH_VAR_COS, PUSH_VAR_FAST_SIN, PUSH_VAR_FAST_COS,
+        JUMP, JUMP_IF_ZERO,  // to target
+        RETURN
     } op;
 
     union
     {
         double num;
         int var_idx;
+        int target;  // index into the code
     };
 
     Operation(op_t op) : op(op) {}
     Operation(double num) : op(PUSH_NUM), num(num) {}
     Operation(int var_idx) : op(PUSH_VAR), var_idx(var_idx) {}
+
+    static const char *get_name(op_t op);
+};
+
+
+// A closed range of numbers.
+struct Interval
+{
+    Interval() : lo(0), hi(0) {}
+    explicit Interval(double x) : lo(x), hi(x) {}
+    Interval(double lo, double hi) : lo(lo), hi(hi) {}
+
+    bool contains(double x) const { return lo <= x && x <= hi; }
+
+    double lo, hi;
 };
 
 
@@ -79,7 +103,18 @@ public:
 
     Evaluator(const std::string& formula, const varlist_t& varlist, const constmap_t& constmap = constmap_t());
 
-    double evaluate(const std::vector<double>& vars);
+    double evaluate(const std::vector<double>& vars) const;
+
+    // Switches between libm and the faster approximations of fastmath.hpp for
+    // pow, sin, cos, tan and exp.  (Interval bounds always use libm.)
+    void set_fast_math(bool fast);
+
+    // Returns bounds of the formula for any variable values within the given
+    // intervals.  The bounds may be wider than necessary, but never narrower.
+    Interval evaluate(const std::vector<Interval>& vars) const;
+
+    // Returns the operations of the formula in postfix order, as parsed.
+    const std::vector<Operation>& get_operations() const { return op_list; }
 
 private:
     const Token& next_token() { return cur_token = tokenizer.read_token(); }
@@ -90,12 +125,15 @@ private:
     void parse_product();  // times, divide
     void parse_power();  // for powers
     void parse_factor();  // for numbers, identifiers and parenthesized expressions
+    void compile();  // translates op_list to code
 
     Tokenizer tokenizer;
     Token cur_token;
     varlist_t varlist;
     constmap_t constmap;
     std::vector<Operation> op_list;
+    std::vector<Operation> code;  // op_list with superinstructions and jumps, ending with RETURN
+    int max_depth;  // of the value stack
 };
 
 #endif  // EVALUATOR_HPP
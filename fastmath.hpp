@@ -0,0 +1,179 @@
+#ifndef FASTMATH_HPP
+#define FASTMATH_HPP
+
+#include <cmath>
+#include <cstring>
+#include <cinttypes>
+
+// Faster replacements for sin, cos, tan, exp and pow, used by the evaluator in
+// fast-math mode.  They skip the extra work libm does for correct rounding and
+// for huge arguments (which are passed on to libm here).
+//
+// Maximum errors against libm, as checked by paramplot-bench over the domains
+// it samples (see bench_fastmath(), which fails if they are exceeded):
+//   fast_sin, fast_cos:  2 ulp   (larger arguments than 1e5 go to libm)
+//   fast_tan:            4 ulp
+//   fast_exp:            1 ulp
+//   fast_pow:            16 ulp  for integer exponents up to 16 in magnitude
+//                                (as it multiplies repeatedly)
+//                        otherwise about 2*|y*ln(x)| + 2 ulp, as it is
+//                        computed as exp(y*log(x)); 50 ulp for |y| <= 10 and
+//                        0 < x <= 10
+
+// Returns 2^k for -1022 <= k <= 1023.
+inline double fast_exp2i(int k)
+{
+    const uint64_t bits = uint64_t(k + 1023) << 52;
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+// Rounds x to the nearest integer, for |x| < 2^51.  Cheaper than floor(),
+// which is a library call on some targets.  (Compilers don't fold the two
+// additions without -ffast-math.)
+inline double fast_round(double x)
+{
+    const double shift = 6755399441055744.0;  // 1.5 * 2^52
+    return (x + shift) - shift;
+}
+
+// sin(r) and cos(r) for |r| <= pi/4 (minimax polynomials from fdlibm).  The
+// polynomials are evaluated in pairs of terms, which shortens the chain of
+// dependent operations compared to Horner's scheme.
+inline double fast_sin_kernel(double r)
+{
+    const double z = r * r, w = z * z;
+    const double p = (-1.66666666666666324348e-01 + z * 8.33333333332248946124e-03)
+                   + w * ((-1.98412698298579493134e-04 + z * 2.75573137070700676789e-06)
+                   + w * (-2.50507602534068634195e-08 + z * 1.58969099521155010221e-10));
+    return r + r * z * p;
+}
+
+inline double fast_cos_kernel(double r)
+{
+    const double z = r * r, w = z * z;
+    const double p = (4.16666666666666019037e-02 + z * -1.38888888888741095749e-03)
+                   + w * ((2.48015872894767294178e-05 + z * -2.75573143513906633035e-07)
+                   + w * (2.08757232129817482790e-09 + z * -1.13596475577881948265e-11));
+    return 1 - .5 * z + w * p;
+}
+
+// Reduces x to r with |r| <= pi/4 and x = r + k*pi/2, for |x| < 1e5.  Returns k.
+inline int fast_reduce_pio2(double x, double& r)
+{
+    const double k = fast_round(x * 6.36619772367581382433e-01);
+    r = ((x - k * 1.57079632673412561417e+00) - k * 6.07710050630396597660e-11) - k * 2.02226624871116645580e-21;
+    return static_cast<int>(k);
+}
+
+inline double fast_sin(double x)
+{
+    if(std::fabs(x) <= M_PI_4) return fast_sin_kernel(x);
+    if(!(std::fabs(x) < 1e5)) return std::sin(x);
+
+    double r;
+    switch(fast_reduce_pio2(x, r) & 3)
+    {
+    case 0:  return fast_sin_kernel(r);
+    case 1:  return fast_cos_kernel(r);
+    case 2:  return -fast_sin_kernel(r);
+    default: return -fast_cos_kernel(r);
+    }
+}
+
+inline double fast_cos(double x)
+{
+    if(std::fabs(x) <= M_PI_4) return fast_cos_kernel(x);
+    if(!(std::fabs(x) < 1e5)) return std::cos(x);
+
+    double r;
+    switch(fast_reduce_pio2(x, r) & 3)
+    {
+    case 0:  return fast_cos_kernel(r);
+    case 1:  return -fast_sin_kernel(r);
+    case 2:  return -fast_cos_kernel(r);
+    default: return fast_sin_kernel(r);
+    }
+}
+
+inline double fast_tan(double x)
+{
+    if(std::fabs(x) <= M_PI_4) return fast_sin_kernel(x) / fast_cos_kernel(x);
+    if(!(std::fabs(x) < 1e5)) return std::tan(x);
+
+    double r;
+    const int k = fast_reduce_pio2(x, r);
+    const double s = fast_sin_kernel(r), c = fast_cos_kernel(r);
+    return k & 1 ? -c / s : s / c;
+}
+
+inline double fast_exp(double x)
+{
+    // Near over- and underflow (and for NaN), leave it to libm:
+    if(!(std::fabs(x) < 708)) return std::exp(x);
+
+    // x = k*ln(2) + r with |r| <= ln(2)/2, and exp(r) from a rational
+    // approximation (from fdlibm):
+    const double k = fast_round(x * 1.44269504088896338700e+00);
+    const double hi = x - k * 6.93147180369123816490e-01, lo = k * 1.90821492927058770002e-10;
+    const double r = hi - lo;
+    const double z = r * r;
+    const double c = r - z * (1.66666666666666019037e-01 + z * (-2.77777777770155933842e-03
+                   + z * (6.61375632143793436117e-05 + z * (-1.65339022054652515390e-06
+                   + z * 4.13813679705723846039e-08))));
+    const double y = 1 - ((lo - (r * c) / (2 - c)) - hi);
+    return y * fast_exp2i(static_cast<int>(k));
+}
+
+// log(x) for positive, finite, normal x.
+inline double fast_log(double x)
+{
+    // x = 2^e * m with sqrt(2)/2 <= m < sqrt(2), and log(m) = log(1+f) from a
+    // polynomial in s = f/(2+f) (from fdlibm):
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    int e = static_cast<int>(bits >> 52) - 1023;
+    bits &= (uint64_t(1) << 52) - 1;
+    if(bits > 0x6a09e667f3bcdULL)  // m >= sqrt(2)
+    {
+        bits |= uint64_t(1022) << 52;
+        ++ e;
+    }
+    else
+        bits |= uint64_t(1023) << 52;
+    double m;
+    memcpy(&m, &bits, sizeof(m));
+
+    const double f = m - 1, s = f / (2 + f);
+    const double z = s * s, w = z * z;
+    const double t1 = w * (3.999999999940941908e-01 + w * (2.222219843214978396e-01 + w * 1.531383769920937332e-01));
+    const double t2 = z * (6.666666666666735130e-01 + w * (2.857142874366239149e-01
+                    + w * (1.818357216161805012e-01 + w * 1.479819860511658591e-01)));
+    const double hfsq = .5 * f * f;
+    return e * 6.93147180369123816490e-01 - ((hfsq - (s * (hfsq + t1 + t2) + e * 1.90821492927058770002e-10)) - f);
+}
+
+inline double fast_pow(double x, double y)
+{
+    // Small integer exponents by repeated squaring:
+    if(std::fabs(y) <= 16 && y == static_cast<int>(y))
+    {
+        unsigned n = static_cast<unsigned>(std::fabs(y));
+        double result = 1, base = x;
+        while(n)
+        {
+            if(n & 1) result *= base;
+            base *= base;
+            n >>= 1;
+        }
+        return y < 0 ? 1 / result : result;
+    }
+
+    // Otherwise exp(y*log(x)), leaving special cases to libm:
+    if(!(x >= 2.2250738585072014e-308 && x <= 1.7976931348623157e308)) return std::pow(x, y);
+    const double t = y * fast_log(x);
+    return std::fabs(t) < 708 ? fast_exp(t) : std::pow(x, y);
+}
+
+#endif  // FASTMATH_HPP
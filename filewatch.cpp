@@ -0,0 +1,67 @@
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include "filewatch.hpp"
+#include "exceptions.hpp"
+using namespace std;
+
+FileWatcher::FileWatcher(const std::string& dir, const callback_t& callback)
+ : callback(callback)
+{
+    inotify_fd = inotify_init();
+    if(inotify_fd < 0) throw SysException("inotify_init");
+
+    if(inotify_add_watch(inotify_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        close(inotify_fd);
+        throw SysException("inotify_add_watch " + dir);
+    }
+
+    if(pipe(stop_pipe) != 0)
+    {
+        close(inotify_fd);
+        throw SysException("pipe");
+    }
+
+    thread = std::thread(&FileWatcher::run, this);
+}
+
+FileWatcher::~FileWatcher()
+{
+    // Wake the thread up and wait for it to finish:
+    const char c = 0;
+    if(write(stop_pipe[1], &c, 1) == 1) thread.join();
+    else thread.detach();
+
+    close(stop_pipe[0]);
+    close(stop_pipe[1]);
+    close(inotify_fd);
+}
+
+void FileWatcher::run()
+{
+    char buffer[4096] __attribute__((aligned(__alignof__(inotify_event))));
+
+    pollfd fds[2];
+    fds[0].fd = inotify_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = stop_pipe[0];
+    fds[1].events = POLLIN;
+
+    while(true)
+    {
+        if(poll(fds, 2, -1) < 0) continue;  // interrupted
+        if(fds[1].revents) break;  // stop requested
+
+        const ssize_t length = read(inotify_fd, buffer, sizeof(buffer));
+        if(length <= 0) continue;
+
+        // A read may return several events:
+        for(const char *p = buffer; p < buffer + length; )
+        {
+            const inotify_event *event = reinterpret_cast<const inotify_event*>(p);
+            if(event->len > 0) callback(event->name);
+            p += sizeof(inotify_event) + event->len;
+        }
+    }
+}
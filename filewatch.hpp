@@ -0,0 +1,31 @@
+#ifndef FILEWATCH_HPP
+#define FILEWATCH_HPP
+
+#include <functional>
+#include <string>
+#include <thread>
+
+// Watches a directory with inotify and calls a function with the name of
+// every file in it that was written or replaced (editors often save by
+// renaming a temporary file).  The function is called from a separate thread.
+class FileWatcher
+{
+public:
+    typedef std::function<void(const std::string& filename)> callback_t;
+
+    FileWatcher(const std::string& dir, const callback_t& callback);
+    ~FileWatcher();
+
+private:
+    FileWatcher(const FileWatcher&);
+    FileWatcher& operator=(const FileWatcher&);
+
+    void run();
+
+    callback_t callback;
+    int inotify_fd;
+    int stop_pipe[2];
+    std::thread thread;
+};
+
+#endif  // FILEWATCH_HPP
@@ -0,0 +1,86 @@
+#ifndef FUNCSURFACE_HPP
+#define FUNCSURFACE_HPP
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "mesh.hpp"
+
+// The same value everywhere, for FunctionSurfaces without color functions.
+struct ConstantFunction
+{
+    explicit ConstantFunction(double value) : value(value) {}
+    double operator()(double, double) const { return value; }
+
+    double value;
+};
+
+// A parametric surface like Surface, but with C++ functions (anything that can
+// be called as f(u, v) with doubles and returns a number) for x, y, z, r, g
+// and b instead of formulas.  For programs with fixed surfaces: the functions
+// are inlined into one loop per output, which the compiler can vectorize,
+// rather than interpreted.  The grid points are the same as those of Surface,
+// so it can take its place in stream_grid().  Use make_function_surface() to
+// get the types right.
+template <class X, class Y, class Z, class R, class G, class B>
+class FunctionSurface : public GridSource
+{
+public:
+    FunctionSurface(X x, Y y, Z z, R r, G g, B b) : x(x), y(y), z(z), r(r), g(g), b(b) {}
+
+    void eval_row(int res_u, int res_v, int j, glm::vec3* positions, glm::vec3* colors)
+    {
+        const int n = res_u + 2;
+        if(us.size() != size_t(n))
+        {
+            us.resize(n);
+            for(int k=0; k<n; ++k) us[k] = 1.0 * (k - 1) / (res_u - 1);
+            soa.resize(3 * n);
+        }
+        const double v = 1.0 * j / (res_v - 1);
+        float *sx = &soa[0], *sy = sx + n, *sz = sy + n;
+
+        eval(x, &us[0], v, n, sx);
+        eval(y, &us[0], v, n, sy);
+        eval(z, &us[0], v, n, sz);
+        for(int k=0; k<n; ++k) positions[k] = glm::vec3(sx[k], sy[k], sz[k]);
+
+        // Colors without the sentinels:
+        if(j < 0 || j >= res_v) return;
+        eval(r, &us[1], v, res_u, sx);
+        eval(g, &us[1], v, res_u, sy);
+        eval(b, &us[1], v, res_u, sz);
+        for(int i=0; i<res_u; ++i) colors[i] = glm::vec3(sx[i], sy[i], sz[i]);
+    }
+
+private:
+    template <class F>
+    static void eval(F& f, const double* __restrict u, double v, int n, float* __restrict out)
+    {
+        for(int k=0; k<n; ++k) out[k] = f(u[k], v);
+    }
+
+    X x;
+    Y y;
+    Z z;
+    R r;
+    G g;
+    B b;
+    std::vector<double> us;  // u of each column of a row, including the sentinels
+    std::vector<float> soa;  // one row of x, y and z (or r, g and b) values
+};
+
+template <class X, class Y, class Z, class R, class G, class B>
+FunctionSurface<X, Y, Z, R, G, B> make_function_surface(X x, Y y, Z z, R r, G g, B b)
+{
+    return FunctionSurface<X, Y, Z, R, G, B>(x, y, z, r, g, b);
+}
+
+// A white surface.
+template <class X, class Y, class Z>
+FunctionSurface<X, Y, Z, ConstantFunction, ConstantFunction, ConstantFunction> make_function_surface(X x, Y y, Z z)
+{
+    const ConstantFunction one(1);
+    return FunctionSurface<X, Y, Z, ConstantFunction, ConstantFunction, ConstantFunction>(x, y, z, one, one, one);
+}
+
+#endif  // FUNCSURFACE_HPP
@@ -0,0 +1,129 @@
+#include <cstring>
+#include "glstate.hpp"
+using namespace std;
+
+GLState::GLState(const GLDispatch& gl)
+ : gl(gl), program(0), array_buffer(0), element_array_buffer(0), attrib_mask(0),
+   offset_factor(0), offset_units(0)
+{
+    // Pointers default to 0, but that's not worth tracking:
+    for(int k=0; k<max_attribs; ++k) attrib_pointer_valid[k] = false;
+}
+
+void GLState::use_program(GLuint program)
+{
+    if(count(program != this->program))
+    {
+        gl.UseProgram(program);
+        this->program = program;
+    }
+}
+
+void GLState::bind_buffer(GLenum target, GLuint buffer)
+{
+    GLuint& bound = target == GL_ARRAY_BUFFER ? array_buffer : element_array_buffer;
+    if(count(buffer != bound))
+    {
+        gl.BindBuffer(target, buffer);
+        bound = buffer;
+    }
+}
+
+void GLState::set_attrib_arrays(uint32_t mask)
+{
+    const uint32_t changed = mask ^ attrib_mask;
+    for(GLuint k=0; k<max_attribs; ++k)
+    {
+        const uint32_t bit = 1u << k;
+        if(!((mask | attrib_mask) & bit)) continue;
+
+        if(count(changed & bit))
+        {
+            if(mask & bit) gl.EnableVertexAttribArray(k);
+            else           gl.DisableVertexAttribArray(k);
+        }
+    }
+    attrib_mask = mask;
+}
+
+void GLState::attrib_pointer(GLuint index, GLint size, GLenum type, GLboolean normalized,
+                             GLsizei stride, const void *pointer)
+{
+    // The pointer refers to the buffer which is bound at the time of the call:
+    AttribPointer ap;
+    ap.buffer = array_buffer;
+    ap.size = size;
+    ap.type = type;
+    ap.normalized = normalized;
+    ap.stride = stride;
+    ap.pointer = pointer;
+
+    if(index >= max_attribs)
+    {
+        count(true);
+        gl.VertexAttribPointer(index, size, type, normalized, stride, pointer);
+    }
+    else if(count(!attrib_pointer_valid[index] || !(attrib_pointers[index] == ap)))
+    {
+        gl.VertexAttribPointer(index, size, type, normalized, stride, pointer);
+        attrib_pointers[index] = ap;
+        attrib_pointer_valid[index] = true;
+    }
+}
+
+void GLState::set_capability(GLenum cap, bool enabled)
+{
+    // Only GL_DITHER is enabled in a new context:
+    map<GLenum, bool>::iterator it = caps.find(cap);
+    const bool current = it != caps.end() ? it->second : cap == GL_DITHER;
+
+    if(count(enabled != current))
+    {
+        if(enabled) gl.Enable(cap);
+        else        gl.Disable(cap);
+        caps[cap] = enabled;
+    }
+}
+
+void GLState::polygon_offset(GLfloat factor, GLfloat units)
+{
+    if(count(factor != offset_factor || units != offset_units))
+    {
+        gl.PolygonOffset(factor, units);
+        offset_factor = factor;
+        offset_units = units;
+    }
+}
+
+void GLState::uniform_matrix4(GLint location, const GLfloat *value)
+{
+    const pair<GLuint, GLint> key(program, location);
+    map<pair<GLuint, GLint>, Matrix>::iterator it = uniforms.find(key);
+
+    if(count(it == uniforms.end() || memcmp(it->second.m, value, sizeof(Matrix)) != 0))
+    {
+        gl.UniformMatrix4fv(location, 1, GL_FALSE, value);
+        memcpy(uniforms[key].m, value, sizeof(Matrix));
+    }
+}
+
+void GLState::forget_program(GLuint program)
+{
+    map<pair<GLuint, GLint>, Matrix>::iterator it = uniforms.lower_bound(make_pair(program, GLint(-1)));
+    while(it != uniforms.end() && it->first.first == program) uniforms.erase(it++);
+
+    // The program will be deleted, so make sure the next use_program() goes
+    // through even if the name is reused:
+    if(this->program == program)
+    {
+        gl.UseProgram(0);
+        this->program = 0;
+    }
+}
+
+GLState::Stats GLState::take_stats()
+{
+    const Stats result = stats;
+    stats = Stats();
+    return result;
+}
@@ -0,0 +1,116 @@
+#ifndef GLSTATE_HPP
+#define GLSTATE_HPP
+
+#include <cinttypes>
+#include <map>
+#include <utility>
+#include <vector>
+#include <GLES2/gl2.h>
+
+// The GL functions GLState forwards to.  Point these to mock functions to
+// use GLState without a GL context, as check_gl_state() in the benchmark
+// does.
+struct GLDispatch
+{
+    void (GL_APIENTRY *UseProgram)(GLuint program);
+    void (GL_APIENTRY *BindBuffer)(GLenum target, GLuint buffer);
+    void (GL_APIENTRY *EnableVertexAttribArray)(GLuint index);
+    void (GL_APIENTRY *DisableVertexAttribArray)(GLuint index);
+    void (GL_APIENTRY *VertexAttribPointer)(GLuint index, GLint size, GLenum type, GLboolean normalized,
+                                            GLsizei stride, const void *pointer);
+    void (GL_APIENTRY *Enable)(GLenum cap);
+    void (GL_APIENTRY *Disable)(GLenum cap);
+    void (GL_APIENTRY *PolygonOffset)(GLfloat factor, GLfloat units);
+    void (GL_APIENTRY *UniformMatrix4fv)(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value);
+
+    // Returns the dispatch table of the real GL implementation.  Inline, so
+    // that programs which only use mocks don't need to link with GL.
+    static GLDispatch native()
+    {
+        GLDispatch gl;
+        gl.UseProgram = glUseProgram;
+        gl.BindBuffer = glBindBuffer;
+        gl.EnableVertexAttribArray = glEnableVertexAttribArray;
+        gl.DisableVertexAttribArray = glDisableVertexAttribArray;
+        gl.VertexAttribPointer = glVertexAttribPointer;
+        gl.Enable = glEnable;
+        gl.Disable = glDisable;
+        gl.PolygonOffset = glPolygonOffset;
+        gl.UniformMatrix4fv = glUniformMatrix4fv;
+        return gl;
+    }
+};
+
+// Shadows a part of the GL state and only forwards calls which actually
+// change it.  Starts out with the initial state of a new context, so all
+// changes to the tracked state must go through this class.
+class GLState
+{
+public:
+    // Numbers of forwarded and skipped calls.
+    struct Stats
+    {
+        Stats() : issued(0), elided(0) {}
+        unsigned long issued, elided;
+    };
+
+    GLState(const GLDispatch& gl = GLDispatch::native());
+
+    void use_program(GLuint program);
+    void bind_buffer(GLenum target, GLuint buffer);
+
+    // Enables exactly the vertex attribute arrays whose bits are set in mask.
+    void set_attrib_arrays(uint32_t mask);
+    void attrib_pointer(GLuint index, GLint size, GLenum type, GLboolean normalized,
+                        GLsizei stride, const void *pointer);
+
+    void set_capability(GLenum cap, bool enabled);
+    void polygon_offset(GLfloat factor, GLfloat units);
+
+    // Sets a mat4 uniform of the current program.
+    void uniform_matrix4(GLint location, const GLfloat *value);
+
+    // Forgets the cached uniforms of program.  Call this before deleting it,
+    // as the driver may reuse its name.
+    void forget_program(GLuint program);
+
+    // Returns the statistics gathered since the last call and resets them.
+    Stats take_stats();
+
+private:
+    struct AttribPointer
+    {
+        GLuint buffer;
+        GLint size;
+        GLenum type;
+        GLboolean normalized;
+        GLsizei stride;
+        const void *pointer;
+
+        bool operator==(const AttribPointer& o) const
+        {
+            return buffer == o.buffer && size == o.size && type == o.type && normalized == o.normalized
+                && stride == o.stride && pointer == o.pointer;
+        }
+    };
+
+    struct Matrix { GLfloat m[16]; };
+
+    enum { max_attribs = 32 };
+
+    // Counts a call as issued if changed is true and as elided otherwise.
+    bool count(bool changed) { ++ (changed ? stats.issued : stats.elided);  return changed; }
+
+    GLDispatch gl;
+    GLuint program;
+    GLuint array_buffer, element_array_buffer;
+    uint32_t attrib_mask;
+    AttribPointer attrib_pointers[max_attribs];
+    bool attrib_pointer_valid[max_attribs];
+    std::map<GLenum, bool> caps;
+    GLfloat offset_factor, offset_units;
+    std::map<std::pair<GLuint, GLint>, Matrix> uniforms;
+    Stats stats;
+};
+
+#endif  // GLSTATE_HPP
@@ -1,27 +1,34 @@
 #include <cassert>
 #include <cinttypes>
+#include <cmath>
 #include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <time.h>
+#include <sstream>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include "graphics.hpp"
+#include "mesh.hpp"
 #include "exceptions.hpp"
 using namespace std;
 using namespace glm;
 
 Graphics::Graphics()
-  : vsync(true), culling(false), wire_mode(false),
-    cam_orient(quat(vec3(0.f, 0.f, 0.f))),
-    cam_pos_z(7)
+  : n_morphed(0), sweep_position(0), vsync(true), culling(false), wire_mode(false), lighting_mode(LIGHTING_AUTO),
+    prog_simple(0), prog_upscale(0),
+    fbo(0), fbo_color(0), fbo_depth(0), vbo_quad(0), capture(NULL)
 {
     sdl_screen = SDL_SetVideoMode(0, 0, 0, SDL_SWSURFACE | SDL_FULLSCREEN);
     if(!sdl_screen) throw SDLException("SDL_SetVideoMode");
 
     init_egl_context();
     init_gl();
+    shader_cache.init();
     load_shaders();
 }
 
@@ -30,68 +37,252 @@ Graphics::~Graphics()
 }
 
 void Graphics::render()
+{
+    const bool scaled = scaler.is_enabled();
+    const double t = scaled ? get_time() : 0;
+    const float scale = scaler.get_scale();
+    const GLsizei w = max(1, int(scale * screen_w + .5f)), h = max(1, int(scale * screen_h + .5f));
+
+    if(scaled)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glViewport(0, 0, w, h);
+    }
+
+    draw_scene();
+
+    if(scaled)
+    {
+        // Upscale the rendered part of the framebuffer to the screen:
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, screen_w, screen_h);
+        // (Clearing spares tiled GPUs from loading the previous frame.)
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        gl_state.set_capability(GL_DEPTH_TEST, false);
+        gl_state.use_program(prog_upscale);
+        gl_state.set_attrib_arrays(1u << attr_upscale_pos);
+        gl_state.bind_buffer(GL_ARRAY_BUFFER, vbo_quad);
+        gl_state.attrib_pointer(attr_upscale_pos, 2, GL_FLOAT, GL_FALSE, 0, 0);
+        glUniform2f(uni_upscale_tex_scale, 1.f * w / screen_w, 1.f * h / screen_h);
+        glUniform2f(uni_upscale_tex_max, (w - .5f) / screen_w, (h - .5f) / screen_h);
+        glBindTexture(GL_TEXTURE_2D, fbo_color);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        gl_state.set_capability(GL_DEPTH_TEST, true);
+
+        // Wait for the GPU, so that the frame time includes its work but not
+        // the wait for VSync in eglSwapBuffers() (GL ES 2 has no timer
+        // queries):
+        glFinish();
+        scaler.add_frame(get_time() - t);
+    }
+
+    if(capture) capture->grab();
+
+    eglSwapBuffers(egl_display, egl_surface);
+}
+
+void Graphics::draw_scene()
 {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     // Create modelview matrix:
     glm::mat4 modelview(1);
-    modelview = translate(modelview, vec3(0, 0, -cam_pos_z));
-    modelview = modelview * mat4_cast(cam_orient);
+    modelview = translate(modelview, vec3(0, 0, -camera.pos_z));
+    modelview = modelview * mat4_cast(camera.orient);
+
+    update_lighting(modelview);
 
     // Draw model:
-    glUseProgram(prog_shiny);
-    glUniformMatrix4fv(uni_shiny_modelmat, 1, GL_FALSE, value_ptr(modelview));
-    glEnableVertexAttribArray(attr_shiny_pos);
-    glEnableVertexAttribArray(attr_shiny_col);
-    glEnableVertexAttribArray(attr_shiny_norm);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo_model);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_model);
+    // (All state changes go through gl_state, which skips the ones that
+    // don't change anything, so nothing is unbound after drawing.  All
+    // objects share the buffers, and the program only changes between
+    // objects lit or morphed differently; otherwise only their modelview
+    // matrix and attribute offsets change between draw calls.)
+    gl_state.bind_buffer(GL_ARRAY_BUFFER, vbo_model);
+    gl_state.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, ibo_model);
+
+    gl_state.set_capability(GL_POLYGON_OFFSET_FILL, wire_mode);
+    if(wire_mode) gl_state.polygon_offset(1.0f, 1.0f);
+
+    for(size_t b=0; b<batches.size(); ++b)
+    {
+        const DrawBatch& batch = batches[b];
+        if(batch.n_keyframes > 1)
+            use_morph_program(prog_morph, batch, modelview);
+        else
+        {
+            const LitProgram& prog = per_vertex[batch.object] ? prog_gouraud : prog_shiny;
+            gl_state.use_program(prog.handle);
+            gl_state.set_attrib_arrays(1u << prog.attr_pos | 1u << prog.attr_col | 1u << prog.attr_norm);
+            gl_state.uniform_matrix4(prog.uni_modelmat, value_ptr(modelview * transforms[batch.object]));
+            gl_state.attrib_pointer(prog.attr_pos, 3, GL_FLOAT, GL_FALSE, 0, vertex_offset(0, batch));
+            gl_state.attrib_pointer(prog.attr_col, 3, GL_FLOAT, GL_FALSE, 0, vertex_offset(1, batch));
+            gl_state.attrib_pointer(prog.attr_norm, 3, GL_FLOAT, GL_FALSE, 0, vertex_offset(2, batch));
+        }
+        glDrawElements(batch.mode, batch.n_elements, GL_UNSIGNED_SHORT,
+                       (void *)(sizeof(uint16_t) * batch.first_element));
+    }
 
+    // Draw wireframe:
     if(wire_mode)
     {
-        glEnable(GL_POLYGON_OFFSET_FILL);
-        glPolygonOffset(1.0f, 1.0f);
+        gl_state.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, ibo_model_wire);
+
+        for(size_t b=0; b<batches.size(); ++b)
+        {
+            const DrawBatch& batch = batches[b];
+            if(batch.n_keyframes > 1)
+                use_morph_program(prog_morph_wire, batch, modelview);
+            else
+            {
+                gl_state.use_program(prog_simple);
+                gl_state.set_attrib_arrays(1u << attr_simple_pos | 1u << attr_simple_col);
+                gl_state.uniform_matrix4(uni_simple_modelmat, value_ptr(modelview * transforms[batch.object]));
+                gl_state.attrib_pointer(attr_simple_pos, 3, GL_FLOAT, GL_FALSE, 0, vertex_offset(0, batch));
+                gl_state.attrib_pointer(attr_simple_col, 3, GL_FLOAT, GL_FALSE, 0, vertex_offset(1, batch));
+            }
+            glDrawElements(GL_LINES, batch.n_wire_elements, GL_UNSIGNED_SHORT,
+                           (void *)(sizeof(uint16_t) * batch.first_wire_element));
+        }
     }
+}
 
-    glVertexAttribPointer(attr_shiny_pos, 3, GL_FLOAT, GL_FALSE, 0, 0);
-    glVertexAttribPointer(attr_shiny_col, 3, GL_FLOAT, GL_FALSE, 0, (void *)(sizeof(float) * 3 * res_u * res_v));
-    glVertexAttribPointer(attr_shiny_norm, 3, GL_FLOAT, GL_FALSE, 0, (void *)(sizeof(float) * 6 * res_u * res_v));
-    glDrawElements(GL_TRIANGLE_STRIP, n_draw_elements, GL_UNSIGNED_SHORT, 0);
+void Graphics::use_morph_program(const MorphProgram& prog, const DrawBatch& batch, const glm::mat4& modelview)
+{
+    // The keyframes around sweep_position, and how far it is between them:
+    const float pos = clamp(sweep_position, 0.f, 1.f) * (batch.n_keyframes - 1);
+    const int k = min(int(pos), batch.n_keyframes - 2);
+
+    // (With simple.fs the normals are unused, and may have been optimized
+    // away.)
+    const GLuint none = GLuint(-1);
+    const GLuint *attrs[3] = { prog.attr_pos, prog.attr_col, prog.attr_norm };
+    uint32_t mask = 0;
+    for(int a=0; a<3; ++a)
+    {
+        for(int n=0; n<2; ++n)
+            if(attrs[a][n] != none) mask |= 1u << attrs[a][n];
+    }
 
-    if(wire_mode)
+    gl_state.use_program(prog.handle);
+    gl_state.set_attrib_arrays(mask);
+    gl_state.uniform_matrix4(prog.uni_modelmat, value_ptr(modelview * transforms[batch.object]));
+    glUniform1f(prog.uni_blend, pos - k);
+    for(int n=0; n<2; ++n)
     {
-        glDisable(GL_POLYGON_OFFSET_FILL);
+        DrawBatch keyframe = batch;
+        keyframe.first_vertex += (k + n) * batch.keyframe_verts;
+        for(int a=0; a<3; ++a)
+        {
+            if(attrs[a][n] != none)
+                gl_state.attrib_pointer(attrs[a][n], 3, GL_FLOAT, GL_FALSE, 0, vertex_offset(a, keyframe));
+        }
     }
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glDisableVertexAttribArray(attr_shiny_pos);
-    glDisableVertexAttribArray(attr_shiny_col);
-    glDisableVertexAttribArray(attr_shiny_norm);
-    glUseProgram(0);
-    
-    // Draw wireframe:
-    if(wire_mode)
+void Graphics::update_lighting(const glm::mat4& modelview)
+{
+    per_vertex.resize(bounds.size());
+
+    // Focal length in rendered pixels, for the field of view of get_projection():
+    const float focal = .5f * get_render_scale() * screen_h / tan(22.5f * float(M_PI) / 180);
+
+    for(size_t o=0; o<bounds.size(); ++o)
     {
-        glUseProgram(prog_simple);
-        glUniformMatrix4fv(uni_simple_modelmat, 1, GL_FALSE, value_ptr(modelview));
-        glEnableVertexAttribArray(attr_simple_pos);
-        glEnableVertexAttribArray(attr_simple_col);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo_model);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_model_wire);
+        if(lighting_mode != LIGHTING_AUTO)
+        {
+            per_vertex[o] = lighting_mode == LIGHTING_PER_VERTEX;
+            continue;
+        }
 
-        glVertexAttribPointer(attr_simple_pos, 3, GL_FLOAT, GL_FALSE, 0, 0);
-        glVertexAttribPointer(attr_simple_col, 3, GL_FLOAT, GL_FALSE, 0, (void *)(sizeof(float) * 3 * res_u * res_v));
-        glDrawElements(GL_LINES, n_draw_wire_elements, GL_UNSIGNED_SHORT, 0);
+        // (Model matrices only translate and scale uniformly.)
+        const ObjectBounds& ob = bounds[o];
+        const float radius = ob.radius * abs(transforms[o][0][0]);
+        const float dist = -(modelview * transforms[o] * vec4(ob.center, 1)).z;
+        if(dist <= radius || ob.n_triangles == 0)
+        {
+            // Too close for the estimate, and triangles are large anyway:
+            per_vertex[o] = false;
+            continue;
+        }
 
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-        glDisableVertexAttribArray(attr_simple_pos);
-        glDisableVertexAttribArray(attr_simple_col);
-        glUseProgram(0);
+        // The surface covers at most its projected bounding sphere, with
+        // about half of its triangles facing the camera.  The thresholds
+        // differ in both directions, so that a surface doesn't flicker
+        // between the modes at one distance:
+        const float r_px = focal * radius / dist;
+        const float tri_area = float(M_PI) * r_px * r_px / (.5f * ob.n_triangles);
+        per_vertex[o] = tri_area < (per_vertex[o] ? 6.f : 4.f);
     }
+}
 
-    eglSwapBuffers(egl_display, egl_surface);
+size_t Graphics::get_n_per_vertex() const
+{
+    return count(per_vertex.begin(), per_vertex.end(), true);
+}
+
+void Graphics::set_target_frame_time(double target_time)
+{
+    scaler.set_target(target_time);
+    if(!scaler.is_enabled())
+    {
+        free_framebuffer();
+        return;
+    }
+
+    try
+    {
+        if(fbo == 0) init_framebuffer();
+    }
+    catch(const exception& e)
+    {
+        cerr << "WARNING: " << e.what() << ", rendering at the full resolution\n";
+        scaler.set_target(0);
+    }
+}
+
+void Graphics::init_framebuffer()
+{
+    // Color texture (non-power-of-two textures in GL ES 2 can't repeat or
+    // have mipmaps):
+    glGenTextures(1, &fbo_color);
+    glBindTexture(GL_TEXTURE_2D, fbo_color);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, screen_w, screen_h, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glGenRenderbuffers(1, &fbo_depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, fbo_depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, screen_w, screen_h);
+
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, fbo_color, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, fbo_depth);
+    const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if(status != GL_FRAMEBUFFER_COMPLETE)
+    {
+        free_framebuffer();
+        throw GLException("offscreen framebuffer incomplete");
+    }
+
+    // Two triangles covering the screen:
+    static const float quad[] = { -1, -1,  1, -1,  -1, 1,  1, 1 };
+    glGenBuffers(1, &vbo_quad);
+    gl_state.bind_buffer(GL_ARRAY_BUFFER, vbo_quad);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+}
+
+void Graphics::free_framebuffer()
+{
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteRenderbuffers(1, &fbo_depth);
+    glDeleteTextures(1, &fbo_color);
+    glDeleteBuffers(1, &vbo_quad);
+    fbo = fbo_depth = fbo_color = vbo_quad = 0;
 }
 
 void Graphics::init_gl()
@@ -101,32 +292,88 @@ void Graphics::init_gl()
     glClearColor(0, 0, 0, 1);
 
     glClearDepthf(1);
-    glEnable(GL_DEPTH_TEST);
+    gl_state.set_capability(GL_DEPTH_TEST, true);
     glDepthRangef(0, 1);
     glDepthFunc(GL_LESS);
 
-    glDisable(GL_CULL_FACE);
+    gl_state.set_capability(GL_CULL_FACE, false);
     glCullFace(GL_BACK);
     glFrontFace(GL_CCW);
 }
 
 void Graphics::load_shaders()
 {
-    // If the shader program is already loaded, delete it first:
-    if(prog_simple != 0) glDeleteProgram(prog_simple);
-    if(prog_shiny != 0) glDeleteProgram(prog_shiny);
+    load_simple_program();
+    load_lit_program(prog_shiny, "shiny");
+    load_lit_program(prog_gouraud, "gouraud");
+    load_morph_program(prog_morph, "data/shaders/shiny.fs");
+    load_morph_program(prog_morph_wire, "data/shaders/simple.fs");
+    load_upscale_program();
+}
 
-    // Simple shader program:
-    // Compile shaders:
-    vector<GLuint> shaders;
-    shaders.push_back(compile_shader(GL_VERTEX_SHADER, "data/shaders/simple.vs"));
-    shaders.push_back(compile_shader(GL_FRAGMENT_SHADER, "data/shaders/simple.fs"));
+void Graphics::reload_data()
+{
+    try
+    {
+        load_shaders();
+    }
+    catch(const exception& e)
+    {
+        cerr << "ERROR: " << e.what() << ", keeping previous shader programs\n";
+    }
+}
 
-    // Link program:
-    prog_simple = link_program(shaders);
+bool Graphics::reload_shader(const std::string& filename)
+{
+    const size_t dot = filename.find('.');
+    const string stem = filename.substr(0, dot);
+    const string ext = dot != string::npos ? filename.substr(dot) : "";
+    if(ext != ".vs" && ext != ".fs") return false;
 
-    // Delete shaders again:
-    for_each(shaders.begin(), shaders.end(), glDeleteShader);
+    try
+    {
+        if(stem == "simple")
+        {
+            load_simple_program(true);
+            load_morph_program(prog_morph_wire, "data/shaders/simple.fs", true);
+        }
+        else if(stem == "shiny")
+        {
+            if(ext == ".fs") load_morph_program(prog_morph, "data/shaders/shiny.fs", true);
+            load_lit_program(prog_shiny, stem, true);
+        }
+        else if(stem == "morph")
+        {
+            load_morph_program(prog_morph, "data/shaders/shiny.fs", true);
+            load_morph_program(prog_morph_wire, "data/shaders/simple.fs", true);
+        }
+        else if(stem == "gouraud")
+            load_lit_program(prog_gouraud, stem, true);
+        else if(stem == "upscale")
+            load_upscale_program(true);
+        else
+            return false;
+    }
+    catch(const exception& e)
+    {
+        cerr << "ERROR: " << e.what() << ", keeping previous " << stem << " program\n";
+        return false;
+    }
+
+    return true;
+}
+
+void Graphics::load_simple_program(bool report)
+{
+    // Build the new program first, so the old one stays if that fails:
+    const GLuint prog = load_program("data/shaders/simple.vs", "data/shaders/simple.fs", report);
+
+    if(prog_simple != 0)
+    {
+        gl_state.forget_program(prog_simple);
+        glDeleteProgram(prog_simple);
+    }
+    prog_simple = prog;
 
     // Get locations:
     attr_simple_pos  = glGetAttribLocation(prog_simple, "pos");
@@ -134,230 +381,444 @@ void Graphics::load_shaders()
     uni_simple_modelmat = glGetUniformLocation(prog_simple, "mat_modelview");
     uni_simple_projmat  = glGetUniformLocation(prog_simple, "mat_projection");
 
-    // Shiny shader program:
-    // Compile shaders:
-    shaders.clear();
-    shaders.push_back(compile_shader(GL_VERTEX_SHADER, "data/shaders/shiny.vs"));
-    shaders.push_back(compile_shader(GL_FRAGMENT_SHADER, "data/shaders/shiny.fs"));
+    // Set constant uniforms:
+    gl_state.use_program(prog_simple);
+    gl_state.uniform_matrix4(uni_simple_projmat, value_ptr(get_projection()));
+}
 
-    // Link program:
-    prog_shiny = link_program(shaders);
+void Graphics::load_lit_program(LitProgram& prog, const std::string& stem, bool report)
+{
+    // Build the new program first, so the old one stays if that fails:
+    const string path = "data/shaders/" + stem;
+    const GLuint handle = load_program(path + ".vs", path + ".fs", report);
 
-    // Delete shaders again:
-    for_each(shaders.begin(), shaders.end(), glDeleteShader);
+    if(prog.handle != 0)
+    {
+        gl_state.forget_program(prog.handle);
+        glDeleteProgram(prog.handle);
+    }
+    prog.handle = handle;
 
     // Get locations:
-    attr_shiny_pos  = glGetAttribLocation(prog_shiny, "pos");
-    attr_shiny_col  = glGetAttribLocation(prog_shiny, "col");
-    attr_shiny_norm = glGetAttribLocation(prog_shiny, "norm");
-    uni_shiny_modelmat = glGetUniformLocation(prog_shiny, "mat_modelview");
-    uni_shiny_projmat  = glGetUniformLocation(prog_shiny, "mat_projection");
+    prog.attr_pos  = glGetAttribLocation(prog.handle, "pos");
+    prog.attr_col  = glGetAttribLocation(prog.handle, "col");
+    prog.attr_norm = glGetAttribLocation(prog.handle, "norm");
+    prog.uni_modelmat = glGetUniformLocation(prog.handle, "mat_modelview");
+    prog.uni_projmat  = glGetUniformLocation(prog.handle, "mat_projection");
 
     // Set constant uniforms:
-    float ratio = 1.f * screen_w / screen_h;
-    mat4 projection = perspective(45.f, ratio, .1f, 100.f);
-    glUseProgram(prog_simple);
-    glUniformMatrix4fv(uni_simple_projmat, 1, GL_FALSE, value_ptr(projection));
-    glUseProgram(prog_shiny);
-    glUniformMatrix4fv(uni_shiny_projmat, 1, GL_FALSE, value_ptr(projection));
-    glUseProgram(0);
+    gl_state.use_program(prog.handle);
+    gl_state.uniform_matrix4(prog.uni_projmat, value_ptr(get_projection()));
 }
 
-void Graphics::load_model(const glm::vec3* positions, const glm::vec3* colors, int res_u, int res_v)
+void Graphics::load_morph_program(MorphProgram& prog, const std::string& fs_filename, bool report)
 {
-    this->res_u = res_u;
-    this->res_v = res_v;
-    n_draw_elements = (res_v - 1) * 2 * res_u + (res_v - 2) * 2;
-    n_draw_wire_elements = (res_v - 1) * 2 * res_u + (res_u - 1) * 2 * res_v;
+    // Build the new program first, so the old one stays if that fails:
+    const GLuint handle = load_program("data/shaders/morph.vs", fs_filename, report);
 
-    const size_t n_verts = res_u * res_v;
+    if(prog.handle != 0)
+    {
+        gl_state.forget_program(prog.handle);
+        glDeleteProgram(prog.handle);
+    }
+    prog.handle = handle;
 
-    // Calculate normals and fill buffer:
-    float *verts = new float[3 * 3 * n_verts];
-    for(int j=0; j<res_v; ++j)
+    // Get locations:
+    for(int n=0; n<2; ++n)
     {
-        for(int i=0; i<res_u; ++i)
-        {
-            const int pos_idx = (i + 1) + (res_u + 2) * (j + 1);
-            const int col_idx = i + res_u * j;
-            const int vert_idx = 3 * (i + res_u * j);
-
-            // Approximate normal at current vertex with 4 neighboring vertices.
-            // The normal is the cross product between the relative vectors:
-            //
-            //  .   .   .   .   .
-            //  .   .  v_n  .   .
-            //  .  v_w (*) v_e  .  ==> normal at (*): (v_e - v_w) x (v_n - v_s)
-            //  .   .  v_s  .   .
-            //  .   .   .   .   .
-            //
-            // If vertices on the grid fall together to make triangles (like at
-            // the caps of a simple sphere), one of these relative vectors can
-            // be zero which is bad.
-            // If this occurs, these vertices have to be avoided, for example
-            // like this:
-            //
-            //  .   .   .   .   .
-            //  .   .  v_n  .   .
-            //         (*)         <-- here a row of vertices is in one point
-            //  .  v_w v_s v_e  .
-            //  .   .   .   .   .
-
-            vec3 v_w = positions[pos_idx - 1];
-            vec3 v_e = positions[pos_idx + 1];
-            vec3 v_s = positions[pos_idx + (res_u + 2)];
-            vec3 v_n = positions[pos_idx - (res_u + 2)];
-
-            const float tol = 1e-15;
-
-            // Watch out for the "triangles":
-            if(length(v_e - v_w) < tol)
-            {
-                v_w = positions[pos_idx - (res_u + 2) - 1];
-                v_e = positions[pos_idx - (res_u + 2) + 1];
+        const string suffix(1, '0' + n);
+        prog.attr_pos[n]  = glGetAttribLocation(prog.handle, ("pos" + suffix).c_str());
+        prog.attr_col[n]  = glGetAttribLocation(prog.handle, ("col" + suffix).c_str());
+        prog.attr_norm[n] = glGetAttribLocation(prog.handle, ("norm" + suffix).c_str());
+    }
+    prog.uni_modelmat = glGetUniformLocation(prog.handle, "mat_modelview");
+    prog.uni_projmat  = glGetUniformLocation(prog.handle, "mat_projection");
+    prog.uni_blend    = glGetUniformLocation(prog.handle, "blend");
 
-                if(j == 0) swap(v_w, v_e);  // this is a very hacky fix for simple spheres
+    // Set constant uniforms:
+    gl_state.use_program(prog.handle);
+    gl_state.uniform_matrix4(prog.uni_projmat, value_ptr(get_projection()));
+}
 
-                //cerr << "INFO: WE correction #1 at i=" << i << ", j=" << j << "\n";
+void Graphics::load_upscale_program(bool report)
+{
+    // Build the new program first, so the old one stays if that fails:
+    const GLuint prog = load_program("data/shaders/upscale.vs", "data/shaders/upscale.fs", report);
 
-                if(length(v_e - v_w) < tol)
-                {
-                    v_w = positions[pos_idx + (res_u + 2) - 1];
-                    v_e = positions[pos_idx + (res_u + 2) + 1];
+    if(prog_upscale != 0)
+    {
+        gl_state.forget_program(prog_upscale);
+        glDeleteProgram(prog_upscale);
+    }
+    prog_upscale = prog;
 
-                    if(j == res_v - 1) swap(v_w, v_e);  // as above
+    // Get locations:
+    attr_upscale_pos = glGetAttribLocation(prog_upscale, "pos");
+    uni_upscale_tex_scale = glGetUniformLocation(prog_upscale, "tex_scale");
+    uni_upscale_tex_max   = glGetUniformLocation(prog_upscale, "tex_max");
+}
 
-                    //cerr << "INFO: WE correction #2 at i=" << i << ", j=" << j << "\n";
-                }
-            }
+glm::mat4 Graphics::get_projection() const
+{
+    float ratio = 1.f * screen_w / screen_h;
+    return perspective(45.f, ratio, .1f, 100.f);
+}
 
-            if(length(v_n - v_s) < tol)
-            {
-                v_s = positions[pos_idx + (res_u + 2) - 1];
-                v_n = positions[pos_idx - (res_u + 2) - 1];
+GLuint Graphics::load_program(const std::string& vs_filename, const std::string& fs_filename, bool report)
+{
+    vector<string> sources;
+    sources.push_back(read_file(vs_filename));
+    sources.push_back(read_file(fs_filename));
+
+    // Try the cache first:
+    const string key = shader_cache.get_key(sources);
+    double t = get_time();
+    GLuint handle = shader_cache.load(key);
+    if(handle != 0)
+    {
+        if(report)
+            cout << "Loaded " << vs_filename << " + " << fs_filename << " from cache in "
+                 << 1000 * (get_time() - t) << " ms\n";
+        return handle;
+    }
 
-                if(i == 0) swap(v_s, v_n);
+    // Compile shaders:
+    vector<GLuint> shaders;
+    try
+    {
+        const string *filenames[] = { &vs_filename, &fs_filename };
+        const GLenum types[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+        for(int k=0; k<2; ++k)
+        {
+            t = get_time();
+            shaders.push_back(compile_shader(types[k], sources[k], *filenames[k]));
+            if(report) cout << "Compiled " << *filenames[k] << " in " << 1000 * (get_time() - t) << " ms\n";
+        }
 
-                //cerr << "INFO: NS correction #1 at i=" << i << ", j=" << j << "\n";
+        // Link program:
+        t = get_time();
+        handle = link_program(shaders);
+        if(report) cout << "Linked " << vs_filename << " + " << fs_filename << " in " << 1000 * (get_time() - t) << " ms\n";
+    }
+    catch(...)
+    {
+        for_each(shaders.begin(), shaders.end(), glDeleteShader);
+        throw;
+    }
 
-                if(length(v_n - v_s) < tol)
-                {
-                    v_s = positions[pos_idx + (res_u + 2) + 1];
-                    v_n = positions[pos_idx - (res_u + 2) + 1];
+    // Delete shaders again:
+    for_each(shaders.begin(), shaders.end(), glDeleteShader);
 
-                    if(i == res_u - 1) swap(v_s, v_n);
+    shader_cache.store(key, handle);
 
-                    //cerr << "INFO: NS correction #2 at i=" << i << ", j=" << j << "\n";
-                }
-            }
+    return handle;
+}
 
-            // Do the cross product:
-            vec3 norm = cross(v_e - v_w, v_n - v_s);
-            const float norm_len = length(norm);
+double Graphics::get_time()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
 
-            if(norm_len < tol)
-            {
-                // Just give up at this point:
-                norm = vec3(0, 0, 0);
-                cerr << "WARNING: Null normal at i=" << i << ", j=" << j << "\n";
-            }
-            else
-            {
-                // Normal-ize!
-                norm /= norm_len;
-            }
+// Extends the box from lo to hi by n points, leaving out those that aren't
+// finite.
+static void extend_box(const vec3 *points, size_t n, vec3& lo, vec3& hi)
+{
+    for(size_t k=0; k<n; ++k)
+    {
+        if(!std::isfinite(points[k].x + points[k].y + points[k].z)) continue;
+        lo = min(lo, points[k]);
+        hi = max(hi, points[k]);
+    }
+}
+
+// Uploads bands of vertex data of a grid into the position, color and normal
+// parts of the currently bound vertex buffer, and extends the box from lo to
+// hi by their positions.  Marks the bad triangles of the grid (see
+// find_bad_grid_triangles()) in bad, which the bands must come in the order
+// of their rows for.
+class BufferSink : public VertexSink
+{
+public:
+    BufferSink(size_t n_verts, size_t first_vertex, int res_u, VertexSink* copy, GridWelder& welder,
+               vec3& lo, vec3& hi, vector<bool>& bad)
+      : n_verts(n_verts), first_vertex(first_vertex), res_u(res_u), copy(copy), welder(welder), lo(lo), hi(hi), bad(bad) {}
 
-            // Fill in GPU buffer data:
-            verts[vert_idx + 0] = positions[pos_idx].x;
-            verts[vert_idx + 1] = positions[pos_idx].y;
-            verts[vert_idx + 2] = positions[pos_idx].z;
+    void write_rows(int j0, int n_rows, const vec3* in_positions, const vec3* in_colors, const vec3* in_normals)
+    {
+        // The copy gets the grid as evaluated, and the buffer the welded one:
+        if(copy) copy->write_rows(j0, n_rows, in_positions, in_colors, in_normals);
+        const size_t n = res_u * n_rows;
+        welded.resize(3 * n);
+        copy_n(in_positions, n, welded.begin());
+        copy_n(in_colors, n, welded.begin() + n);
+        copy_n(in_normals, n, welded.begin() + 2 * n);
+        vec3 *positions = &welded[0], *colors = positions + n, *normals = colors + n;
+        welder.weld_rows(j0, n_rows, positions, colors, normals);
+
+        // Check the quads between the last band and this one, and within it:
+        for(int r=0; r<n_rows; ++r)
+        {
+            const int j = j0 + r;
+            if(j == 0) continue;
+            const vec3 *row = positions + res_u * r, *prev_row = r > 0 ? row - res_u : &last_row[0];
+            find_bad_grid_triangles(prev_row, row, res_u, bad, 2 * size_t(res_u - 1) * (j - 1));
+        }
+        last_row.assign(positions + res_u * (n_rows - 1), positions + res_u * n_rows);
 
-            verts[3 * n_verts + vert_idx + 0] = colors[col_idx].x;
-            verts[3 * n_verts + vert_idx + 1] = colors[col_idx].y;
-            verts[3 * n_verts + vert_idx + 2] = colors[col_idx].z;
+        const size_t offset = sizeof(vec3) * (first_vertex + res_u * j0), size = sizeof(vec3) * res_u * n_rows;
+        glBufferSubData(GL_ARRAY_BUFFER, offset, size, positions);
+        glBufferSubData(GL_ARRAY_BUFFER, sizeof(vec3) * n_verts + offset, size, colors);
+        glBufferSubData(GL_ARRAY_BUFFER, 2 * sizeof(vec3) * n_verts + offset, size, normals);
+        extend_box(positions, res_u * n_rows, lo, hi);
+    }
 
-            verts[6 * n_verts + vert_idx + 0] = norm.x;
-            verts[6 * n_verts + vert_idx + 1] = norm.y;
-            verts[6 * n_verts + vert_idx + 2] = norm.z;
+private:
+    size_t n_verts;  // of the whole buffer
+    size_t first_vertex;  // of the grid
+    int res_u;
+    VertexSink *copy;  // passed the same rows, if set
+    GridWelder& welder;
+    vec3 &lo, &hi;
+    vector<bool>& bad;
+    vector<vec3> welded;  // positions, colors and normals of the band
+    vector<vec3> last_row;  // of the last band
+};
+
+void Graphics::load_scene(const vector<SceneObject>& objects)
+{
+    // Split meshes into batches that can be drawn with 16 bit indices (grids
+    // have at most 64k vertices anyway), and count all vertices:
+    vector<Mesh> split_meshes(objects.size());
+    vector<vector<MeshBatch> > mesh_batches(objects.size());
+    vector<vector<uint16_t> > mesh_elems(objects.size());
+    n_model_verts = 0;
+    for(size_t o=0; o<objects.size(); ++o)
+    {
+        if(objects[o].mesh)
+        {
+            mesh_batches[o] = split_mesh(*objects[o].mesh, 65536, split_meshes[o], mesh_elems[o]);
+            n_model_verts += split_meshes[o].positions.size();
         }
+        else
+            n_model_verts += objects[o].res_u * objects[o].res_v * objects[o].n_keyframes;
     }
 
+    // Allocate the vertex buffer for all objects:
     glGenBuffers(1, &vbo_model);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo_model);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 3 * 3 * n_verts, verts, GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-    delete[] verts;
+    gl_state.bind_buffer(GL_ARRAY_BUFFER, vbo_model);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 3 * 3 * n_model_verts, NULL, GL_STATIC_DRAW);
+
+    // Fill it and collect the element indices of all objects:
+    vector<uint16_t> elems, wire_elems;
+    map<pair<int, int>, DrawBatch> grid_batches;  // by resolution, as grids of equal size share their indices
+    batches.clear();
+    transforms.clear();
+    bounds.clear();
+    grid_topologies.assign(objects.size(), GridTopology());
+    n_morphed = 0;
+    size_t first_vertex = 0;
+    for(size_t o=0; o<objects.size(); ++o)
+    {
+        const SceneObject& obj = objects[o];
+        transforms.push_back(obj.transform);
 
-    uint16_t *elems;
+        // Bounding box and size, for update_lighting():
+        vec3 lo(numeric_limits<float>::max()), hi(-numeric_limits<float>::max());
+        size_t n_triangles;
 
-    // Calculate element indices for filled model:
-    elems = new uint16_t[n_draw_elements];
-    {
-        size_t idx = 0;
-        for(int j=0; j < res_v - 1; ++j)
+        if(obj.grid || obj.vertices)
         {
-            if(j > 0)
+            const pair<int, int> res(obj.res_u, obj.res_v);
+            map<pair<int, int>, DrawBatch>::iterator it = grid_batches.find(res);
+            if(it == grid_batches.end())
             {
-                // Generate degenerate triangles:
-                elems[idx ++] = res_u * (j + 1) - 1;
-                elems[idx ++] = res_u * j;
+                // Calculate element indices for filled grid and wireframe:
+                DrawBatch batch;
+                batch.mode = GL_TRIANGLE_STRIP;
+                batch.first_element = elems.size();
+                batch.n_elements = n_strip_elements(obj.res_u, obj.res_v);
+                batch.first_wire_element = wire_elems.size();
+                batch.n_wire_elements = n_wire_elements(obj.res_u, obj.res_v);
+
+                elems.resize(elems.size() + batch.n_elements);
+                gen_strip_indices(obj.res_u, obj.res_v, &elems[batch.first_element]);
+                wire_elems.resize(wire_elems.size() + batch.n_wire_elements);
+                gen_wire_indices(obj.res_u, obj.res_v, &wire_elems[batch.first_wire_element]);
+
+                it = grid_batches.insert(make_pair(res, batch)).first;
             }
 
-            for(int i=0; i<res_u; ++i)
+            const size_t n_verts = obj.res_u * obj.res_v;
+            DrawBatch batch = it->second;
+            batch.object = o;
+            batch.first_vertex = first_vertex;
+            batch.n_keyframes = obj.n_keyframes;
+            batch.keyframe_verts = n_verts;
+            batches.push_back(batch);
+            if(obj.n_keyframes > 1) ++ n_morphed;
+
+            // Triangles with coinciding vertices (as at the poles of a
+            // sphere) or vertices where the formulas aren't finite:
+            n_triangles = 2 * (obj.res_u - 1) * (obj.res_v - 1);
+            vector<bool> bad(n_triangles, false);
+
+            // Seams and poles are welded on the way into the buffer.  Of
+            // keyframes, the first one is reported:
+            GridWelder welder(obj.res_u, obj.res_v, obj.weld_tolerance);
+            bool inwards = true;  // in all keyframes
+            if(obj.vertices)
+            {
+                // The keyframes follow each other, like separate grids.
+                // Triangles without area are only left out if they have none
+                // in all keyframes, but those with a non-finite vertex in any
+                // keyframe would show garbage while morphing:
+                vector<bool> non_finite(n_verts, false);
+                for(int k=0; k<obj.n_keyframes; ++k)
+                {
+                    const vec3 *vertices = obj.vertices + 3 * n_verts * k;
+                    for(size_t v=0; v<n_verts; ++v)
+                    {
+                        if(!std::isfinite(vertices[v].x + vertices[v].y + vertices[v].z)) non_finite[v] = true;
+                    }
+                    vector<bool> bad_in_keyframe(n_triangles, false);
+                    GridWelder keyframe_welder(obj.res_u, obj.res_v, obj.weld_tolerance);
+                    BufferSink sink(n_model_verts, first_vertex + n_verts * k, obj.res_u, obj.copy_sink,
+                                    k == 0 ? welder : keyframe_welder, lo, hi, k == 0 ? bad : bad_in_keyframe);
+                    sink.write_rows(0, obj.res_v, vertices, vertices + n_verts, vertices + 2 * n_verts);
+                    for(size_t t=0; t<n_triangles && k>0; ++t) bad[t] = bad[t] && bad_in_keyframe[t];
+
+                    const GridTopology topo = (k == 0 ? welder : keyframe_welder).get_topology();
+                    if(k == 0 || (grid_topologies[o].is_closed() && !topo.is_closed())) grid_topologies[o] = topo;
+                    inwards = inwards && topo.volume < 0;
+                }
+                for(int j=0; j < obj.res_v - 1 && obj.n_keyframes > 1; ++j)
+                {
+                    for(int i=0; i < obj.res_u - 1; ++i)
+                    {
+                        const size_t a = i + obj.res_u * j, b = a + 1, c = a + obj.res_u, d = c + 1;
+                        const size_t t = 2 * (i + size_t(obj.res_u - 1) * j);
+                        if(non_finite[a] || non_finite[b] || non_finite[c]) bad[t] = true;
+                        if(non_finite[b] || non_finite[c] || non_finite[d]) bad[t + 1] = true;
+                    }
+                }
+            }
+            else
             {
-                elems[idx ++] = i + res_u * j;
-                elems[idx ++] = i + res_u * (j + 1);
+                // Evaluate the grid and fill the buffer in bands of about 16k vertices:
+                BufferSink sink(n_model_verts, first_vertex, obj.res_u, obj.copy_sink, welder, lo, hi, bad);
+                stream_grid(*obj.grid, obj.res_u, obj.res_v, max(1, 16384 / obj.res_u), sink);
+                grid_topologies[o] = welder.get_topology();
+                inwards = grid_topologies[o].volume < 0;
             }
-        }
-        assert(idx == n_draw_elements);
-    }
+            first_vertex += n_verts * obj.n_keyframes;
 
-    glGenBuffers(1, &ibo_model);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_model);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint16_t) * n_draw_elements, elems, GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+            const GridWeldStats& weld_stats = welder.get_stats();
+            if(weld_stats.n_merged > 0)
+            {
+                cout << "Surface " << (o + 1) << ": welded " << weld_stats.n_seam_rows << " seam and "
+                     << weld_stats.n_pole_rows << " pole row(s), " << weld_stats.n_merged << " of " << n_verts
+                     << " vertices merged (" << (100.0 * weld_stats.n_merged / n_verts) << "%), "
+                     << weld_stats.n_recalculated << " normal(s) recalculated\n";
+            }
+            const NormalStats& normal_stats = weld_stats.null_stats;
+            if(normal_stats.n_null > 0)
+            {
+                cerr << "WARNING: " << normal_stats.n_null << " null normal(s) in surface " << (o + 1)
+                     << ", the first at i=" << normal_stats.first_null_i << ", j=" << normal_stats.first_null_j << "\n";
+            }
 
-    delete[] elems;
+            // Closed grids that face inwards are turned around for backface
+            // culling, as orient_mesh() does with meshes:
+            GridTopology& topo = grid_topologies[o];
+            const bool flip = inwards && topo.finite && topo.u_closed && topo.v_closed;
+            if(flip)
+            {
+                topo.volume = -topo.volume;
+                cout << "Surface " << (o + 1) << ": turned around, as it faced inwards\n";
+            }
 
-    // Calculate element indices for model wireframe:
-    elems = new uint16_t[n_draw_wire_elements];
-    {
-        size_t idx = 0;
-        for(int j=0; j < res_v; ++j)
-        {
-            for(int i=0; i < res_u - 1; ++i)
+            // Draw grids with bad triangles as a list of the others, rather
+            // than with the shared strip, and so turned around ones:
+            const size_t n_bad = count(bad.begin(), bad.end(), true);
+            if(n_bad > 0 || flip)
             {
-                elems[idx ++] = i + res_u * j;
-                elems[idx ++] = i + 1 + res_u * j;
+                DrawBatch& list_batch = batches.back();
+                list_batch.mode = GL_TRIANGLES;
+                list_batch.first_element = elems.size();
+                gen_triangle_indices(obj.res_u, obj.res_v, bad, elems);
+                list_batch.n_elements = elems.size() - list_batch.first_element;
+                for(size_t e=list_batch.first_element; e<elems.size() && flip; e+=3) swap(elems[e + 1], elems[e + 2]);
+                list_batch.first_wire_element = wire_elems.size();
+                list_batch.n_wire_elements = 2 * list_batch.n_elements;
+                wire_elems.resize(wire_elems.size() + list_batch.n_wire_elements);
+                if(list_batch.n_elements > 0)
+                {
+                    gen_wire_indices(&elems[list_batch.first_element], list_batch.n_elements / 3,
+                                     &wire_elems[list_batch.first_wire_element]);
+                }
+
+                n_triangles -= n_bad;
+                if(n_bad > 0)
+                    cout << "Surface " << (o + 1) << ": " << n_bad << " degenerate or non-finite triangle(s) left out\n";
             }
         }
-        for(int i=0; i < res_u; ++i)
+        else
         {
-            for(int j=0; j < res_v - 1; ++j)
+            const Mesh& split = split_meshes[o];
+            for(size_t b=0; b<mesh_batches[o].size(); ++b)
             {
-                elems[idx ++] = i + res_u * j;
-                elems[idx ++] = i + res_u * (j + 1);
+                const MeshBatch& mesh_batch = mesh_batches[o][b];
+                DrawBatch batch;
+                batch.mode = GL_TRIANGLES;
+                batch.object = o;
+                batch.first_vertex = first_vertex + mesh_batch.first_vertex;
+                batch.first_element = elems.size() + mesh_batch.first_index;
+                batch.n_elements = mesh_batch.n_indices;
+                batch.first_wire_element = wire_elems.size() + 2 * mesh_batch.first_index;
+                batch.n_wire_elements = 2 * mesh_batch.n_indices;
+                batch.n_keyframes = 1;
+                batch.keyframe_verts = 0;
+                batches.push_back(batch);
             }
-        }
-        assert(idx == n_draw_wire_elements);
-    }
 
-    glGenBuffers(1, &ibo_model_wire);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_model_wire);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint16_t) * n_draw_wire_elements, elems, GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+            const vector<uint16_t>& obj_elems = mesh_elems[o];
+            elems.insert(elems.end(), obj_elems.begin(), obj_elems.end());
+            wire_elems.resize(wire_elems.size() + 2 * obj_elems.size());
+            if(!obj_elems.empty())
+            {
+                gen_wire_indices(&obj_elems[0], obj_elems.size() / 3,
+                                 &wire_elems[wire_elems.size() - 2 * obj_elems.size()]);
+            }
 
-    delete[] elems;
-}
+            const size_t offset = sizeof(vec3) * first_vertex, size = sizeof(vec3) * split.positions.size();
+            if(size > 0)
+            {
+                glBufferSubData(GL_ARRAY_BUFFER, offset, size, &split.positions[0]);
+                glBufferSubData(GL_ARRAY_BUFFER, sizeof(vec3) * n_model_verts + offset, size, &split.colors[0]);
+                glBufferSubData(GL_ARRAY_BUFFER, 2 * sizeof(vec3) * n_model_verts + offset, size, &split.normals[0]);
+            }
+            first_vertex += split.positions.size();
+            n_triangles = obj_elems.size() / 3;
+            if(!split.positions.empty()) extend_box(&split.positions[0], split.positions.size(), lo, hi);
+        }
 
-void Graphics::rotate_cam(float dphi, float dtheta, float droll)
-{
-    dphi *= M_PI / 180.f;
-    dtheta *= M_PI / 180.f;
-    droll *= M_PI / 180.f;
+        ObjectBounds ob;
+        ob.center = .5f * (lo + hi);
+        ob.radius = .5f * length(hi - lo);
+        ob.n_triangles = n_triangles;
+        bounds.push_back(ob);
+    }
 
-    cam_orient = normalize(cross(quat(vec3(dtheta, dphi, -droll)), cam_orient));
+    glGenBuffers(1, &ibo_model);
+    gl_state.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, ibo_model);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint16_t) * elems.size(), elems.empty() ? NULL : &elems[0], GL_STATIC_DRAW);
+
+    glGenBuffers(1, &ibo_model_wire);
+    gl_state.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, ibo_model_wire);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint16_t) * wire_elems.size(),
+                 wire_elems.empty() ? NULL : &wire_elems[0], GL_STATIC_DRAW);
 }
 
 void Graphics::init_egl_context()
@@ -456,33 +917,23 @@ void Graphics::init_egl_context()
         throw EGLException("eglSwapInterval");
 }
 
-GLuint Graphics::compile_shader(GLenum type, const std::string& filename)
+std::string Graphics::read_file(const std::string& filename)
 {
-    char *shader_text = NULL;
-    int shader_length = 0;
-
-    // Read file contents:
-    //   Open file:
-    ifstream file_stream(filename.c_str());
-
-    //   Get file length:
-    file_stream.seekg(0, ios::end);
-    shader_length = file_stream.tellg();
-    file_stream.seekg(0, ios::beg);
-
-    //   Read into buffer:
-    shader_text = new char[shader_length];
-    file_stream.read(shader_text, shader_length);
-
-    //    Close file:
-    file_stream.close();
+    ifstream file_stream(filename.c_str(), ios::binary);
+    if(!file_stream) throw SysException(filename);
 
+    stringstream contents;
+    contents << file_stream.rdbuf();
+    return contents.str();
+}
 
+GLuint Graphics::compile_shader(GLenum type, const std::string& source, const std::string& filename)
+{
     // Create OpenGL shader:
     const GLuint handle = glCreateShader(type);
-    const char *const_shader_text = shader_text;
-    glShaderSource(handle, 1, &const_shader_text, &shader_length);
-    delete[] shader_text;
+    const char *shader_text = source.c_str();
+    const GLint shader_length = source.length();
+    glShaderSource(handle, 1, &shader_text, &shader_length);
     glCompileShader(handle);
 
     // Check for errors:
@@ -499,6 +950,7 @@ GLuint Graphics::compile_shader(GLenum type, const std::string& filename)
         // Print log:
         cerr << "Compilation of \"" << filename << "\" failed:\n" << log_text << "\n";
         delete[] log_text;
+        glDeleteShader(handle);
 
         throw GLException("shader compilation failed");
     }
@@ -538,6 +990,7 @@ GLuint Graphics::link_program(const vector<GLuint>& shaders)
         // Print log:
         cerr << "Linking of shader program failed:\n" << log_text << "\n";
         delete[] log_text;
+        glDeleteProgram(handle);
 
         throw GLException("program linking failed");
     }
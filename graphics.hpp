@@ -10,6 +10,31 @@
 #include <EGL/egl.h>
 #include <GLES2/gl2.h>
 #include <SDL.h>
+#include "camera.hpp"
+#include "capture.hpp"
+#include "glstate.hpp"
+#include "mesh.hpp"
+#include "rescale.hpp"
+#include "shadercache.hpp"
+
+// A surface of the scene: either a res_u*res_v grid evaluated by grid (or
+// given by its vertex data) or a triangle mesh.
+struct SceneObject
+{
+    SceneObject() : grid(NULL), res_u(0), res_v(0), vertices(NULL), n_keyframes(1), copy_sink(NULL), weld_tolerance(0), mesh(NULL), transform(1) {}
+
+    GridSource *grid;
+    int res_u, res_v;
+    const glm::vec3 *vertices;  // if set, the positions, colors and normals of the grid, one after the other
+    int n_keyframes;  // if more than 1, vertices has that many grids to morph between (see Graphics::set_sweep_position())
+    VertexSink *copy_sink;  // if set, also receives the vertex data evaluated from grid
+    float weld_tolerance;  // for welding the seams and poles of the grid (see GridWelder)
+    const Mesh *mesh;
+    glm::mat4 transform;  // model matrix (translation and uniform scaling only)
+};
+
+// How surfaces are lit (see Graphics::set_lighting_mode()):
+enum LightingMode { LIGHTING_AUTO, LIGHTING_PER_FRAGMENT, LIGHTING_PER_VERTEX };
 
 class Graphics
 {
@@ -17,53 +42,176 @@ public:
     Graphics();
     ~Graphics();
 
-    // Calculates normals from given positions and loads both into GPU memory.
-    // Around a grid of size res_u*res_v, positions must have a frame of
-    // sentinel vertices for the calculation of normals (therefore the positions
-    // array has to have (res_u+2)*(res_v+2) entries).
-    void load_model(const glm::vec3* positions, const glm::vec3* colors, int res_u, int res_v);
+    // Loads the surfaces of a scene into GPU memory.  All vertices go into one
+    // buffer, and grids of the same size share their element indices.  Grids
+    // are evaluated and their normals calculated while streaming them row by
+    // row, so apart from the buffer objects memory use only grows with res_u.
+    void load_scene(const std::vector<SceneObject>& objects);
+    // Whether a grid object of the scene is closed (see GridWelder), in all
+    // of its keyframes.
+    const GridTopology& get_grid_topology(size_t object) const { return grid_topologies[object]; }
 
     void render();
-    void rotate_cam(float dphi, float dtheta, float droll);
-    void move_cam(float dz) { cam_pos_z = glm::clamp(cam_pos_z + dz, 0.f, 100.f); }
-    void reload_data() { load_shaders(); }
+    void set_camera(const Camera& camera) { this->camera = camera; }
+    const Camera& get_camera() const { return camera; }
+    // Reloads all shader programs.  Programs that fail to build are kept.
+    void reload_data();
+    // Rebuilds the shader program which uses the given file from the shader
+    // directory.  Returns false if there is none or if it fails to build, in
+    // which case the previous program stays in use.
+    bool reload_shader(const std::string& filename);
     void get_screen_size(int& w, int& h) const { w = sdl_screen->w;  h = sdl_screen->h; }
     void set_vsync(bool vsync) { this->vsync = vsync;  eglSwapInterval(egl_display, vsync); }
     bool get_vsync() const { return vsync; }
-    void set_culling(bool culling) { if((this->culling = culling)) glEnable(GL_CULL_FACE); else glDisable(GL_CULL_FACE); }
+    void set_culling(bool culling) { gl_state.set_capability(GL_CULL_FACE, this->culling = culling); }
     bool get_culling() const { return culling; }
     void set_wire_mode(bool wire_mode) { this->wire_mode = wire_mode; }
     bool get_wire_mode() const { return wire_mode; }
+    // Per-vertex lighting looks the same as per-fragment lighting when the
+    // triangles are only a few pixels in size, and is much cheaper.  In
+    // LIGHTING_AUTO mode each surface is lit per vertex while its triangles
+    // are that small on the screen.
+    void set_lighting_mode(LightingMode mode) { lighting_mode = mode; }
+    LightingMode get_lighting_mode() const { return lighting_mode; }
+    // Returns how many surfaces were lit per vertex in the last frame.
+    size_t get_n_per_vertex() const;
+    // Renders the scene into an offscreen framebuffer at a resolution that
+    // adapts to keep frames at about target_time seconds, and upscales it to
+    // the screen.  0 renders directly at the screen resolution.
+    void set_target_frame_time(double target_time);
+    // Returns the fraction of the screen resolution the scene is rendered at,
+    // and the average time of recent frames (with a target frame time only).
+    float get_render_scale() const { return scaler.is_enabled() ? scaler.get_scale() : 1; }
+    double get_frame_time() const { return scaler.get_frame_time(); }
+    // Sets where between the first (0) and the last (1) of their keyframes
+    // objects with several ones are drawn.  The vertex shader interpolates
+    // between the two nearest keyframes.
+    void set_sweep_position(float position) { sweep_position = position; }
+    bool has_keyframes() const { return n_morphed > 0; }
+    // Passes every rendered frame (at screen resolution) to capture, if set.
+    void set_capture(FrameCapture* capture) { this->capture = capture; }
+    // Returns the numbers of issued and skipped GL state changes since the last call.
+    GLState::Stats take_gl_stats() { return gl_state.take_stats(); }
 
 private:
     void init_egl_context();
     void init_gl();
     void load_shaders();
+    void load_simple_program(bool report = false);
+    // A program with the attributes and uniforms of shiny.vs:
+    struct LitProgram
+    {
+        LitProgram() : handle(0) {}
+
+        GLuint handle;
+        GLuint attr_pos, attr_col, attr_norm;
+        GLuint uni_modelmat, uni_projmat;
+    };
+
+    // A program with the attributes and uniforms of morph.vs, which come in
+    // pairs for the two keyframes:
+    struct MorphProgram
+    {
+        MorphProgram() : handle(0) {}
+
+        GLuint handle;
+        GLuint attr_pos[2], attr_col[2], attr_norm[2];
+        GLuint uni_modelmat, uni_projmat, uni_blend;
+    };
+
+    // Loads prog from the files data/shaders/<stem>.vs and .fs.
+    void load_lit_program(LitProgram& prog, const std::string& stem, bool report = false);
+    void load_upscale_program(bool report = false);
+    // Loads prog from data/shaders/morph.vs and the given fragment shader.
+    void load_morph_program(MorphProgram& prog, const std::string& fs_filename, bool report = false);
+    void init_framebuffer();
+    void free_framebuffer();
+    void draw_scene();
+    // Decides for each object whether to light it per vertex, by the
+    // average projected area of its front facing triangles.
+    void update_lighting(const glm::mat4& modelview);
+    glm::mat4 get_projection() const;
 
-    static GLuint compile_shader(GLenum type, const std::string& filename);
+    // Loads a program from the shader cache, or compiles and links it from
+    // the given vertex and fragment shader files (and caches it).  If report
+    // is set, the time taken by each step is printed.
+    GLuint load_program(const std::string& vs_filename, const std::string& fs_filename, bool report = false);
+
+    static double get_time();
+    static std::string read_file(const std::string& filename);
+    static GLuint compile_shader(GLenum type, const std::string& source, const std::string& filename);
     static GLuint link_program(const std::vector<GLuint>& shaders);
 
-    int res_u;
-    int res_v;
-    size_t n_draw_elements, n_draw_wire_elements;
+    // A part of the model that is drawn with one call (per mode), as 16 bit
+    // indices can only address 64k vertices.
+    struct DrawBatch
+    {
+        GLenum mode;  // for the filled model
+        size_t object;  // index of the SceneObject
+        size_t first_vertex;
+        size_t first_element, n_elements;  // in ibo_model
+        size_t first_wire_element, n_wire_elements;  // in ibo_model_wire
+        int n_keyframes;  // of a morphed grid, whose keyframes follow each other
+        size_t keyframe_verts;  // vertices per keyframe
+    };
+
+    // Returns the offset of the first vertex of batch in the positions (0),
+    // colors (1) or normals (2) part of vbo_model.
+    const void *vertex_offset(int part, const DrawBatch& batch) const
+    {
+        return (const void *)(sizeof(float) * 3 * (part * n_model_verts + batch.first_vertex));
+    }
+
+    // Sets up prog to draw the morphed grid of batch at sweep_position.
+    void use_morph_program(const MorphProgram& prog, const DrawBatch& batch, const glm::mat4& modelview);
+
+    // Bounding sphere (in model coordinates) and size of a scene object:
+    struct ObjectBounds
+    {
+        glm::vec3 center;
+        float radius;
+        size_t n_triangles;
+    };
+
+    size_t n_model_verts;
+    std::vector<DrawBatch> batches;
+    std::vector<glm::mat4> transforms;  // of the scene objects
+    std::vector<ObjectBounds> bounds;  // of the scene objects
+    std::vector<GridTopology> grid_topologies;  // of the scene objects, if they are grids
+    std::vector<bool> per_vertex;  // lighting of the scene objects in this frame
+    size_t n_morphed;  // objects with keyframes
+    float sweep_position;
 
     SDL_Surface *sdl_screen;
     uint32_t screen_w, screen_h;
     EGLDisplay egl_display;
     EGLSurface egl_surface;
     bool vsync, culling, wire_mode;
+    LightingMode lighting_mode;
+
+    GLState gl_state;
 
     GLuint vao;
     GLuint vbo_model;
     GLuint ibo_model, ibo_model_wire;
-    GLuint prog_simple, prog_shiny;
+    ShaderCache shader_cache;
+    GLuint prog_simple, prog_upscale;
+    LitProgram prog_shiny, prog_gouraud;
+    MorphProgram prog_morph, prog_morph_wire;  // with shiny.fs and simple.fs
     GLuint attr_simple_pos, attr_simple_col;
-    GLuint attr_shiny_pos, attr_shiny_col, attr_shiny_norm;
+    GLuint attr_upscale_pos;
     GLuint uni_simple_modelmat, uni_simple_projmat;
-    GLuint uni_shiny_modelmat, uni_shiny_projmat;
+    GLuint uni_upscale_tex_scale, uni_upscale_tex_max;
+
+    // Offscreen framebuffer of screen size, of which the scene uses the lower
+    // left render scale part (so changing the scale needs no reallocation):
+    GLuint fbo, fbo_color, fbo_depth;
+    GLuint vbo_quad;  // covers the screen, for the upscale pass
+    ResolutionScaler scaler;
+
+    FrameCapture *capture;
 
-    glm::quat cam_orient;
-    float cam_pos_z;
+    Camera camera;
 };
 
 #endif  // GRAPHICS_HPP
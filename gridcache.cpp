@@ -0,0 +1,190 @@
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "gridcache.hpp"
+#include "cachedir.hpp"
+#include "hash.hpp"
+using namespace std;
+using glm::vec3;
+
+static const char cache_magic[4] = { 'P', 'P', 'G', 'C' };
+static const uint32_t cache_version = 1;
+static const char cache_suffix[] = ".grid";
+
+// The vertex data follows the header: positions, colors and normals of all
+// vertices, one after the other.
+struct CacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t res_u, res_v;
+};
+
+// Returns the size of an entry of a res_u*res_v grid.
+static size_t entry_size(int res_u, int res_v)
+{
+    return sizeof(CacheHeader) + 3 * sizeof(vec3) * res_u * res_v;
+}
+
+// Writes all of data at offset of fd.  Returns false on failure.
+static bool write_at(int fd, const void *data, size_t size, off_t offset)
+{
+    const char *p = static_cast<const char*>(data);
+    while(size > 0)
+    {
+        const ssize_t n = pwrite(fd, p, size, offset);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        p += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+const vec3 *MappedGrid::get_vertices() const
+{
+    return reinterpret_cast<const vec3*>(static_cast<const char*>(data) + sizeof(CacheHeader));
+}
+
+void MappedGrid::unmap()
+{
+    if(!data) return;
+    munmap(data, length);
+    data = NULL;
+    length = 0;
+}
+
+void GridCacheWriter::write_rows(int j0, int n_rows, const vec3* positions, const vec3* colors, const vec3* normals)
+{
+    if(fd < 0 || failed) return;
+
+    const size_t n_verts = size_t(res_u) * res_v;
+    const off_t offset = sizeof(CacheHeader) + sizeof(vec3) * res_u * j0;
+    const size_t size = sizeof(vec3) * res_u * n_rows;
+    failed = !write_at(fd, positions, size, offset)
+          || !write_at(fd, colors, size, offset + sizeof(vec3) * n_verts)
+          || !write_at(fd, normals, size, offset + 2 * sizeof(vec3) * n_verts);
+}
+
+bool GridCacheWriter::commit()
+{
+    if(fd < 0) return false;
+
+    if(failed || close(fd) != 0 || rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        cerr << "WARNING: Can't write grid cache entry \"" << tmp_path << "\"\n";
+        discard();
+        return false;
+    }
+    fd = -1;
+    return true;
+}
+
+void GridCacheWriter::discard()
+{
+    if(fd < 0) return;
+    close(fd);
+    remove(tmp_path.c_str());
+    fd = -1;
+}
+
+void GridCache::init(size_t max_size)
+{
+    this->max_size = max_size;
+    dir = max_size > 0 ? get_cache_dir("grids") : "";
+}
+
+string GridCache::get_key(const string& definition, int res_u, int res_v) const
+{
+    const int32_t res[2] = { res_u, res_v };
+    const uint64_t h = fnv1a(res, sizeof(res), fnv1a(definition));
+
+    char key[17];
+    snprintf(key, sizeof(key), "%016" PRIx64, h);
+    return key;
+}
+
+string GridCache::get_path(const string& key) const
+{
+    return dir + "/" + key + cache_suffix;
+}
+
+bool GridCache::load(const string& key, int res_u, int res_v, MappedGrid& grid) const
+{
+    if(!is_enabled()) return false;
+
+    const string path = get_path(key);
+    const int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) return false;
+
+    // Entries of a different size can't be right, and would fault beyond the
+    // end of the file:
+    struct stat st;
+    const size_t length = entry_size(res_u, res_v);
+    void *data = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && size_t(st.st_size) == length)
+        data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) return false;
+
+    const CacheHeader *header = static_cast<const CacheHeader*>(data);
+    if(memcmp(header->magic, cache_magic, sizeof(cache_magic)) != 0 || header->version != cache_version
+       || header->res_u != uint32_t(res_u) || header->res_v != uint32_t(res_v))
+    {
+        munmap(data, length);
+        return false;
+    }
+
+    // Mark the entry as recently used:
+    utimes(path.c_str(), NULL);
+
+    grid.unmap();
+    grid.data = data;
+    grid.length = length;
+    return true;
+}
+
+bool GridCache::begin_store(const string& key, int res_u, int res_v, GridCacheWriter& writer) const
+{
+    if(!is_enabled()) return false;
+    writer.discard();
+
+    // Write to a temporary file first, so that there are never half-written
+    // entries in the cache.  Its name is unique, as several writers (of equal
+    // surfaces in one scene, or of other processes) may store the same key:
+    writer.path = get_path(key);
+    writer.tmp_path = writer.path + ".XXXXXX";
+    writer.fd = mkostemp(&writer.tmp_path[0], O_CLOEXEC);
+    if(writer.fd >= 0) fchmod(writer.fd, 0644);
+    if(writer.fd < 0)
+    {
+        cerr << "WARNING: Can't create grid cache entry \"" << writer.tmp_path << "\": " << strerror(errno) << "\n";
+        return false;
+    }
+
+    CacheHeader header;
+    memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.version = cache_version;
+    header.res_u = res_u;
+    header.res_v = res_v;
+
+    writer.res_u = res_u;
+    writer.res_v = res_v;
+    writer.failed = ftruncate(writer.fd, entry_size(res_u, res_v)) != 0
+                 || !write_at(writer.fd, &header, sizeof(header), 0);
+    return true;
+}
+
+void GridCache::evict() const
+{
+    if(is_enabled()) evict_cache_files(dir, cache_suffix, max_size);
+}
@@ -0,0 +1,101 @@
+#ifndef GRIDCACHE_HPP
+#define GRIDCACHE_HPP
+
+#include <string>
+#include <glm/glm.hpp>
+#include "mesh.hpp"
+
+// The vertex data of a grid, mapped read-only from a grid cache entry.
+class MappedGrid
+{
+public:
+    MappedGrid() : data(NULL), length(0) {}
+    ~MappedGrid() { unmap(); }
+
+    bool is_mapped() const { return data != NULL; }
+
+    // Returns the positions, colors and normals (res_u*res_v each, one after
+    // the other), as SceneObject::vertices expects them.
+    const glm::vec3 *get_vertices() const;
+
+    void unmap();
+
+private:
+    MappedGrid(const MappedGrid&);
+    MappedGrid& operator=(const MappedGrid&);
+    friend class GridCache;
+
+    void *data;
+    size_t length;
+};
+
+// Writes the vertex data of a grid into a new grid cache entry, as it is
+// streamed by stream_grid().  The entry only appears in the cache when it is
+// committed.
+class GridCacheWriter : public VertexSink
+{
+public:
+    GridCacheWriter() : fd(-1), res_u(0), res_v(0), failed(false) {}
+    ~GridCacheWriter() { discard(); }
+
+    bool is_open() const { return fd >= 0; }
+
+    void write_rows(int j0, int n_rows, const glm::vec3* positions,
+                    const glm::vec3* colors, const glm::vec3* normals);
+
+    // Moves the entry into the cache.  Returns false if it couldn't be
+    // written completely, in which case it is discarded.
+    bool commit();
+
+    void discard();
+
+private:
+    GridCacheWriter(const GridCacheWriter&);
+    GridCacheWriter& operator=(const GridCacheWriter&);
+    friend class GridCache;
+
+    int fd;
+    std::string path, tmp_path;
+    int res_u, res_v;
+    bool failed;
+};
+
+// On-disk cache of evaluated grids, so that surfaces which were already
+// plotted with the same formulas and resolution don't have to be evaluated
+// again.  Entries are keyed by a hash of the surface definition (see
+// Surface::get_definition()) and the resolution, and are loaded with mmap(),
+// without any parsing.  When the cache grows beyond its size limit, the
+// least recently used entries are removed.
+class GridCache
+{
+public:
+    GridCache() : max_size(0) {}
+
+    // Sets up the cache directory.  A max_size of 0 disables the cache.
+    void init(size_t max_size);
+
+    bool is_enabled() const { return !dir.empty(); }
+
+    // Returns the key of a res_u*res_v grid of the surface with the given
+    // definition.
+    std::string get_key(const std::string& definition, int res_u, int res_v) const;
+
+    // Maps the entry for key into grid.  Returns false if there is no usable
+    // entry.
+    bool load(const std::string& key, int res_u, int res_v, MappedGrid& grid) const;
+
+    // Opens writer for a new entry.  Returns false on failure.
+    bool begin_store(const std::string& key, int res_u, int res_v, GridCacheWriter& writer) const;
+
+    // Removes the least recently used entries until the cache is within its
+    // size limit.
+    void evict() const;
+
+private:
+    std::string get_path(const std::string& key) const;
+
+    std::string dir;
+    size_t max_size;  // in bytes
+};
+
+#endif  // GRIDCACHE_HPP
@@ -0,0 +1,28 @@
+#ifndef HASH_HPP
+#define HASH_HPP
+
+#include <cinttypes>
+#include <cstddef>
+#include <string>
+
+// 64-bit FNV-1a hash.  Pass the result of a previous call as h to hash
+// several pieces of data as if they were concatenated.
+inline uint64_t fnv1a(const void* data, size_t length, uint64_t h = 14695981039346656037ULL)
+{
+    const unsigned char *p = static_cast<const unsigned char*>(data);
+    for(size_t k=0; k<length; ++k)
+    {
+        h ^= p[k];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+inline uint64_t fnv1a(const std::string& str, uint64_t h = 14695981039346656037ULL)
+{
+    // Include the terminating null character so that ("ab", "c") and
+    // ("a", "bc") give different hashes:
+    return fnv1a(str.c_str(), str.length() + 1, h);
+}
+
+#endif  // HASH_HPP
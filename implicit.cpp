@@ -0,0 +1,317 @@
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+#include "implicit.hpp"
+using namespace std;
+using namespace glm;
+
+// Corner c of a cell is offset by (c & 1, c >> 1 & 1, c >> 2 & 1).  Cells are
+// split into six tetrahedra around the diagonal from corner 0 to corner 7, so
+// neighboring cells agree on the diagonals of their common faces:
+static const int tetrahedra[6][4] =
+{
+    { 0, 7, 1, 3 }, { 0, 7, 3, 2 }, { 0, 7, 2, 6 },
+    { 0, 7, 6, 4 }, { 0, 7, 4, 5 }, { 0, 7, 5, 1 }
+};
+
+void ImplicitStats::merge(const ImplicitStats& other)
+{
+    n_nodes += other.n_nodes;
+    n_pruned += other.n_pruned;
+    n_cells += other.n_cells;
+    n_samples += other.n_samples;
+}
+
+ImplicitSurface::ImplicitSurface()
+{
+    varlist.push_back("x");
+    varlist.push_back("y");
+    varlist.push_back("z");
+
+    constmap["pi"] = M_PI;
+    constmap["e"] = M_E;
+}
+
+void ImplicitSurface::set_formula(const std::string& def)
+{
+    etors.clear();
+    etors.push_back(Evaluator(def, varlist, constmap));
+}
+
+namespace {
+
+// An octree node: the n*n*n grid cells starting at cell (i,j,k).
+struct Node
+{
+    int i, j, k, n;
+};
+
+// Polygonizes octree nodes.  There is one per thread, each with its own caches.
+class Polygonizer
+{
+public:
+    Polygonizer(const Evaluator& formula, int depth, double size)
+      : formula(formula), res(1 << depth), size(size), vars(3), ivars(3) {}
+
+    // Returns false if the surface can't pass through node.
+    bool may_contain_surface(const Node& node);
+
+    // Polygonizes node into mesh, recursing into its children.
+    void process(const Node& node, Mesh& mesh);
+
+    // Forgets the cached samples and vertices, which only pay off for nearby cells.
+    void clear_caches() { values.clear();  edge_verts.clear(); }
+
+    ImplicitStats stats;
+
+private:
+    double coord(int i) const { return size * (2.0 * i / res - 1); }
+    uint64_t point_id(int i, int j, int k) const { return i + (res + 1) * (j + uint64_t(res + 1) * k); }
+
+    double eval(const dvec3& p);
+    double sample(int i, int j, int k);
+    vec3 calc_normal(const dvec3& p);
+    uint32_t edge_vertex(const int *a, double va, const int *b, double vb, Mesh& mesh);
+    void polygonize_cell(int i, int j, int k, Mesh& mesh);
+    void add_triangle(uint32_t v0, uint32_t v1, uint32_t v2, Mesh& mesh);
+
+    const Evaluator& formula;
+    const int res;  // cells along each axis
+    const double size;
+    vector<double> vars;
+    vector<Interval> ivars;
+
+    unordered_map<uint64_t, double> values;  // by grid point
+    unordered_map<uint64_t, uint32_t> edge_verts;  // by pair of grid points
+};
+
+bool Polygonizer::may_contain_surface(const Node& node)
+{
+    ivars[0] = Interval(coord(node.i), coord(node.i + node.n));
+    ivars[1] = Interval(coord(node.j), coord(node.j + node.n));
+    ivars[2] = Interval(coord(node.k), coord(node.k + node.n));
+
+    ++ stats.n_nodes;
+    if(formula.evaluate(ivars).contains(0)) return true;
+    ++ stats.n_pruned;
+    return false;
+}
+
+void Polygonizer::process(const Node& node, Mesh& mesh)
+{
+    if(node.n == 1)
+    {
+        polygonize_cell(node.i, node.j, node.k, mesh);
+        return;
+    }
+
+    if(!may_contain_surface(node)) return;
+
+    const int h = node.n / 2;
+    for(int c=0; c<8; ++c)
+    {
+        const Node child = { node.i + (c & 1) * h, node.j + (c >> 1 & 1) * h, node.k + (c >> 2 & 1) * h, h };
+        process(child, mesh);
+    }
+}
+
+double Polygonizer::eval(const dvec3& p)
+{
+    vars[0] = p.x;
+    vars[1] = p.y;
+    vars[2] = p.z;
+    ++ stats.n_samples;
+    return formula.evaluate(vars);
+}
+
+double Polygonizer::sample(int i, int j, int k)
+{
+    const uint64_t id = point_id(i, j, k);
+    unordered_map<uint64_t, double>::const_iterator it = values.find(id);
+    if(it != values.end()) return it->second;
+
+    const double value = eval(dvec3(coord(i), coord(j), coord(k)));
+    values[id] = value;
+    return value;
+}
+
+vec3 Polygonizer::calc_normal(const dvec3& p)
+{
+    // Central differences of the formula:
+    const double h = 1e-2 * size / res;
+    const dvec3 grad(eval(p + dvec3(h, 0, 0)) - eval(p - dvec3(h, 0, 0)),
+                     eval(p + dvec3(0, h, 0)) - eval(p - dvec3(0, h, 0)),
+                     eval(p + dvec3(0, 0, h)) - eval(p - dvec3(0, 0, h)));
+
+    const double len = length(grad);
+    if(!(len > 0) || std::isinf(len)) return vec3(0);
+    return vec3(grad / len);
+}
+
+// Returns the vertex where the surface crosses the edge between the grid
+// points a and b, creating it if necessary.
+uint32_t Polygonizer::edge_vertex(const int *a, double va, const int *b, double vb, Mesh& mesh)
+{
+    uint64_t id_a = point_id(a[0], a[1], a[2]), id_b = point_id(b[0], b[1], b[2]);
+    if(id_a > id_b)
+    {
+        swap(id_a, id_b);
+        swap(a, b);
+        swap(va, vb);
+    }
+
+    const uint64_t n_points = uint64_t(res + 1) * (res + 1) * (res + 1);
+    const uint64_t id = id_a * n_points + id_b;
+    unordered_map<uint64_t, uint32_t>::const_iterator it = edge_verts.find(id);
+    if(it != edge_verts.end()) return it->second;
+
+    double t = va / (va - vb);
+    if(!(t >= 0 && t <= 1)) t = .5;  // with NaN samples
+    const dvec3 pa(coord(a[0]), coord(a[1]), coord(a[2]));
+    const dvec3 pb(coord(b[0]), coord(b[1]), coord(b[2]));
+    const dvec3 p = pa + t * (pb - pa);
+
+    const uint32_t v = mesh.positions.size();
+    mesh.positions.push_back(vec3(p));
+    mesh.colors.push_back(vec3(1));
+    mesh.normals.push_back(calc_normal(p));
+    edge_verts[id] = v;
+    return v;
+}
+
+void Polygonizer::add_triangle(uint32_t v0, uint32_t v1, uint32_t v2, Mesh& mesh)
+{
+    // Wind the triangle counter-clockwise when seen from outside:
+    const vec3 face_normal = cross(mesh.positions[v1] - mesh.positions[v0], mesh.positions[v2] - mesh.positions[v0]);
+    const vec3 normal = mesh.normals[v0] + mesh.normals[v1] + mesh.normals[v2];
+    if(dot(face_normal, normal) < 0) swap(v1, v2);
+
+    mesh.triangles.push_back(v0);
+    mesh.triangles.push_back(v1);
+    mesh.triangles.push_back(v2);
+}
+
+void Polygonizer::polygonize_cell(int i, int j, int k, Mesh& mesh)
+{
+    ++ stats.n_cells;
+
+    int corners[8][3];
+    double values[8];
+    int n_inside = 0;
+    for(int c=0; c<8; ++c)
+    {
+        corners[c][0] = i + (c & 1);
+        corners[c][1] = j + (c >> 1 & 1);
+        corners[c][2] = k + (c >> 2 & 1);
+        values[c] = sample(corners[c][0], corners[c][1], corners[c][2]);
+        if(values[c] < 0) ++ n_inside;
+    }
+    if(n_inside == 0 || n_inside == 8) return;
+
+    for(int t=0; t<6; ++t)
+    {
+        // Sort the corners of the tetrahedron into inside and outside ones:
+        int inside[4], outside[4], n_in = 0, n_out = 0;
+        for(int c=0; c<4; ++c)
+        {
+            const int corner = tetrahedra[t][c];
+            if(values[corner] < 0)
+                inside[n_in ++] = corner;
+            else
+                outside[n_out ++] = corner;
+        }
+
+        #define EDGE_VERTEX(a, b) edge_vertex(corners[a], values[a], corners[b], values[b], mesh)
+        if(n_in == 1 || n_in == 3)
+        {
+            // One corner is cut off by a triangle:
+            const int single = n_in == 1 ? inside[0] : outside[0];
+            const int *others = n_in == 1 ? outside : inside;
+            add_triangle(EDGE_VERTEX(single, others[0]), EDGE_VERTEX(single, others[1]),
+                         EDGE_VERTEX(single, others[2]), mesh);
+        }
+        else if(n_in == 2)
+        {
+            // The tetrahedron is cut in half by a quad:
+            const uint32_t v0 = EDGE_VERTEX(inside[0], outside[0]), v1 = EDGE_VERTEX(inside[0], outside[1]);
+            const uint32_t v2 = EDGE_VERTEX(inside[1], outside[1]), v3 = EDGE_VERTEX(inside[1], outside[0]);
+            add_triangle(v0, v1, v2, mesh);
+            add_triangle(v0, v2, v3, mesh);
+        }
+        #undef EDGE_VERTEX
+    }
+}
+
+// Processes the nodes of tasks, from next_task on, until there are none left.
+void work(const Evaluator& formula, int depth, double size, const vector<Node>& tasks,
+          atomic<size_t>* next_task, vector<Mesh>* meshes, ImplicitStats* stats)
+{
+    Polygonizer polygonizer(formula, depth, size);
+
+    size_t t;
+    while((t = (*next_task) ++) < tasks.size())
+    {
+        polygonizer.clear_caches();
+        polygonizer.process(tasks[t], (*meshes)[t]);
+    }
+
+    *stats = polygonizer.stats;
+}
+
+}  // namespace
+
+ImplicitStats ImplicitSurface::polygonize(int depth, double size, Mesh& mesh, int n_threads) const
+{
+    assert(has_formula() && depth >= 0 && depth <= 10);
+
+    if(n_threads <= 0) n_threads = max(1u, std::thread::hardware_concurrency());
+
+    // Split the octree into tasks, enough of them to keep all threads busy even
+    // if the surface only passes through some:
+    Polygonizer top(etors[0], depth, size);
+    const Node root = { 0, 0, 0, 1 << depth };
+    vector<Node> tasks(1, root);
+    while(tasks.size() < 64 * size_t(n_threads) && tasks[0].n > 1)
+    {
+        vector<Node> children;
+        for(size_t t=0; t<tasks.size(); ++t)
+        {
+            const Node& node = tasks[t];
+            if(!top.may_contain_surface(node)) continue;
+
+            const int h = node.n / 2;
+            for(int c=0; c<8; ++c)
+            {
+                const Node child = { node.i + (c & 1) * h, node.j + (c >> 1 & 1) * h, node.k + (c >> 2 & 1) * h, h };
+                children.push_back(child);
+            }
+        }
+        tasks.swap(children);
+        if(tasks.empty()) break;
+    }
+
+    // Polygonize the tasks in parallel, each into its own mesh so that the
+    // result doesn't depend on scheduling:
+    vector<Mesh> meshes(tasks.size());
+    vector<ImplicitStats> stats(n_threads);
+    atomic<size_t> next_task(0);
+    vector<std::thread> threads;
+    for(int t=1; t<n_threads; ++t)
+    {
+        threads.push_back(std::thread(work, std::cref(etors[0]), depth, size, std::cref(tasks),
+                                      &next_task, &meshes, &stats[t]));
+    }
+    work(etors[0], depth, size, tasks, &next_task, &meshes, &stats[0]);
+
+    for(size_t t=0; t<threads.size(); ++t) threads[t].join();
+
+    mesh = Mesh();
+    for(size_t t=0; t<meshes.size(); ++t) mesh.append(meshes[t]);
+
+    stats[0].merge(top.stats);
+    for(int t=1; t<n_threads; ++t) stats[0].merge(stats[t]);
+    return stats[0];
+}
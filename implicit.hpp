@@ -0,0 +1,49 @@
+#ifndef IMPLICIT_HPP
+#define IMPLICIT_HPP
+
+#include <string>
+#include <vector>
+#include "evaluator.hpp"
+#include "mesh.hpp"
+
+// Work done by ImplicitSurface::polygonize().
+struct ImplicitStats
+{
+    ImplicitStats() : n_nodes(0), n_pruned(0), n_cells(0), n_samples(0) {}
+
+    void merge(const ImplicitStats& other);
+
+    size_t n_nodes;  // octree nodes whose bounds were evaluated
+    size_t n_pruned;  // of these, the ones the surface can't pass through
+    size_t n_cells;  // grid cells that were sampled
+    size_t n_samples;  // point evaluations, including those for normals
+};
+
+// An implicit surface: the points where a formula in x, y and z is zero.
+// Points where it is negative are inside.
+class ImplicitSurface
+{
+public:
+    ImplicitSurface();
+
+    // Sets the formula.  Throws a string if it can't be parsed.
+    void set_formula(const std::string& def);
+    bool has_formula() const { return !etors.empty(); }
+
+    // Switches the formula to fast-math mode (see Evaluator::set_fast_math).
+    void set_fast_math(bool fast) { if(has_formula()) etors[0].set_fast_math(fast); }
+
+    // Polygonizes the surface within the cube [-size,size]^3, which is divided
+    // into 2^depth cells along each axis.  Octree nodes are skipped where the
+    // bounds of the formula exclude zero; the remaining cells are sampled and
+    // polygonized with marching tetrahedra on n_threads threads (0 means one
+    // per CPU core).
+    ImplicitStats polygonize(int depth, double size, Mesh& mesh, int n_threads = 0) const;
+
+private:
+    Evaluator::varlist_t varlist;
+    Evaluator::constmap_t constmap;
+    std::vector<Evaluator> etors;  // empty or the formula
+};
+
+#endif  // IMPLICIT_HPP
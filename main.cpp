@@ -1,20 +1,46 @@
-#include <cassert>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <getopt.h>
 #include <iostream>
+#include <memory>
+#include <set>
 #include <string>
+#include <thread>
+#include <time.h>
 #include <vector>
 #include <unistd.h>
+#include <sys/resource.h>
 #include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
 #include <SDL.h>
 #include <bcm_host.h>
 #include "graphics.hpp"
-#include "evaluator.hpp"
+#include "camera.hpp"
+#include "capture.hpp"
+#include "filewatch.hpp"
+#include "surface.hpp"
+#include "implicit.hpp"
+#include "gridcache.hpp"
+#include "decimate.hpp"
+#include "server.hpp"
 #include "exceptions.hpp"
 using namespace std;
 
+// Codes of SDL_USEREVENTs:
+enum { EVENT_SHADER_CHANGED, EVENT_CAMERA_MOVED };
+
 static const int res_u_def = 64;
 static const int res_v_def = 64;
+static const double implicit_size = 2;  // half the edge length of the implicit mode cube
+static const int grid_cache_size_def = 64;  // MiB
+static const float weld_tolerance = 1e-5;  // relative to the size of a surface
+static const int n_keyframes_def = 16;
+static const double sweep_duration = 4;  // seconds from the first keyframe to the last
 
 void handle_sdl_error(const char *fname)
 {
@@ -42,17 +68,219 @@ void print_help(const char* progname)
          << "   Set the number of sampling points along the u and v coordinates.\n"
          << "   Their product must not be greater than 2^16.\n"
          << "   The default is " << res_u_def << ", " << res_v_def << ".\n"
+         << " -f <fdef>\n"
+         << "   Plot the implicit surface where fdef is zero instead of a parametric one.\n"
+         << "   fdef may use x, y and z, from -" << implicit_size << " to " << implicit_size << ".  In this mode -u sets the\n"
+         << "   number of cells along each axis, rounded up to a power of two (at most\n"
+         << "   1024).\n"
+         << " -t <x>,<y>,<z>\n"
+         << "   Move the surface by the given offset.  Without -t, several surfaces are\n"
+         << "   placed next to each other.\n"
+         << " -A <varchar>=<from>,<to>[,<keyframes>]\n"
+         << "   Define an auxiliary variable like -e which sweeps from one value to the\n"
+         << "   other and back.  The surface is evaluated for " << n_keyframes_def << " (or the given number\n"
+         << "   of) values in advance, and the GPU morphs between these keyframes, so\n"
+         << "   playing the sweep costs no evaluation at all.  Space pauses it.\n"
+         << " -d <triangles>\n"
+         << "   Simplify the surface to at most the given number of triangles, merging\n"
+         << "   vertices in flat regions first.\n"
+         << " -D <error>\n"
+         << "   Simplify the surface as far as possible without moving it by more than\n"
+         << "   error.  With -d, simplification stops at whichever limit comes first.\n"
+         << " -N\n"
+         << "   Start the definition of another surface.  All following options up to\n"
+         << "   the next -N (except -m, -W, -C, -S, -F, -T and --capture) apply to the\n"
+         << "   new surface, so that a scene of several surfaces can be compared side by\n"
+         << "   side.\n"
+         << " -m\n"
+         << "   Use faster approximations of sin, cos, tan, exp and pow, which are off\n"
+         << "   by a few units in the last place.\n"
+         << " -W\n"
+         << "   Turn grids into meshes with all duplicate vertices merged, which needs\n"
+         << "   memory for several copies of the whole grid.  By default they are\n"
+         << "   streamed into the vertex buffer row by row as they are evaluated, and\n"
+         << "   only their seams and poles are welded.  Surfaces simplified with -d or -D\n"
+         << "   are always turned into meshes.\n"
+         << " -C <size>\n"
+         << "   Limit the grid cache to size MiB, or disable it with 0.  The default is\n"
+         << "   " << grid_cache_size_def << " MiB.\n"
+         << " -S <path>\n"
+         << "   Don't show anything, but serve meshes to other processes over a Unix\n"
+         << "   domain socket at path (see the README).  -m and -C apply to the server.\n"
+         << " -F <fps>\n"
+         << "   Limit the frame rate while the view is moving.  When nothing moves, no\n"
+         << "   frames are drawn at all.  The default is no limit besides VSync.\n"
+         << " -T <ms>\n"
+         << "   Render at a lower resolution whenever frames would take longer than ms\n"
+         << "   milliseconds, and upscale to the screen.  The resolution adapts as the\n"
+         << "   load changes.  By default the full screen resolution is always used.\n"
+         << " --capture <path>\n"
+         << "   Record every drawn frame: as a YUV4MPEG2 video if path ends in \".y4m\",\n"
+         << "   otherwise as numbered PPM images in the directory path.  Frames are\n"
+         << "   written by background threads and dropped if they can't keep up.\n"
+         << "   While capturing, frames are drawn at the rate set with -F (60 by\n"
+         << "   default) even if nothing changes, so that the video plays in real time.\n"
          << "\nExamples:\n"
          << " Sphere:\n"
          << "   " << progname << " -e \"U=2*pi*u\" -e \"V=pi*v\" \\\n"
-         << "     -x \"cos(U) * sin(V)\" -z \"sin(U) * sin(V)\" -y \"cos(V)\"\n";
+         << "     -x \"cos(U) * sin(V)\" -z \"sin(U) * sin(V)\" -y \"cos(V)\"\n"
+         << " Two spheres, the second one finer and flattened:\n"
+         << "   " << progname << " -e \"U=2*pi*u\" -e \"V=pi*v\" \\\n"
+         << "     -x \"cos(U) * sin(V)\" -z \"sin(U) * sin(V)\" -y \"cos(V)\" -N -u128 -v128 \\\n"
+         << "     -e \"U=2*pi*u\" -e \"V=pi*v\" \\\n"
+         << "     -x \"cos(U) * sin(V)\" -z \"sin(U) * sin(V)\" -y \".5*cos(V)\"\n"
+         << " Implicit torus:\n"
+         << "   " << progname << " -f \"(x^2 + y^2 + z^2 + .75)^2 - 4*(x^2 + y^2)\"\n";
 }
 
-// Calculates u,v resolution and all the positions from cmd args and loads the graphics object with them.
-void gen_model(int argc, char **argv, Graphics& gfx);
+// Settings of one surface of the scene.
+struct SurfaceOptions
+{
+    SurfaceOptions() : res_u(res_u_def), res_v(res_v_def), has_offset(false), max_triangles(0), max_error(0),
+                       sweep_aux(-1), sweep_from(0), sweep_to(0), n_keyframes(0) {}
+
+    Surface surface;
+    ImplicitSurface implicit;  // used instead of surface if it has a formula
+    int res_u, res_v;
+    bool has_offset;
+    glm::vec3 offset;
+    size_t max_triangles;  // to decimate to, or 0
+    double max_error;  // allowed by decimation, or 0
+    int sweep_aux;  // index of the swept auxiliary variable, or -1
+    double sweep_from, sweep_to;
+    int n_keyframes;
+};
+
+struct Options
+{
+    Options() : surfaces(1), fast_math(false), weld(false), grid_cache_size(grid_cache_size_def), max_fps(0), target_frame_time(0) {}
+
+    std::vector<SurfaceOptions> surfaces;  // options apply to the last one
+    bool fast_math;
+    bool weld;  // turn all grids into welded meshes instead of streaming them
+    int grid_cache_size;  // in MiB
+    int max_fps;  // 0 means unlimited
+    double target_frame_time;  // in seconds, 0 disables resolution scaling
+    std::string socket_path;  // to serve meshes on instead of showing them, if set
+    std::string capture_path;  // to record frames to, if set
+};
+
+// Everything the main loop needs to keep track of between frames.
+struct LoopState
+{
+    LoopState() : quitting(false), dirty(true), sweep_paused(false), sweep_time(0) {}
+
+    bool quitting;
+    bool dirty;  // the scene changed and has to be redrawn
+    bool sweep_paused;
+    double sweep_time;  // seconds of sweeps played
+    std::set<std::string> changed_shaders;  // files in the shader directory
+};
+
+// Parses the command-line options into opts.
+void parse_options(int argc, char **argv, Options& opts);
+
+// Calculates all the surfaces and loads the graphics object with them.
+void gen_model(Options& opts, Graphics& gfx);
+
+// Serves meshes on opts.socket_path until SIGINT or SIGTERM (see MeshServer).
+// Returns the exit code.
+int run_server(const Options& opts);
+
+// Updates the loop state, camera and graphics settings from one SDL event.
+void handle_event(const SDL_Event& event, Graphics& gfx, CameraSimulation& cam_sim, LoopState& st);
+
+// Posts an event about a changed shader file to the main loop.  Is called
+// from the file watcher thread.
+void post_shader_changed(const std::string& filename)
+{
+    SDL_Event event;
+    event.type = SDL_USEREVENT;
+    event.user.code = EVENT_SHADER_CHANGED;
+    event.user.data1 = new string(filename);
+    event.user.data2 = NULL;
+    if(SDL_PushEvent(&event) != 0) delete static_cast<string*>(event.user.data1);
+}
+
+// Wakes the main loop up to draw the camera.  Is called from the camera
+// simulation thread.
+void post_camera_moved()
+{
+    SDL_Event event;
+    event.type = SDL_USEREVENT;
+    event.user.code = EVENT_CAMERA_MOVED;
+    event.user.data1 = event.user.data2 = NULL;
+    SDL_PushEvent(&event);
+}
+
+// Returns the current time of a monotonic clock in seconds.
+double get_time()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// Returns the CPU time (user and system) used by this process in seconds.
+double get_cpu_time()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+         + 1e-6 * (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+// Evaluates keyframes first, first+step, ... of a swept surface (see
+// eval_keyframes()) into vertices.
+static void eval_keyframe_range(const SurfaceOptions* so, int first, int step, glm::vec3* vertices)
+{
+    const size_t n_verts = size_t(so->res_u) * so->res_v;
+    for(int kf=first; kf<so->n_keyframes; kf+=step)
+    {
+        // Surface isn't thread-safe, so each thread works on a copy:
+        Surface surface = so->surface;
+        const double value = so->sweep_from + (so->sweep_to - so->sweep_from) * kf / (so->n_keyframes - 1);
+        surface.set_aux_value(so->sweep_aux, value);
+
+        GridArraySink grid(so->res_u, so->res_v);
+        stream_grid(surface, so->res_u, so->res_v, max(1, 16384 / so->res_u), grid);
+        copy(grid.get_vertices(), grid.get_vertices() + 3 * n_verts, vertices + 3 * n_verts * kf);
+    }
+}
+
+// Evaluates the grids of a swept surface for n_keyframes values of its swept
+// variable, on all cores.  Returns their vertex data one after the other, as
+// expected by SceneObject::vertices.
+static vector<glm::vec3> eval_keyframes(const SurfaceOptions& so)
+{
+    vector<glm::vec3> vertices(3 * size_t(so.res_u) * so.res_v * so.n_keyframes);
+    const int n_threads = min(so.n_keyframes, int(max(1u, std::thread::hardware_concurrency())));
+
+    vector<std::thread> threads;
+    for(int t=1; t<n_threads; ++t)
+        threads.push_back(std::thread(eval_keyframe_range, &so, t, n_threads, &vertices[0]));
+    eval_keyframe_range(&so, 0, n_threads, &vertices[0]);
+    for(size_t t=0; t<threads.size(); ++t) threads[t].join();
+
+    return vertices;
+}
+
+// Sleeps until the given time of the monotonic clock.
+void sleep_until(double t)
+{
+    timespec ts;
+    ts.tv_sec = static_cast<time_t>(t);
+    ts.tv_nsec = static_cast<long>((t - ts.tv_sec) * 1e9);
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
 
 int main(int argc, char **argv)
 {
+    Options opts;
+    parse_options(argc, argv, opts);
+
+    if(!opts.socket_path.empty()) return run_server(opts);
+
     bcm_host_init();
 
     // Initialize SDL:
@@ -64,161 +292,166 @@ int main(int argc, char **argv)
     try
     {
         Graphics gfx;
+        gfx.set_target_frame_time(opts.target_frame_time);
+
+        // Captures are drawn at a fixed frame rate, see below:
+        unique_ptr<FrameCapture> capture;
+        const int capture_fps = opts.max_fps > 0 ? opts.max_fps : 60;
+        if(!opts.capture_path.empty())
+        {
+            int w, h;
+            gfx.get_screen_size(w, h);
+            capture.reset(new FrameCapture(opts.capture_path, w, h, capture_fps));
+            gfx.set_capture(capture.get());
+        }
 
-        // Parse command-line options and generate model:
-        gen_model(argc, argv, gfx);
+        // Generate model:
+        gen_model(opts, gfx);
+
+        // Rebuild shader programs whenever their files change:
+        FileWatcher *shader_watcher = NULL;
+        try
+        {
+            shader_watcher = new FileWatcher("data/shaders", post_shader_changed);
+        }
+        catch(const SysException& e)
+        {
+            cerr << "WARNING: " << e.what() << ", shaders won't be reloaded automatically\n";
+        }
 
-        bool quitting = false;
+        LoopState st;
+        CameraSimulation cam_sim(gfx.get_camera(), post_camera_moved);
 
         const int framecount_interval = 100;
         int frames = 0;
-        Uint32 last_time = SDL_GetTicks();
-        float v_phi = 0, v_theta = 0, v_roll = 0, v_z = 0;
-        const float v_damp = 0.8;
-        while(!quitting)
+        double last_time = get_time();
+        double last_cpu_time = get_cpu_time();
+        const double start_time = last_time, start_cpu_time = last_cpu_time;
+
+        const double frame_interval = capture ? 1.0 / capture_fps : opts.max_fps > 0 ? 1.0 / opts.max_fps : 0;
+        double next_frame_time = last_time;
+        double sweep_clock = last_time;  // when st.sweep_time was last advanced
+
+        while(!st.quitting)
         {
-            gfx.render();
+            Camera camera;
+            if(cam_sim.take_camera(camera))
+            {
+                gfx.set_camera(camera);
+                st.dirty = true;
+            }
 
-            SDL_Event event;
-            while(SDL_PollEvent(&event))
+            // Sweeps go back and forth:
+            const bool sweeping = gfx.has_keyframes() && !st.sweep_paused;
+            if(sweeping)
             {
-                switch(event.type)
-                {
-                case SDL_MOUSEMOTION:
-                    // Keep mouse centered:
-                    {
-                        int w, h;
-                        gfx.get_screen_size(w, h);
-                        if(event.motion.x != w/2 || event.motion.y != h/2)
-                        {
-                            SDL_WarpMouse(w/2, h/2);
-                        }
-                        else break;
-                    }
+                const double now = get_time();
+                st.sweep_time += now - sweep_clock;
+                sweep_clock = now;
+                const double phase = fmod(st.sweep_time / sweep_duration, 2);
+                gfx.set_sweep_position(phase <= 1 ? phase : 2 - phase);
+                st.dirty = true;
+            }
+            else
+                sweep_clock = get_time();
 
-                    // Camera rotation:
-                    if(event.motion.state & SDL_BUTTON(1))
-                    {
-                        v_phi += 0.05 * event.motion.xrel;
-                        v_theta += 0.05 * event.motion.yrel;
-                    }
+            // A video needs a frame in every slot, also while nothing
+            // changes, or it would play too fast:
+            if(capture) st.dirty = true;
 
-                    if(event.motion.state & SDL_BUTTON(3))
-                    {
-                        v_roll += 0.05 * event.motion.xrel;
-                    }
+            if(st.dirty)
+            {
+                // Wait for the next frame slot if the frame rate is limited:
+                if(frame_interval > 0)
+                {
+                    const double now = get_time();
+                    if(next_frame_time > now) sleep_until(next_frame_time);
+                    // Don't try to catch up with frames missed by more than one interval:
+                    next_frame_time = max(next_frame_time, now - frame_interval) + frame_interval;
+                }
 
-                    // Camera movement:
-                    if(event.motion.state & SDL_BUTTON(2))
-                    {
-                        v_z += 0.002 * event.motion.yrel;
-                    }
-                    break;
+                gfx.render();
+                st.dirty = false;
 
-                case SDL_MOUSEBUTTONDOWN:
-                    if(event.button.button == SDL_BUTTON_WHEELDOWN)
+                // Count framerate:
+                if(++frames >= framecount_interval)
+                {
+                    const double this_time = get_time(), this_cpu_time = get_cpu_time();
+                    const double dt = this_time - last_time;
+                    const GLState::Stats gl_stats = gfx.take_gl_stats();
+                    cout << "* " << (frames / dt) << " FPS, "
+                         << (100.0 * (this_cpu_time - last_cpu_time) / dt) << "% CPU, "
+                         << (1.0 * gl_stats.issued / frames) << " GL state changes/frame ("
+                         << (1.0 * gl_stats.elided / frames) << " skipped), "
+                         << gfx.get_n_per_vertex() << " surface(s) lit per vertex";
+                    if(opts.target_frame_time > 0)
                     {
-                        v_z += 0.1;
+                        cout << ", render scale " << gfx.get_render_scale() << " ("
+                             << (1000 * gfx.get_frame_time()) << " ms/frame)";
                     }
-                    else if(event.button.button == SDL_BUTTON_WHEELUP)
+                    if(capture)
                     {
-                        v_z -= 0.1;
+                        const FrameCapture::Stats cap_stats = capture->take_stats();
+                        cout << ", " << cap_stats.n_written << " frames captured (" << cap_stats.n_dropped
+                             << " dropped, at most " << cap_stats.max_queued << " queued)";
                     }
-                    break;
+                    cout << "\n";
+                    frames = 0;
+                    last_time = this_time;
+                    last_cpu_time = this_cpu_time;
+                }
+            }
 
-                case SDL_KEYDOWN:
-                    switch(event.key.keysym.sym)
-                    {
-                    case SDLK_r:
-                        gfx.reload_data();
-                        break;
-
-                    case SDLK_F1:
-                        cout << "\nUsage:\n"
-                             << "  F1:               Display this help.\n"
-                             << "  F2:               Toggle VSync.\n"
-                             << "  F3:               Toggle backface culling.\n"
-                             << "  F4:               Toggle wireframe rendering.\n"
-                             << "  LMB / Arrow keys: Rotate camera.\n"
-                             << "  RMB:              Roll camera.\n"
-                             << "  MMB / Mouse wheel / Page keys:\n"
-                             << "                    Move camera.\n"
-                             << "\n";
-                        break;
-
-                    case SDLK_F2:
-                        {
-                            const bool new_vsync = !gfx.get_vsync();
-                            gfx.set_vsync(new_vsync);
-                            cout << "VSync turned " << (new_vsync ? "on" : "off") << ".\n";
-                        }
-                        break;
-
-                    case SDLK_F3:
-                        {
-                            const bool new_cull = !gfx.get_culling();
-                            gfx.set_culling(new_cull);
-                            cout << "Culling turned " << (new_cull ? "on" : "off") << ".\n";
-                        }
-                        break;
-
-                    case SDLK_F4:
-                        {
-                            const bool new_wire = !gfx.get_wire_mode();
-                            gfx.set_wire_mode(new_wire);
-                            cout << "Wireframe turned " << (new_wire ? "on" : "off") << ".\n";
-                        }
-                        break;
-
-                    case SDLK_ESCAPE:
-                        quitting = true;
-                        break;
-
-                    default:
-                        break;
-                    }
-                    break;
+            SDL_Event event;
 
-                case SDL_QUIT:
-                    quitting = true;
-                    break;
+            // Sleep until the next event arrives (the camera simulation
+            // sends one when the camera moved), unless a sweep is playing or
+            // frames are captured:
+            if(!sweeping && !capture)
+            {
+                if(!SDL_WaitEvent(&event)) throw SDLException("SDL_WaitEvent");
+                handle_event(event, gfx, cam_sim, st);
+            }
 
-                default:
-                    break;
-                }
+            while(SDL_PollEvent(&event))
+            {
+                handle_event(event, gfx, cam_sim, st);
             }
 
-            const Uint8 *keystate = SDL_GetKeyState(NULL);
-            // Handle camera keys:
-            if(keystate[SDLK_RIGHT])    v_phi   += 0.5;
-            if(keystate[SDLK_LEFT])     v_phi   -= 0.5;
-            if(keystate[SDLK_DOWN])     v_theta += 0.5;
-            if(keystate[SDLK_UP])       v_theta -= 0.5;
-            if(keystate[SDLK_PAGEDOWN]) v_z     += 0.02;
-            if(keystate[SDLK_PAGEUP])   v_z     -= 0.02;
-
-            // Apply camera movements:
-            gfx.rotate_cam(v_phi, v_theta, v_roll);
-            gfx.move_cam(v_z);
-
-            // Dampen movements:
-            v_phi *= v_damp;
-            v_theta *= v_damp;
-            v_roll *= v_damp;
-            v_z *= v_damp;
-
-            //SDL_Delay(50);
-
-            // Count framerate:
-            if(++frames >= framecount_interval)
+            // Rebuild the programs of changed shaders, once per program:
+            for(set<string>::const_iterator it = st.changed_shaders.begin(); it != st.changed_shaders.end(); ++it)
             {
-                const Uint32 this_time = SDL_GetTicks();
-                const Uint32 dt = this_time - last_time;
-                cout << "* " << (1000.0 * frames / dt) << " FPS\n";
-                frames = 0;
-                last_time = this_time;
+                if(gfx.reload_shader(*it)) st.dirty = true;
             }
+            st.changed_shaders.clear();
+
+            // Pass the camera keys on to the simulation, which moves the
+            // camera while they are held down:
+            const Uint8 *keystate = SDL_GetKeyState(NULL);
+            unsigned keys = 0;
+            if(keystate[SDLK_RIGHT])    keys |= CAM_KEY_RIGHT;
+            if(keystate[SDLK_LEFT])     keys |= CAM_KEY_LEFT;
+            if(keystate[SDLK_DOWN])     keys |= CAM_KEY_DOWN;
+            if(keystate[SDLK_UP])       keys |= CAM_KEY_UP;
+            if(keystate[SDLK_PAGEDOWN]) keys |= CAM_KEY_BACK;
+            if(keystate[SDLK_PAGEUP])   keys |= CAM_KEY_FORWARD;
+            cam_sim.set_keys(keys);
         }
+
+        delete shader_watcher;
+
+        if(capture)
+        {
+            // Wait for the queued frames:
+            cout << "Writing captured frames to \"" << opts.capture_path << "\"...\n";
+            const unsigned long n_frames = capture->get_n_frames();
+            capture.reset();
+            cout << n_frames << " frames captured.\n";
+        }
+
+        const double dt = get_time() - start_time;
+        cout << "Average CPU usage: " << (100.0 * (get_cpu_time() - start_cpu_time) / dt)
+             << "% over " << dt << " s\n";
     }
     catch(const exception& e)
     {
@@ -231,35 +464,170 @@ int main(int argc, char **argv)
     return 0;
 }
 
-
-void gen_model(int argc, char **argv, Graphics& gfx)
+void handle_event(const SDL_Event& event, Graphics& gfx, CameraSimulation& cam_sim, LoopState& st)
 {
-    int opt;
-    extern char *optarg;
+    switch(event.type)
+    {
+    case SDL_MOUSEMOTION:
+        // Keep mouse centered:
+        {
+            int w, h;
+            gfx.get_screen_size(w, h);
+            if(event.motion.x != w/2 || event.motion.y != h/2)
+            {
+                SDL_WarpMouse(w/2, h/2);
+            }
+            else break;
+        }
+
+        // Camera rotation (in degrees per second):
+        if(event.motion.state & SDL_BUTTON(1))
+        {
+            cam_sim.push(3 * event.motion.xrel, 3 * event.motion.yrel, 0, 0);
+        }
+
+        if(event.motion.state & SDL_BUTTON(3))
+        {
+            cam_sim.push(0, 0, 3 * event.motion.xrel, 0);
+        }
+
+        // Camera movement:
+        if(event.motion.state & SDL_BUTTON(2))
+        {
+            cam_sim.push(0, 0, 0, .12 * event.motion.yrel);
+        }
+        break;
+
+    case SDL_MOUSEBUTTONDOWN:
+        if(event.button.button == SDL_BUTTON_WHEELDOWN)
+        {
+            cam_sim.push(0, 0, 0, 6);
+        }
+        else if(event.button.button == SDL_BUTTON_WHEELUP)
+        {
+            cam_sim.push(0, 0, 0, -6);
+        }
+        break;
+
+    case SDL_KEYDOWN:
+        switch(event.key.keysym.sym)
+        {
+        case SDLK_r:
+            gfx.reload_data();
+            st.dirty = true;
+            break;
+
+        case SDLK_F1:
+            cout << "\nUsage:\n"
+                 << "  F1:               Display this help.\n"
+                 << "  F2:               Toggle VSync.\n"
+                 << "  F3:               Toggle backface culling.\n"
+                 << "  F4:               Toggle wireframe rendering.\n"
+                 << "  F5:               Cycle lighting between automatic, per fragment and\n"
+                 << "                    per vertex.\n"
+                 << "  Space:            Pause or resume sweeps (see -A).\n"
+                 << "  LMB / Arrow keys: Rotate camera.\n"
+                 << "  RMB:              Roll camera.\n"
+                 << "  MMB / Mouse wheel / Page keys:\n"
+                 << "                    Move camera.\n"
+                 << "\n";
+            break;
+
+        case SDLK_F2:
+            {
+                const bool new_vsync = !gfx.get_vsync();
+                gfx.set_vsync(new_vsync);
+                cout << "VSync turned " << (new_vsync ? "on" : "off") << ".\n";
+            }
+            break;
+
+        case SDLK_F3:
+            {
+                const bool new_cull = !gfx.get_culling();
+                gfx.set_culling(new_cull);
+                cout << "Culling turned " << (new_cull ? "on" : "off") << ".\n";
+                st.dirty = true;
+            }
+            break;
+
+        case SDLK_F4:
+            {
+                const bool new_wire = !gfx.get_wire_mode();
+                gfx.set_wire_mode(new_wire);
+                cout << "Wireframe turned " << (new_wire ? "on" : "off") << ".\n";
+                st.dirty = true;
+            }
+            break;
+
+        case SDLK_F5:
+            {
+                static const char *names[] = { "automatic", "per fragment", "per vertex" };
+                const LightingMode new_mode = LightingMode((gfx.get_lighting_mode() + 1) % 3);
+                gfx.set_lighting_mode(new_mode);
+                cout << "Lighting set to " << names[new_mode] << ".\n";
+                st.dirty = true;
+            }
+            break;
 
-    Evaluator::varlist_t varlist;
-    varlist.push_back("u");
-    varlist.push_back("v");
-    vector<double> vars(2);
+        case SDLK_SPACE:
+            st.sweep_paused = !st.sweep_paused;
+            st.dirty = true;
+            break;
 
-    Evaluator::constmap_t constmap;
-    constmap["pi"] = M_PI;
-    constmap["e"] = M_E;
+        case SDLK_ESCAPE:
+            st.quitting = true;
+            break;
 
-    vector<Evaluator> extra_etors;
-    string x_str("2*u-1"), y_str("0"), z_str("2*v-1");
-    string r_str("1"), g_str("1"), b_str("1");
+        default:
+            break;
+        }
+        break;
 
-    int res_u = res_u_def;
-    int res_v = res_u_def;
+    case SDL_USEREVENT:
+        if(event.user.code == EVENT_SHADER_CHANGED)
+        {
+            string *filename = static_cast<string*>(event.user.data1);
+            st.changed_shaders.insert(*filename);
+            delete filename;
+        }
+        // EVENT_CAMERA_MOVED only wakes the main loop up, which takes the
+        // camera itself.
+        break;
 
-    glm::vec3 *positions = NULL;
-    glm::vec3 *colors    = NULL;
+    case SDL_ACTIVEEVENT:
+    case SDL_VIDEOEXPOSE:
+        st.dirty = true;
+        break;
+
+    case SDL_QUIT:
+        st.quitting = true;
+        break;
+
+    default:
+        break;
+    }
+}
+
+
+void parse_options(int argc, char **argv, Options& opts)
+{
+    int opt;
+    extern char *optarg;
+
+    // Options without a short form:
+    enum { OPT_CAPTURE = 256 };
+    static const option long_options[] =
+    {
+        { "capture", required_argument, NULL, OPT_CAPTURE },
+        { NULL, 0, NULL, 0 }
+    };
 
     try 
     {
-        while((opt = getopt(argc, argv, "he:u:v:x:y:z:r:g:b:")) != -1)
+        while((opt = getopt_long(argc, argv, "he:u:v:x:y:z:r:g:b:f:t:d:D:NmWC:S:F:T:A:", long_options, NULL)) != -1)
         {
+            SurfaceOptions& cur = opts.surfaces.back();
+
             switch(opt)
             {
             case 'h':
@@ -268,102 +636,379 @@ void gen_model(int argc, char **argv, Graphics& gfx)
                 break;
 
             case 'e':
-                {
-                    assert(strlen(optarg) >= 3);
-                    string varname;
-                    varname += optarg[0];
-                    varlist.push_back(varname);
-                    extra_etors.push_back(Evaluator(optarg + 2, varlist, constmap));
-                    vars.push_back(0.0);
-                }
+                cur.surface.add_aux(optarg);
                 break;
 
             case 'u':
-                res_u = atoi(optarg);
+                cur.res_u = atoi(optarg);
                 break;
 
             case 'v':
-                res_v = atoi(optarg);
+                cur.res_v = atoi(optarg);
                 break;
 
-            case 'x':
-                x_str = optarg;
+            case 'x': case 'y': case 'z':
+            case 'r': case 'g': case 'b':
+                cur.surface.set_formula(opt, optarg);
                 break;
 
-            case 'y':
-                y_str = optarg;
+            case 'f':
+                cur.implicit.set_formula(optarg);
                 break;
 
-            case 'z':
-                z_str = optarg;
+            case 't':
+                if(sscanf(optarg, "%f,%f,%f", &cur.offset.x, &cur.offset.y, &cur.offset.z) != 3)
+                    throw string("offset must be of the form <x>,<y>,<z>");
+                cur.has_offset = true;
                 break;
 
-            case 'r':
-                r_str = optarg;
+            case 'A':
+                {
+                    char var;
+                    double from, to;
+                    int n_keyframes = n_keyframes_def;
+                    if(sscanf(optarg, "%c=%lf,%lf,%d", &var, &from, &to, &n_keyframes) < 3 || n_keyframes < 2)
+                        throw string("sweep must be of the form <varchar>=<from>,<to>[,<keyframes>] with at least 2 keyframes");
+                    cur.sweep_aux = cur.surface.get_n_aux();
+                    cur.sweep_from = from;
+                    cur.sweep_to = to;
+                    cur.n_keyframes = n_keyframes;
+                    cur.surface.add_aux(string(1, var) + "=0");
+                    cur.surface.set_aux_value(cur.sweep_aux, from);
+                }
+                break;
+
+            case 'd':
+                cur.max_triangles = max(atoi(optarg), 0);
                 break;
 
-            case 'g':
-                g_str = optarg;
+            case 'D':
+                cur.max_error = atof(optarg);
                 break;
 
-            case 'b':
-                b_str = optarg;
+            case 'N':
+                opts.surfaces.push_back(SurfaceOptions());
+                break;
+
+            case 'm':
+                opts.fast_math = true;
+                break;
+
+            case 'W':
+                opts.weld = true;
+                break;
+
+            case 'C':
+                opts.grid_cache_size = atoi(optarg);
+                break;
+
+            case 'S':
+                opts.socket_path = optarg;
+                break;
+
+            case 'F':
+                opts.max_fps = atoi(optarg);
+                break;
+
+            case 'T':
+                opts.target_frame_time = max(atof(optarg), 0.0) / 1000;
+                break;
+
+            case OPT_CAPTURE:
+                opts.capture_path = optarg;
                 break;
             }
         }
 
-        assert(res_u > 1 && res_v > 1 && res_u * res_v <= 256 * 256);
-
-        // Position evaluators:
-        Evaluator x_eval(x_str, varlist, constmap),
-                  y_eval(y_str, varlist, constmap),
-                  z_eval(z_str, varlist, constmap);
-        // Color evaluators:
-        Evaluator r_eval(r_str, varlist, constmap),
-                  g_eval(g_str, varlist, constmap),
-                  b_eval(b_str, varlist, constmap);
-
-        // Calculate vertex positions and colors:
-        positions = new glm::vec3[(res_u + 2) * (res_v + 2)];
-        colors    = new glm::vec3[res_u * res_v];
-        for(int j=-1; j<res_v+1; ++j)
+        for(size_t k=0; k<opts.surfaces.size(); ++k)
         {
-            vars[1] = 1.0 * j / (res_v - 1);  // v
-            for(int i=-1; i<res_u+1; ++i)
+            SurfaceOptions& so = opts.surfaces[k];
+            // Grids are drawn with 16 bit indices, and the product may overflow an int:
+            if(so.implicit.has_formula())
             {
-                vars[0] = 1.0 * i / (res_u - 1);  // u
+                if(so.res_u <= 1 || so.res_u > 1024)
+                    throw string("resolution of implicit surfaces must be from 2 to 1024");
+            }
+            else if(so.res_u <= 1 || so.res_v <= 1 || int64_t(so.res_u) * so.res_v > 256 * 256)
+                throw string("resolution must be at least 2 in u and v, with at most 65536 vertices");
 
-                // Calculate auxiliary variables:
-                for(size_t k=0; k<extra_etors.size(); ++k)
-                {
-                    vars[2 + k] = extra_etors[k].evaluate(vars);
-                }
+            so.surface.compile();
+            so.surface.set_fast_math(opts.fast_math);
+            so.implicit.set_fast_math(opts.fast_math);
+        }
+    }
+    catch(const string& e)
+    {
+        cout << "PARSE ERROR: " << e << "\n";
+        exit(1);
+    }
+}
 
-                const int pos_idx = (i+1) + (res_u+2) * (j+1);
+void gen_model(Options& opts, Graphics& gfx)
+{
+    const size_t n_surfaces = opts.surfaces.size();
+
+    // Place surfaces without an offset next to each other along the x axis:
+    bool any_offset = false;
+    for(size_t k=0; k<n_surfaces; ++k) any_offset |= opts.surfaces[k].has_offset;
+
+    GridCache grid_cache;
+    grid_cache.init(size_t(max(opts.grid_cache_size, 0)) << 20);
+
+    vector<Mesh> meshes(n_surfaces);
+    vector<SceneObject> objects(n_surfaces);
+    vector<MappedGrid> cached_grids(n_surfaces);
+    vector<GridCacheWriter> cache_writers(n_surfaces);
+    vector<vector<glm::vec3> > keyframes(n_surfaces);
+    // The first surface that keeps backface culling from being enabled, and why:
+    size_t not_closed = n_surfaces;
+    const char *problem = NULL;
+    for(size_t k=0; k<n_surfaces; ++k)
+    {
+        SurfaceOptions& so = opts.surfaces[k];
+        SceneObject& obj = objects[k];
 
-                // Evaluate position:
-                positions[pos_idx] = glm::vec3(x_eval.evaluate(vars),
-                                               y_eval.evaluate(vars),
-                                               z_eval.evaluate(vars));
+        const float spacing = 2.5;
+        const glm::vec3 offset = any_offset ? so.offset : glm::vec3(spacing * (k - .5f * (n_surfaces - 1)), 0, 0);
+        obj.transform = glm::translate(glm::mat4(1), offset);
 
-                // Evaluate colors:
-                if(i >= 0 && i < res_u && j >= 0 && j < res_v)
-                {
-                    colors[i + res_u * j] = glm::vec3(r_eval.evaluate(vars),
-                                                      g_eval.evaluate(vars),
-                                                      b_eval.evaluate(vars));
-                }
+        if(so.sweep_aux >= 0 && so.implicit.has_formula())
+            cerr << "WARNING: Implicit surfaces can't be swept.\n";
+
+        // Report the evaluations of auxiliary variables that are skipped:
+        const AuxStats aux = so.surface.get_aux_stats();
+        if(!so.implicit.has_formula() && (aux.n_unused > 0 || aux.n_color_only > 0))
+        {
+            const double n_points = (so.res_u + 2.0) * (so.res_v + 2.0);
+            const double n_saved = aux.n_unused * n_points + aux.n_color_only * (n_points - so.res_u * so.res_v);
+
+            cout << "Surface";
+            if(n_surfaces > 1) cout << ' ' << (k + 1);
+            cout << ": " << aux.n_unused << " of " << aux.n_aux << " auxiliary variable(s) unused, "
+                 << aux.n_color_only << " only needed for colors; " << 100 * n_saved / (aux.n_aux * n_points)
+                 << "% of their evaluations skipped.\n";
+        }
+
+        if(so.sweep_aux >= 0 && !so.implicit.has_formula())
+        {
+            // The keyframes must keep their vertices in the same places, so
+            // they are drawn as streamed grids are:
+            if(so.max_triangles > 0 || so.max_error > 0)
+                cerr << "WARNING: Swept surfaces can't be decimated.\n";
+
+            const double t0 = get_time();
+            keyframes[k] = eval_keyframes(so);
+            const double t1 = get_time();
+            obj.res_u = so.res_u;
+            obj.res_v = so.res_v;
+            obj.vertices = &keyframes[k][0];
+            obj.n_keyframes = so.n_keyframes;
+            obj.weld_tolerance = weld_tolerance;
+
+            cout << "Surface";
+            if(n_surfaces > 1) cout << ' ' << (k + 1);
+            cout << ": " << so.n_keyframes << " keyframes evaluated in " << 1e3 * (t1 - t0) << " ms.\n";
+            continue;
+        }
+
+        if(!so.implicit.has_formula())
+        {
+            // Use the cached grid if there is one, or cache it while it is evaluated:
+            const string key = grid_cache.get_key(so.surface.get_definition(), so.res_u, so.res_v);
+            const bool cached = grid_cache.load(key, so.res_u, so.res_v, cached_grids[k]);
+            if(!cached) grid_cache.begin_store(key, so.res_u, so.res_v, cache_writers[k]);
+            VertexSink *copy_sink = cache_writers[k].is_open() ? &cache_writers[k] : NULL;
+
+            // Stream the grid row by row, unless it must be a mesh:
+            if(!opts.weld && so.max_triangles == 0 && so.max_error == 0)
+            {
+                obj.grid = &so.surface;
+                obj.res_u = so.res_u;
+                obj.res_v = so.res_v;
+                if(cached) obj.vertices = cached_grids[k].get_vertices();
+                obj.copy_sink = copy_sink;
+                obj.weld_tolerance = weld_tolerance;
+                continue;
             }
+
+            // Turn the grid into a mesh without duplicate vertices along its
+            // seams and at its poles:
+            const double t0 = get_time();
+            if(cached)
+                append_grid(cached_grids[k].get_vertices(), so.res_u, so.res_v, meshes[k]);
+            else
+            {
+                GridArraySink grid(so.res_u, so.res_v, copy_sink);
+                stream_grid(so.surface, so.res_u, so.res_v, max(1, 16384 / so.res_u), grid);
+                append_grid(grid.get_vertices(), so.res_u, so.res_v, meshes[k]);
+            }
+            const WeldStats stats = weld_vertices(meshes[k], weld_tolerance);
+            const double t1 = get_time();
+            obj.mesh = &meshes[k];
+
+            cout << "Surface";
+            if(n_surfaces > 1) cout << ' ' << (k + 1);
+            cout << ": welded " << stats.n_vertices_before << " to " << stats.n_vertices_after << " vertices ("
+                 << 100.0 * (stats.n_vertices_before - stats.n_vertices_after) / stats.n_vertices_before
+                 << "% fewer) in " << 1e3 * (t1 - t0) << " ms, " << (stats.n_triangles_before - stats.n_triangles_after)
+                 << " collapsed triangles removed, " << stats.n_recalculated << " normals recalculated.\n";
+            if(stats.n_null > 0)
+                cerr << "WARNING: " << stats.n_null << " null normal(s) in surface " << (k + 1) << "\n";
+        }
+        else
+        {
+            // Polygonize with at least res_u cells along each axis:
+            int depth = 1;
+            while((1 << depth) < so.res_u) ++ depth;
+
+            const double t0 = get_time();
+            const ImplicitStats stats = so.implicit.polygonize(depth, implicit_size, meshes[k]);
+            const double t1 = get_time();
+            obj.mesh = &meshes[k];
+
+            const long n_cells = 1L << 3 * depth;
+            cout << "Implicit surface";
+            if(n_surfaces > 1) cout << ' ' << (k + 1);
+            cout << ": " << meshes[k].n_triangles() << " triangles in " << 1e3 * (t1 - t0) << " ms; "
+                 << stats.n_cells << " of " << n_cells << " cells sampled, " << stats.n_pruned << " of "
+                 << stats.n_nodes << " octree nodes pruned, " << stats.n_samples << " samples.\n";
+
+            // Implicit meshes still have duplicate vertices where the
+            // polygonizer's tasks meet, which would keep them from being
+            // simplified or found closed:
+            weld_vertices(meshes[k], weld_tolerance);
+        }
+
+        // Triangles without area (as where welding moved vertices together)
+        // or with vertices where the formulas aren't finite would only cost
+        // time and show garbage:
+        const size_t n_bad = remove_bad_triangles(meshes[k]);
+        if(n_bad > 0)
+        {
+            cout << "Surface";
+            if(n_surfaces > 1) cout << ' ' << (k + 1);
+            cout << ": " << n_bad << " degenerate or non-finite triangle(s) removed.\n";
+        }
+
+        if(so.max_triangles > 0 || so.max_error > 0)
+        {
+            const double t0 = get_time();
+            const DecimateStats stats = decimate_mesh(meshes[k], so.max_triangles,
+                                                      so.max_error > 0 ? so.max_error : HUGE_VAL);
+            const double t1 = get_time();
+
+            cout << "Surface";
+            if(n_surfaces > 1) cout << ' ' << (k + 1);
+            cout << ": decimated " << stats.n_triangles_before << " to " << stats.n_triangles_after
+                 << " triangles in " << 1e3 * (t1 - t0) << " ms, max deviation " << stats.max_deviation << ".\n";
+        }
+
+        // Check whether backface culling would be safe, and turn inside-out
+        // surfaces around for it:
+        const double t0 = get_time();
+        const TopologyStats topo = orient_mesh(meshes[k]);
+        const double t1 = get_time();
+        if(!topo.is_closed() && not_closed == n_surfaces)
+        {
+            not_closed = k;
+            problem = "is not closed";
+        }
+
+        cout << "Surface";
+        if(n_surfaces > 1) cout << ' ' << (k + 1);
+        if(topo.is_closed())
+        {
+            cout << ": closed (" << topo.n_components << " component(s)";
+            if(topo.n_flipped > 0) cout << ", " << topo.n_flipped << " turned around as they were inside out";
+            cout << ")";
+        }
+        else
+        {
+            cout << ": not closed (" << topo.n_boundary_edges << " boundary, " << topo.n_nonmanifold_edges
+                 << " non-manifold and " << topo.n_inconsistent_edges << " inconsistently oriented edges)";
+        }
+        cout << ", checked in " << 1e3 * (t1 - t0) << " ms.\n";
+    }
+
+    const double t0 = get_time();
+    gfx.load_scene(objects);
+    const double t1 = get_time();
+
+    // Backface culling halves the fragments to shade, but would show holes
+    // in open surfaces and hide faces of inconsistently oriented ones.  Grids
+    // are checked while they are loaded:
+    for(size_t k=0; k<not_closed; ++k)
+    {
+        if(!objects[k].mesh && !gfx.get_grid_topology(k).is_closed())
+        {
+            not_closed = k;
+            problem = gfx.get_grid_topology(k).get_problem();
+        }
+    }
+    gfx.set_culling(not_closed == n_surfaces);
+    if(not_closed == n_surfaces)
+        cout << "Backface culling enabled, as all surfaces are closed";
+    else
+    {
+        cout << "Backface culling disabled, as surface";
+        if(n_surfaces > 1) cout << ' ' << (not_closed + 1);
+        cout << ' ' << problem;
+    }
+    cout << " (toggle with F3).\n";
+
+    if(grid_cache.is_enabled())
+    {
+        size_t n_grids = 0, n_hits = 0;
+        for(size_t k=0; k<n_surfaces; ++k)
+        {
+            if(!opts.surfaces[k].implicit.has_formula()) ++ n_grids;
+            if(cached_grids[k].is_mapped()) ++ n_hits;
+            cache_writers[k].commit();
+        }
+        grid_cache.evict();
+
+        if(n_grids > 0)
+        {
+            cout << "Grid cache: " << n_hits << " of " << n_grids << " grid(s) loaded from the cache, scene loaded in "
+                 << 1e3 * (t1 - t0) << " ms.\n";
         }
     }
+}
+
+static MeshServer *running_server = NULL;
+
+static void stop_server(int)
+{
+    if(running_server) running_server->stop();
+}
+
+int run_server(const Options& opts)
+{
+    ServerSettings settings;
+    settings.fast_math = opts.fast_math;
+    settings.mesh_cache_size = size_t(max(opts.grid_cache_size, 0)) << 20;
+    settings.weld_tolerance = weld_tolerance;
+    settings.implicit_size = implicit_size;
+    settings.stats_interval = 10;
+
+    MeshServer server(settings);
+    try
+    {
+        server.listen(opts.socket_path);
+    }
     catch(const string& e)
     {
-        cout << "PARSE ERROR: " << e << "\n";
-        exit(1);
+        cerr << "ERROR: " << e << "\n";
+        return 1;
     }
 
-    gfx.load_model(positions, colors, res_u, res_v);
+    running_server = &server;
+    signal(SIGINT, stop_server);
+    signal(SIGTERM, stop_server);
+
+    cout << "Serving meshes on \"" << opts.socket_path << "\".\n";
+    server.run();
 
-    delete[] positions;
-    delete[] colors;
+    running_server = NULL;
+    return 0;
 }
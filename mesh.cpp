@@ -0,0 +1,896 @@
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "mesh.hpp"
+using namespace std;
+using namespace glm;
+
+static const float tol = 1e-15;
+
+// The normal at a vertex is approximated with its 4 neighboring vertices.
+// The normal is the cross product between the relative vectors:
+//
+//  .   .   .   .   .
+//  .   .  v_n  .   .
+//  .  v_w (*) v_e  .  ==> normal at (*): (v_e - v_w) x (v_n - v_s)
+//  .   .  v_s  .   .
+//  .   .   .   .   .
+//
+// If vertices on the grid fall together to make triangles (like at
+// the caps of a simple sphere), one of these relative vectors can
+// be zero which is bad.
+// If this occurs, these vertices have to be avoided, for example
+// like this:
+//
+//  .   .   .   .   .
+//  .   .  v_n  .   .
+//         (*)         <-- here a row of vertices is in one point
+//  .  v_w v_s v_e  .
+//  .   .   .   .   .
+//
+// Rows are processed in two passes: a branch-free pass over structure-of-arrays
+// copies of the three rows involved, which the compiler can vectorize, and a
+// slow pass which does the corrections above for the vertices flagged by the
+// first one.
+
+// Calculates the normal of vertex i of row j the slow way, with corrections
+// for degenerate neighbors.  above, row and below point to the sentinel vertex
+// at the start of rows j-1, j and j+1.  Returns false if it gave up.
+static bool calc_normal_slow(const vec3* above, const vec3* row, const vec3* below,
+                             int i, int j, int res_u, int res_v, vec3& norm)
+{
+    const int k = i + 1;
+
+    vec3 v_w = row[k - 1];
+    vec3 v_e = row[k + 1];
+    vec3 v_s = below[k];
+    vec3 v_n = above[k];
+
+    // Watch out for the "triangles":
+    if(length(v_e - v_w) < tol)
+    {
+        v_w = above[k - 1];
+        v_e = above[k + 1];
+
+        if(j == 0) swap(v_w, v_e);  // this is a very hacky fix for simple spheres
+
+        if(length(v_e - v_w) < tol)
+        {
+            v_w = below[k - 1];
+            v_e = below[k + 1];
+
+            if(j == res_v - 1) swap(v_w, v_e);  // as above
+        }
+    }
+
+    if(length(v_n - v_s) < tol)
+    {
+        v_s = below[k - 1];
+        v_n = above[k - 1];
+
+        if(i == 0) swap(v_s, v_n);
+
+        if(length(v_n - v_s) < tol)
+        {
+            v_s = below[k + 1];
+            v_n = above[k + 1];
+
+            if(i == res_u - 1) swap(v_s, v_n);
+        }
+    }
+
+    // Do the cross product:
+    norm = cross(v_e - v_w, v_n - v_s);
+    const float norm_len = length(norm);
+
+    if(norm_len < tol)
+    {
+        // Just give up at this point:
+        norm = vec3(0, 0, 0);
+        return false;
+    }
+
+    // Normal-ize!
+    norm /= norm_len;
+    return true;
+}
+
+// Copies n vertices into separate x, y and z arrays.
+static void to_soa(const vec3* src, int n, float* x, float* y, float* z)
+{
+    for(int k=0; k<n; ++k)
+    {
+        x[k] = src[k].x;
+        y[k] = src[k].y;
+        z[k] = src[k].z;
+    }
+}
+
+// The fast pass: calculates the normals of a row from structure-of-arrays
+// rows (including sentinels) without any corrections, and flags the vertices
+// which need them.
+static void calc_normals_soa(const float* __restrict ax, const float* __restrict ay, const float* __restrict az,
+                             const float* __restrict rx, const float* __restrict ry, const float* __restrict rz,
+                             const float* __restrict bx, const float* __restrict by, const float* __restrict bz,
+                             int res_u, float* __restrict nx, float* __restrict ny, float* __restrict nz,
+                             unsigned char* __restrict slow)
+{
+    const float tol2 = tol * tol;
+
+    for(int i=0; i<res_u; ++i)
+    {
+        // v_e - v_w:
+        const float ewx = rx[i + 2] - rx[i];
+        const float ewy = ry[i + 2] - ry[i];
+        const float ewz = rz[i + 2] - rz[i];
+
+        // v_n - v_s:
+        const float nsx = ax[i + 1] - bx[i + 1];
+        const float nsy = ay[i + 1] - by[i + 1];
+        const float nsz = az[i + 1] - bz[i + 1];
+
+        const float cx = ewy * nsz - ewz * nsy;
+        const float cy = ewz * nsx - ewx * nsz;
+        const float cz = ewx * nsy - ewy * nsx;
+
+        const float ew2 = ewx * ewx + ewy * ewy + ewz * ewz;
+        const float ns2 = nsx * nsx + nsy * nsy + nsz * nsz;
+        const float c2 = cx * cx + cy * cy + cz * cz;
+
+        // Garbage if c2 is 0, but then the vertex is flagged anyway:
+        const float inv_len = 1.f / sqrtf(c2);
+        nx[i] = cx * inv_len;
+        ny[i] = cy * inv_len;
+        nz[i] = cz * inv_len;
+
+        slow[i] = (ew2 < tol2) | (ns2 < tol2) | (c2 < tol2);
+    }
+}
+
+void NormalStats::merge(const NormalStats& other)
+{
+    if(other.n_null > 0 && (n_null == 0 || other.first_null_j < first_null_j
+                            || (other.first_null_j == first_null_j && other.first_null_i < first_null_i)))
+    {
+        first_null_i = other.first_null_i;
+        first_null_j = other.first_null_j;
+    }
+    n_null += other.n_null;
+}
+
+void calc_normal_row(const glm::vec3* above, const glm::vec3* row, const glm::vec3* below,
+                     int res_u, int res_v, int j, glm::vec3* normals,
+                     NormalScratch& scratch, NormalStats& stats)
+{
+    const int n = res_u + 2;
+    if(scratch.soa.size() != size_t(12 * n))
+    {
+        scratch.soa.resize(12 * n);
+        scratch.slow.resize(res_u);
+        for(int k=0; k<3; ++k) scratch.rows[k] = -2;
+    }
+
+    // Convert the rows, unless they are still there from the previous rows:
+    float *soa_rows[3];
+    const vec3 *src_rows[3] = { above, row, below };
+    for(int k=0; k<3; ++k)
+    {
+        const int slot = (j + k) % 3;
+        soa_rows[k] = &scratch.soa[3 * n * slot];
+        if(scratch.rows[slot] != j - 1 + k)
+        {
+            to_soa(src_rows[k], n, soa_rows[k], soa_rows[k] + n, soa_rows[k] + 2 * n);
+            scratch.rows[slot] = j - 1 + k;
+        }
+    }
+
+    const float *a = soa_rows[0], *r = soa_rows[1], *b = soa_rows[2];
+    float *norm = &scratch.soa[9 * n];
+    unsigned char *slow = &scratch.slow[0];
+    calc_normals_soa(a, a + n, a + 2 * n, r, r + n, r + 2 * n, b, b + n, b + 2 * n,
+                     res_u, norm, norm + n, norm + 2 * n, slow);
+
+    for(int i=0; i<res_u; ++i)
+    {
+        if(!slow[i])
+        {
+            normals[i] = vec3(norm[i], norm[n + i], norm[2 * n + i]);
+        }
+        else if(!calc_normal_slow(above, row, below, i, j, res_u, res_v, normals[i]))
+        {
+            NormalStats null_stats;
+            null_stats.n_null = 1;
+            null_stats.first_null_i = i;
+            null_stats.first_null_j = j;
+            stats.merge(null_stats);
+        }
+    }
+}
+
+// Calculates the normals of rows j0 to j1-1.
+static void calc_normal_rows(const vec3* positions, int res_u, int res_v, int j0, int j1,
+                             vec3* normals, NormalStats* stats)
+{
+    const int stride = res_u + 2;
+    NormalScratch scratch;
+    for(int j=j0; j<j1; ++j)
+    {
+        const vec3 *row = positions + stride * (j + 1);
+        calc_normal_row(row - stride, row, row + stride, res_u, res_v, j, normals + res_u * j, scratch, *stats);
+    }
+}
+
+NormalStats calc_normals(const glm::vec3* positions, int res_u, int res_v, glm::vec3* normals, int n_threads)
+{
+    // Threads only pay off with enough work for each of them:
+    const int min_verts_per_thread = 16384;
+    if(n_threads <= 0) n_threads = max(1u, std::thread::hardware_concurrency());
+    n_threads = max(1, min(n_threads, min(res_v, res_u * res_v / min_verts_per_thread)));
+
+    vector<NormalStats> stats(n_threads);
+    vector<std::thread> threads;
+    for(int t=1; t<n_threads; ++t)
+    {
+        threads.push_back(std::thread(calc_normal_rows, positions, res_u, res_v,
+                                      res_v * t / n_threads, res_v * (t + 1) / n_threads,
+                                      normals, &stats[t]));
+    }
+    calc_normal_rows(positions, res_u, res_v, 0, res_v / n_threads, normals, &stats[0]);
+
+    for(size_t t=0; t<threads.size(); ++t) threads[t].join();
+    for(int t=1; t<n_threads; ++t) stats[0].merge(stats[t]);
+
+    return stats[0];
+}
+
+NormalStats stream_grid(GridSource& source, int res_u, int res_v, int band_rows, VertexSink& sink)
+{
+    const int stride = res_u + 2;
+
+    // Ring of the last three rows; row r lives in slot (r + 1) % 3:
+    vector<vec3> ring_positions(3 * stride), ring_colors(3 * res_u);
+    // The band of rows waiting to be passed to the sink:
+    vector<vec3> band_positions(band_rows * res_u), band_colors(band_rows * res_u), band_normals(band_rows * res_u);
+
+    NormalScratch scratch;
+    NormalStats stats;
+
+    for(int r=-1; r<=0; ++r)
+        source.eval_row(res_u, res_v, r, &ring_positions[stride * (r + 1)], &ring_colors[res_u * (r + 1)]);
+
+    int band_j0 = 0;
+    for(int j=0; j<res_v; ++j)
+    {
+        // Evaluate the row after this one, which is needed for the normals:
+        const int next_slot = (j + 2) % 3;
+        source.eval_row(res_u, res_v, j + 1, &ring_positions[stride * next_slot], &ring_colors[res_u * next_slot]);
+
+        const vec3 *above = &ring_positions[stride * (j % 3)];
+        const vec3 *row   = &ring_positions[stride * ((j + 1) % 3)];
+        const vec3 *below = &ring_positions[stride * next_slot];
+        const vec3 *colors = &ring_colors[res_u * ((j + 1) % 3)];
+
+        const int b = res_u * (j - band_j0);
+        calc_normal_row(above, row, below, res_u, res_v, j, &band_normals[b], scratch, stats);
+        copy(row + 1, row + 1 + res_u, &band_positions[b]);
+        copy(colors, colors + res_u, &band_colors[b]);
+
+        if(j - band_j0 + 1 == band_rows || j == res_v - 1)
+        {
+            sink.write_rows(band_j0, j - band_j0 + 1, &band_positions[0], &band_colors[0], &band_normals[0]);
+            band_j0 = j + 1;
+        }
+    }
+
+    return stats;
+}
+
+void gen_strip_indices(int res_u, int res_v, uint16_t* elems)
+{
+    size_t idx = 0;
+    for(int j=0; j < res_v - 1; ++j)
+    {
+        if(j > 0)
+        {
+            // Generate degenerate triangles:
+            elems[idx ++] = res_u * (j + 1) - 1;
+            elems[idx ++] = res_u * j;
+        }
+
+        for(int i=0; i<res_u; ++i)
+        {
+            elems[idx ++] = i + res_u * j;
+            elems[idx ++] = i + res_u * (j + 1);
+        }
+    }
+    assert(idx == n_strip_elements(res_u, res_v));
+}
+
+void gen_wire_indices(int res_u, int res_v, uint16_t* elems)
+{
+    size_t idx = 0;
+    for(int j=0; j < res_v; ++j)
+    {
+        for(int i=0; i < res_u - 1; ++i)
+        {
+            elems[idx ++] = i + res_u * j;
+            elems[idx ++] = i + 1 + res_u * j;
+        }
+    }
+    for(int i=0; i < res_u; ++i)
+    {
+        for(int j=0; j < res_v - 1; ++j)
+        {
+            elems[idx ++] = i + res_u * j;
+            elems[idx ++] = i + res_u * (j + 1);
+        }
+    }
+    assert(idx == n_wire_elements(res_u, res_v));
+}
+
+void Mesh::append(const Mesh& other)
+{
+    const uint32_t base = positions.size();
+    positions.insert(positions.end(), other.positions.begin(), other.positions.end());
+    colors.insert(colors.end(), other.colors.begin(), other.colors.end());
+    normals.insert(normals.end(), other.normals.begin(), other.normals.end());
+    for(size_t k=0; k<other.triangles.size(); ++k) triangles.push_back(base + other.triangles[k]);
+}
+
+void GridArraySink::write_rows(int j0, int n_rows, const vec3* positions, const vec3* colors, const vec3* normals)
+{
+    const size_t n_verts = vertices.size() / 3, offset = res_u * j0, size = res_u * n_rows;
+    copy_n(positions, size, vertices.begin() + offset);
+    copy_n(colors, size, vertices.begin() + n_verts + offset);
+    copy_n(normals, size, vertices.begin() + 2 * n_verts + offset);
+    if(copy) copy->write_rows(j0, n_rows, positions, colors, normals);
+}
+
+void append_grid(const vec3* vertices, int res_u, int res_v, Mesh& mesh)
+{
+    const size_t n_verts = res_u * res_v;
+    const uint32_t base = mesh.positions.size();
+    mesh.positions.insert(mesh.positions.end(), vertices, vertices + n_verts);
+    mesh.colors.insert(mesh.colors.end(), vertices + n_verts, vertices + 2 * n_verts);
+    mesh.normals.insert(mesh.normals.end(), vertices + 2 * n_verts, vertices + 3 * n_verts);
+
+    // Split each quad along the same diagonal as the strips, and wind the
+    // triangles like their first one:
+    for(int j=0; j < res_v - 1; ++j)
+    {
+        for(int i=0; i < res_u - 1; ++i)
+        {
+            const uint32_t a = base + i + res_u * j, b = a + 1, c = a + res_u, d = c + 1;
+            const uint32_t quad[6] = { a, c, b, b, c, d };
+            mesh.triangles.insert(mesh.triangles.end(), quad, quad + 6);
+        }
+    }
+}
+
+bool is_bad_triangle(const vec3& a, const vec3& b, const vec3& c)
+{
+    if(!std::isfinite(a.x + a.y + a.z + b.x + b.y + b.z + c.x + c.y + c.z)) return true;
+
+    // |e1 x e2| = |e1| |e2| sin(angle):
+    const dvec3 e1 = dvec3(b) - dvec3(a), e2 = dvec3(c) - dvec3(a);
+    const dvec3 n = cross(e1, e2);
+    return !(dot(n, n) > 1e-12 * dot(e1, e1) * dot(e2, e2));
+}
+
+size_t remove_bad_triangles(Mesh& mesh)
+{
+    size_t n_kept = 0;
+    for(size_t t=0; t<mesh.triangles.size(); t+=3)
+    {
+        const uint32_t *tri = &mesh.triangles[t];
+        if(is_bad_triangle(mesh.positions[tri[0]], mesh.positions[tri[1]], mesh.positions[tri[2]])) continue;
+        copy(tri, tri + 3, mesh.triangles.begin() + 3 * n_kept);
+        ++ n_kept;
+    }
+
+    const size_t n_removed = mesh.n_triangles() - n_kept;
+    mesh.triangles.resize(3 * n_kept);
+    return n_removed;
+}
+
+size_t find_bad_grid_triangles(const vec3* row, const vec3* next_row, int res_u, vector<bool>& bad, size_t first)
+{
+    size_t n_bad = 0;
+    for(int i=0; i < res_u - 1; ++i)
+    {
+        const vec3 &a = row[i], &b = row[i + 1], &c = next_row[i], &d = next_row[i + 1];
+        if(is_bad_triangle(a, c, b))
+        {
+            bad[first + 2 * i] = true;
+            ++ n_bad;
+        }
+        if(is_bad_triangle(b, c, d))
+        {
+            bad[first + 2 * i + 1] = true;
+            ++ n_bad;
+        }
+    }
+    return n_bad;
+}
+
+void gen_triangle_indices(int res_u, int res_v, const vector<bool>& bad, vector<uint16_t>& elems)
+{
+    size_t t = 0;
+    for(int j=0; j < res_v - 1; ++j)
+    {
+        for(int i=0; i < res_u - 1; ++i, t+=2)
+        {
+            const uint16_t a = i + res_u * j, b = a + 1, c = a + res_u, d = c + 1;
+            const uint16_t quad[6] = { a, c, b, b, c, d };
+            if(!bad[t]) elems.insert(elems.end(), quad, quad + 3);
+            if(!bad[t + 1]) elems.insert(elems.end(), quad + 3, quad + 6);
+        }
+    }
+}
+
+// Returns a key for cell (x,y,z) of the spatial hash.  Different cells may
+// get the same key, which only costs some distance checks.
+static uint64_t cell_key(int64_t x, int64_t y, int64_t z)
+{
+    return uint64_t(x) * 73856093ULL ^ uint64_t(y) * 19349663ULL ^ uint64_t(z) * 83492791ULL;
+}
+
+WeldStats weld_vertices(Mesh& mesh, float tolerance)
+{
+    WeldStats stats;
+    stats.n_vertices_before = mesh.positions.size();
+    stats.n_triangles_before = mesh.n_triangles();
+    stats.n_recalculated = stats.n_null = 0;
+
+    // Vertices are merged within eps.  The hash cells are larger, so merge
+    // partners are at most in the neighboring cells across the faces that a
+    // vertex is within eps of, and mostly in its own:
+    vec3 lo(HUGE_VALF), hi(-HUGE_VALF);
+    for(size_t v=0; v<mesh.positions.size(); ++v)
+    {
+        const vec3& p = mesh.positions[v];
+        if(!std::isfinite(p.x + p.y + p.z)) continue;
+        lo = glm::min(lo, p);
+        hi = glm::max(hi, p);
+    }
+    const vec3 extent = glm::max(hi - lo, vec3(0));
+    const float eps = tolerance * std::max(extent.x, std::max(extent.y, extent.z));
+    const double cell_size = eps > 0 ? 16 * eps : 1, margin = eps / cell_size;
+
+    const uint32_t none = uint32_t(-1);
+    Mesh welded;
+    vector<uint32_t> new_idx(mesh.positions.size());
+    vector<uint32_t> n_merged;  // per welded vertex
+    unordered_map<uint64_t, uint32_t> cell_heads;  // first welded vertex in each cell
+    cell_heads.reserve(mesh.positions.size());
+    vector<uint32_t> cell_next;  // next welded vertex in the same cell
+    for(size_t v=0; v<mesh.positions.size(); ++v)
+    {
+        const vec3& p = mesh.positions[v];
+        uint32_t w = none;
+        uint64_t key = 0;
+
+        // Vertices that are infinite, NaN or too far out for the cell
+        // coordinates are left alone:
+        const double qx = p.x / cell_size, qy = p.y / cell_size, qz = p.z / cell_size;
+        const double fx = floor(qx), fy = floor(qy), fz = floor(qz);
+        const double max_coord = 1e18;
+        const bool hashable = fabs(fx) < max_coord && fabs(fy) < max_coord && fabs(fz) < max_coord;
+        if(hashable)
+        {
+            const int64_t cx = fx, cy = fy, cz = fz;
+            key = cell_key(cx, cy, cz);
+
+            // Direction of the neighboring cell along each axis, if p is close
+            // enough to it:
+            const int dx = qx - fx < margin ? -1 : qx - fx > 1 - margin ? 1 : 0;
+            const int dy = qy - fy < margin ? -1 : qy - fy > 1 - margin ? 1 : 0;
+            const int dz = qz - fz < margin ? -1 : qz - fz > 1 - margin ? 1 : 0;
+            for(int n=0; n<8 && w == none; ++n)
+            {
+                if(((n & 1) && !dx) || ((n & 2) && !dy) || ((n & 4) && !dz)) continue;
+                unordered_map<uint64_t, uint32_t>::const_iterator it
+                    = cell_heads.find(cell_key(cx + (n & 1) * dx, cy + (n >> 1 & 1) * dy, cz + (n >> 2) * dz));
+                if(it == cell_heads.end()) continue;
+                for(uint32_t c = it->second; c != none; c = cell_next[c])
+                {
+                    const vec3 d = welded.positions[c] - p;
+                    if(dot(d, d) <= eps * eps)
+                    {
+                        w = c;
+                        break;
+                    }
+                }
+            }
+        }
+
+        if(w == none)
+        {
+            w = welded.positions.size();
+            welded.positions.push_back(p);
+            welded.colors.push_back(mesh.colors[v]);
+            welded.normals.push_back(mesh.normals[v]);
+            n_merged.push_back(1);
+            if(hashable)
+            {
+                unordered_map<uint64_t, uint32_t>::iterator it = cell_heads.insert(make_pair(key, none)).first;
+                cell_next.push_back(it->second);
+                it->second = w;
+            }
+            else
+                cell_next.push_back(none);
+        }
+        else
+        {
+            welded.colors[w] += mesh.colors[v];
+            welded.normals[w] += mesh.normals[v];
+            ++ n_merged[w];
+        }
+        new_idx[v] = w;
+    }
+
+    // Keep the triangles which haven't collapsed:
+    for(size_t t=0; t<mesh.triangles.size(); t+=3)
+    {
+        const uint32_t a = new_idx[mesh.triangles[t]], b = new_idx[mesh.triangles[t + 1]], c = new_idx[mesh.triangles[t + 2]];
+        if(a == b || b == c || c == a) continue;
+        welded.triangles.push_back(a);
+        welded.triangles.push_back(b);
+        welded.triangles.push_back(c);
+    }
+
+    // Average the merged colors and normals, and find the normals that need
+    // recalculating:
+    vector<bool> recalc(welded.positions.size());
+    for(size_t w=0; w<welded.positions.size(); ++w)
+    {
+        vec3& normal = welded.normals[w];
+        const float len = length(normal);
+        if(n_merged[w] > 1)
+        {
+            welded.colors[w] /= float(n_merged[w]);
+            if(len > 1e-3f * n_merged[w]) normal /= len;
+            else recalc[w] = true;
+        }
+        else if(!(len > 0))
+            recalc[w] = true;
+        if(recalc[w]) normal = vec3(0);
+    }
+
+    // Recalculate them as the area weighted sums of the adjacent triangle normals:
+    for(size_t t=0; t<welded.triangles.size(); t+=3)
+    {
+        const uint32_t *tri = &welded.triangles[t];
+        if(!recalc[tri[0]] && !recalc[tri[1]] && !recalc[tri[2]]) continue;
+
+        const vec3 face_normal = cross(welded.positions[tri[1]] - welded.positions[tri[0]],
+                                       welded.positions[tri[2]] - welded.positions[tri[0]]);
+        for(int k=0; k<3; ++k)
+        {
+            if(recalc[tri[k]]) welded.normals[tri[k]] += face_normal;
+        }
+    }
+    for(size_t w=0; w<welded.positions.size(); ++w)
+    {
+        if(!recalc[w]) continue;
+        vec3& normal = welded.normals[w];
+        const float len = length(normal);
+        if(len > 0 && !std::isinf(len))
+        {
+            normal /= len;
+            ++ stats.n_recalculated;
+        }
+        else
+        {
+            normal = vec3(0);
+            ++ stats.n_null;
+        }
+    }
+
+    stats.n_vertices_after = welded.positions.size();
+    stats.n_triangles_after = welded.n_triangles();
+    swap(mesh, welded);
+    return stats;
+}
+
+// Returns the representative of the set of v, and shortens the path to it.
+static uint32_t find_root(vector<uint32_t>& parent, uint32_t v)
+{
+    while(parent[v] != v)
+    {
+        parent[v] = parent[parent[v]];
+        v = parent[v];
+    }
+    return v;
+}
+
+TopologyStats orient_mesh(Mesh& mesh)
+{
+    TopologyStats stats;
+    stats.n_edges = stats.n_boundary_edges = stats.n_nonmanifold_edges = stats.n_inconsistent_edges = 0;
+    stats.n_components = stats.n_flipped = 0;
+
+    // Collect the edges of all triangles as (lower vertex, higher vertex,
+    // direction), so that sorting brings the uses of each edge together:
+    const uint64_t n_verts = mesh.positions.size();
+    vector<uint64_t> edges;
+    edges.reserve(mesh.triangles.size());
+    for(size_t t=0; t<mesh.triangles.size(); t+=3)
+    {
+        for(int k=0; k<3; ++k)
+        {
+            const uint32_t a = mesh.triangles[t + k], b = mesh.triangles[t + (k + 1) % 3];
+            if(a == b) continue;
+            edges.push_back((min(a, b) * n_verts + max(a, b)) << 1 | (a < b));
+        }
+    }
+    sort(edges.begin(), edges.end());
+
+    for(size_t e=0; e<edges.size(); )
+    {
+        size_t n = 1;
+        while(e + n < edges.size() && edges[e + n] >> 1 == edges[e] >> 1) ++ n;
+
+        ++ stats.n_edges;
+        if(n == 1)
+            ++ stats.n_boundary_edges;
+        else if(n > 2)
+            ++ stats.n_nonmanifold_edges;
+        else if((edges[e] & 1) == (edges[e + 1] & 1))
+            ++ stats.n_inconsistent_edges;
+        e += n;
+    }
+
+    // Find the components:
+    vector<uint32_t> parent(n_verts);
+    for(size_t v=0; v<n_verts; ++v) parent[v] = v;
+    for(size_t t=0; t<mesh.triangles.size(); t+=3)
+    {
+        const uint32_t a = find_root(parent, mesh.triangles[t]);
+        for(int k=1; k<3; ++k)
+        {
+            const uint32_t b = find_root(parent, mesh.triangles[t + k]);
+            if(b != a) parent[b] = a;
+        }
+    }
+
+    // Sum up the signed volume of each (as tetrahedra between the origin and
+    // the triangles, times 6):
+    vector<double> volume(n_verts, 0);
+    vector<bool> used(n_verts, false);
+    for(size_t t=0; t<mesh.triangles.size(); t+=3)
+    {
+        const uint32_t *tri = &mesh.triangles[t];
+        const dvec3 p0(mesh.positions[tri[0]]), p1(mesh.positions[tri[1]]), p2(mesh.positions[tri[2]]);
+        const uint32_t c = find_root(parent, tri[0]);
+        volume[c] += dot(p0, cross(p1, p2));
+        used[c] = true;
+    }
+    for(size_t v=0; v<n_verts; ++v)
+    {
+        if(!used[v]) continue;
+        ++ stats.n_components;
+        if(volume[v] < 0) ++ stats.n_flipped;
+    }
+
+    // Without a consistent orientation there's no inside to flip:
+    if(!stats.is_closed() || stats.n_flipped == 0)
+    {
+        stats.n_flipped = 0;
+        return stats;
+    }
+
+    for(size_t t=0; t<mesh.triangles.size(); t+=3)
+    {
+        if(volume[find_root(parent, mesh.triangles[t])] < 0) swap(mesh.triangles[t + 1], mesh.triangles[t + 2]);
+    }
+    for(size_t v=0; v<n_verts; ++v)
+    {
+        if(volume[find_root(parent, v)] < 0) mesh.normals[v] = -mesh.normals[v];
+    }
+    return stats;
+}
+
+const char* GridTopology::get_problem() const
+{
+    if(!finite) return "has non-finite vertices";
+    if(!u_closed) return "is open along u=0 and u=1";
+    if(!v_closed) return "is open along v=0 and v=1";
+    if(volume <= 0) return "faces inwards";
+    return "is closed";
+}
+
+GridWelder::GridWelder(int res_u, int res_v, float tolerance)
+ : res_u(res_u), res_v(res_v), tolerance(tolerance), finite(true), n_closed_rows(0),
+   first_pole(false), last_pole(false), v_seam(false), west_point(true), east_point(true), volume(0)
+{
+}
+
+GridTopology GridWelder::get_topology() const
+{
+    GridTopology topo;
+    topo.finite = finite;
+    topo.u_closed = n_closed_rows == size_t(res_v) || (west_point && east_point);
+    topo.v_closed = (first_pole && last_pole) || v_seam;
+    topo.volume = volume;
+    return topo;
+}
+
+// The square of the distance from a to b.
+static float distance2(const vec3& a, const vec3& b)
+{
+    const vec3 d = b - a;
+    return dot(d, d);
+}
+
+void GridWelder::weld_rows(int j0, int n_rows, vec3* positions, vec3* colors, vec3* normals)
+{
+    // The size of the band, by its finite positions:
+    vec3 lo(numeric_limits<float>::max()), hi(-numeric_limits<float>::max());
+    for(int k=0; k < res_u * n_rows; ++k)
+    {
+        const vec3& p = positions[k];
+        if(!std::isfinite(p.x + p.y + p.z))
+        {
+            finite = false;
+            continue;
+        }
+        lo = min(lo, p);
+        hi = max(hi, p);
+    }
+    const float tol = tolerance * (lo.x <= hi.x ? length(hi - lo) : 0), tol2 = tol * tol;
+
+    for(int r=0; r<n_rows; ++r)
+    {
+        const int j = j0 + r, last = res_u - 1;
+        vec3 *p = positions + res_u * r, *c = colors + res_u * r, *n = normals + res_u * r;
+
+        // NaNs fail the comparisons, so rows with them are neither poles nor seams:
+        bool pole = true;
+        for(int i=1; i<res_u && pole; ++i) pole = distance2(p[0], p[i]) <= tol2;
+
+        if(pole)
+        {
+            vec3 center(0), color(0);
+            for(int i=0; i<res_u; ++i)
+            {
+                center += p[i];
+                color += c[i];
+            }
+            center /= float(res_u);
+            color /= float(res_u);
+
+            // The rows next to the pole show which way it faces:
+            vec3 normal(0);
+            const vec3 *above = r > 0 ? n - res_u : j > 0 ? &last_normals[0] : NULL;
+            const vec3 *below = r + 1 < n_rows ? n + res_u : NULL;
+            for(int i=0; i<res_u; ++i)
+            {
+                if(above) normal += above[i];
+                if(below) normal += below[i];
+            }
+            const float len = length(normal);
+            if(len > 0) normal /= len;
+
+            for(int i=0; i<res_u; ++i)
+            {
+                p[i] = center;
+                c[i] = color;
+                n[i] = normal;
+            }
+            ++ stats.n_pole_rows;
+            stats.n_merged += last;
+            stats.n_recalculated += res_u;
+        }
+        else if(distance2(p[0], p[last]) <= tol2)
+        {
+            p[last] = p[0];
+            c[0] = c[last] = .5f * (c[0] + c[last]);
+
+            // One of them may be null:
+            const vec3 normal = n[0] + n[last];
+            const float len = length(normal);
+            if(len > 0) n[0] = n[last] = normal / len;
+            ++ stats.n_seam_rows;
+            ++ stats.n_merged;
+        }
+
+        for(int i=0; i<res_u; ++i)
+        {
+            if(n[i] != vec3(0)) continue;
+            NormalStats null_stats;
+            null_stats.n_null = 1;
+            null_stats.first_null_i = i;
+            null_stats.first_null_j = j;
+            stats.null_stats.merge(null_stats);
+        }
+
+        // The edges of the grid, for get_topology():
+        if(pole || p[0] == p[last]) ++ n_closed_rows;
+        if(j == 0)
+        {
+            first_row.assign(p, p + res_u);
+            first_pole = pole;
+        }
+        west_point = west_point && distance2(first_row[0], p[0]) <= tol2;
+        east_point = east_point && distance2(first_row[last], p[last]) <= tol2;
+        if(j == res_v - 1)
+        {
+            last_pole = pole;
+            v_seam = true;
+            for(int i=0; i<res_u && v_seam; ++i) v_seam = distance2(first_row[i], p[i]) <= tol2;
+        }
+
+        // Add the quads between this row and the last one to the volume, with
+        // their triangles as append_grid() makes them:
+        if(j == 0) continue;
+        const vec3 *prev = r > 0 ? p - res_u : &last_positions[0];
+        for(int i=0; i<last; ++i)
+        {
+            const dvec3 a(prev[i]), b(prev[i + 1]), c(p[i]), d(p[i + 1]);
+            volume += dot(a, cross(c, b)) + dot(b, cross(c, d));
+        }
+    }
+
+    last_positions.assign(positions + res_u * (n_rows - 1), positions + res_u * n_rows);
+    last_normals.assign(normals + res_u * (n_rows - 1), normals + res_u * n_rows);
+}
+
+vector<MeshBatch> split_mesh(const Mesh& mesh, size_t max_verts, Mesh& out, vector<uint16_t>& indices)
+{
+    assert(max_verts >= 3 && max_verts <= 65536);
+
+    // Index of every vertex in the batch given by batch_of, if any:
+    vector<uint16_t> new_idx(mesh.positions.size());
+    vector<size_t> batch_of(mesh.positions.size(), size_t(-1));
+
+    out = Mesh();
+    indices.clear();
+    indices.reserve(mesh.triangles.size());
+
+    vector<MeshBatch> batches;
+    for(size_t t=0; t<mesh.triangles.size(); t+=3)
+    {
+        // Start a new batch when this triangle might not fit anymore:
+        if(batches.empty() || batches.back().n_vertices + 3 > max_verts)
+        {
+            MeshBatch batch = { out.positions.size(), 0, indices.size(), 0 };
+            batches.push_back(batch);
+        }
+        MeshBatch& batch = batches.back();
+
+        for(int k=0; k<3; ++k)
+        {
+            const uint32_t v = mesh.triangles[t + k];
+            if(batch_of[v] != batches.size())
+            {
+                batch_of[v] = batches.size();
+                new_idx[v] = batch.n_vertices ++;
+                out.positions.push_back(mesh.positions[v]);
+                out.colors.push_back(mesh.colors[v]);
+                out.normals.push_back(mesh.normals[v]);
+            }
+            indices.push_back(new_idx[v]);
+            ++ batch.n_indices;
+        }
+    }
+
+    return batches;
+}
+
+void gen_wire_indices(const uint16_t* triangles, size_t n_triangles, uint16_t* elems)
+{
+    for(size_t t=0; t<n_triangles; ++t)
+    {
+        const uint16_t *tri = triangles + 3 * t;
+        for(int k=0; k<3; ++k)
+        {
+            *elems ++ = tri[k];
+            *elems ++ = tri[(k + 1) % 3];
+        }
+    }
+}
@@ -0,0 +1,265 @@
+#ifndef MESH_HPP
+#define MESH_HPP
+
+#include <cinttypes>
+#include <cstddef>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Vertices for which no normal could be found (these get a zero normal).
+struct NormalStats
+{
+    NormalStats() : n_null(0), first_null_i(-1), first_null_j(-1) {}
+
+    // Adds the null normals of other.
+    void merge(const NormalStats& other);
+
+    size_t n_null;
+    int first_null_i, first_null_j;  // the first one, in row-major order
+};
+
+// Reusable buffers for calc_normal_row().  Keeps converted copies of the last
+// three rows, so a scratch object must only be used for one grid.
+struct NormalScratch
+{
+    std::vector<float> soa;
+    std::vector<unsigned char> slow;
+    int rows[3];  // indices of the rows in soa
+};
+
+// Calculates unit normals of row j of a res_u*res_v grid from the positions of
+// rows j-1, j and j+1, which must have a sentinel vertex at both ends (so
+// res_u+2 entries each).  Normals are written without sentinels.  The positions
+// of a row must not change while scratch still has it (see above).
+void calc_normal_row(const glm::vec3* above, const glm::vec3* row, const glm::vec3* below,
+                     int res_u, int res_v, int j, glm::vec3* normals,
+                     NormalScratch& scratch, NormalStats& stats);
+
+// Calculates unit normals of a res_u*res_v grid.  Around the grid, positions
+// must have a frame of sentinel vertices (so (res_u+2)*(res_v+2) entries).
+// Normals are written without frame (res_u*res_v entries).  Rows are split
+// among n_threads threads (0 means one per CPU core).
+NormalStats calc_normals(const glm::vec3* positions, int res_u, int res_v, glm::vec3* normals, int n_threads = 0);
+
+// Something that can evaluate a grid row by row.
+class GridSource
+{
+public:
+    virtual ~GridSource() {}
+
+    // Evaluates row j (from -1 to res_v) of a res_u*res_v grid: res_u+2
+    // positions including a sentinel vertex at both ends and, only for
+    // 0 <= j < res_v, res_u colors.
+    virtual void eval_row(int res_u, int res_v, int j, glm::vec3* positions, glm::vec3* colors) = 0;
+};
+
+// Receives the vertex data of a grid in bands of rows.
+class VertexSink
+{
+public:
+    virtual ~VertexSink() {}
+
+    // Receives the positions, colors and normals (res_u per row, no
+    // sentinels) of the n_rows rows starting with row j0.
+    virtual void write_rows(int j0, int n_rows, const glm::vec3* positions,
+                            const glm::vec3* colors, const glm::vec3* normals) = 0;
+};
+
+// Evaluates a grid row by row, calculates its normals and passes the vertex
+// data to sink in bands of band_rows rows.  Only three rows of positions
+// and one band are kept in memory at any time.
+NormalStats stream_grid(GridSource& source, int res_u, int res_v, int band_rows, VertexSink& sink);
+
+// Number of element indices of a grid drawn as one triangle strip.
+inline size_t n_strip_elements(int res_u, int res_v) { return (res_v - 1) * 2 * res_u + (res_v - 2) * 2; }
+
+// Number of element indices of a grid drawn as lines.
+inline size_t n_wire_elements(int res_u, int res_v) { return (res_v - 1) * 2 * res_u + (res_u - 1) * 2 * res_v; }
+
+// Fills elems with the triangle strip indices of a grid, rows connected by
+// degenerate triangles.
+void gen_strip_indices(int res_u, int res_v, uint16_t* elems);
+
+// Fills elems with the line indices of a grid.
+void gen_wire_indices(int res_u, int res_v, uint16_t* elems);
+
+// A triangle mesh.  colors and normals have one entry per position.
+struct Mesh
+{
+    std::vector<glm::vec3> positions, colors, normals;
+    std::vector<uint32_t> triangles;  // three vertex indices per triangle
+
+    size_t n_triangles() const { return triangles.size() / 3; }
+
+    // Appends the vertices and triangles of other.
+    void append(const Mesh& other);
+};
+
+// Collects the vertex data of a res_u*res_v grid in memory: the positions,
+// colors and normals of all vertices, one after the other.  Each band of rows
+// is also passed on to copy, if set.
+class GridArraySink : public VertexSink
+{
+public:
+    GridArraySink(int res_u, int res_v, VertexSink* copy = NULL)
+      : res_u(res_u), vertices(3 * res_u * res_v), copy(copy) {}
+
+    void write_rows(int j0, int n_rows, const glm::vec3* positions,
+                    const glm::vec3* colors, const glm::vec3* normals);
+
+    const glm::vec3 *get_vertices() const { return &vertices[0]; }
+
+private:
+    int res_u;
+    std::vector<glm::vec3> vertices;
+    VertexSink *copy;
+};
+
+// Whether triangle abc has a vertex that isn't finite or has no area to
+// speak of (its angle at a is below about 1e-6 radians, or an edge has zero
+// length).  Drawing such triangles is wasted work at best.
+bool is_bad_triangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c);
+
+// Removes the triangles of mesh for which is_bad_triangle() holds.  Returns
+// how many there were.
+size_t remove_bad_triangles(Mesh& mesh);
+
+// Checks the triangles of the quads between two rows of a grid (res_u
+// vertices each) and sets their entries in bad, starting at first, if they
+// are bad.  Each quad has two triangles, split as in append_grid().  Returns
+// the number of bad triangles found.
+size_t find_bad_grid_triangles(const glm::vec3* row, const glm::vec3* next_row, int res_u,
+                               std::vector<bool>& bad, size_t first);
+
+// Appends the triangles of a res_u*res_v grid, as in append_grid() but
+// without those marked in bad, to elems as a triangle list.
+void gen_triangle_indices(int res_u, int res_v, const std::vector<bool>& bad, std::vector<uint16_t>& elems);
+
+// Appends a res_u*res_v grid to mesh, with two triangles per quad that face
+// the same way as the triangle strips of gen_strip_indices().  vertices holds
+// the positions, colors and normals of the grid, one after the other.
+void append_grid(const glm::vec3* vertices, int res_u, int res_v, Mesh& mesh);
+
+// Result of weld_vertices().
+struct WeldStats
+{
+    size_t n_vertices_before, n_vertices_after;
+    size_t n_triangles_before, n_triangles_after;
+    size_t n_recalculated;  // normals calculated from the surrounding triangles
+    size_t n_null;  // normals which couldn't be calculated that way either
+};
+
+// Merges the vertices of mesh which are closer than tolerance times the size
+// of its bounding box (such as those along the seams and at the poles of a
+// closed grid), using a spatial hash.  Triangles which collapse are removed.
+// Merged vertices get the average color and normal of the original ones;
+// where the normals are null or cancel out, they are calculated from the
+// surrounding triangles instead.
+WeldStats weld_vertices(Mesh& mesh, float tolerance);
+
+// Result of GridWelder.
+struct GridWeldStats
+{
+    GridWeldStats() : n_seam_rows(0), n_pole_rows(0), n_merged(0), n_recalculated(0) {}
+
+    size_t n_seam_rows;  // rows whose first and last vertices were merged
+    size_t n_pole_rows;  // rows which were merged into one vertex
+    size_t n_merged;  // vertices which became copies of others
+    size_t n_recalculated;  // normals of pole rows, taken from the rows next to them
+    NormalStats null_stats;  // normals which are still null
+};
+
+// Whether a grid is the surface of a solid, as far as GridWelder can tell
+// from its rows: the u=0 and u=1 columns must be one seam or both be collapsed
+// to points, and likewise the v=0 and v=1 rows.
+struct GridTopology
+{
+    GridTopology() : finite(true), u_closed(false), v_closed(false), volume(0) {}
+
+    bool finite;  // all positions
+    bool u_closed, v_closed;  // along the u=0/u=1 and v=0/v=1 edges of the grid
+    double volume;  // enclosed, times 6; negative if the grid faces inwards
+
+    // Whether backface culling doesn't change how the grid looks from outside.
+    bool is_closed() const { return finite && u_closed && v_closed && volume > 0; }
+    // Why it isn't closed, as in "the surface ...".
+    const char* get_problem() const;
+};
+
+// Welds a grid while it is streamed (see stream_grid()), keeping no more than
+// a row of it: where the first and last vertex of a row are in one place (on
+// the seam of a closed surface), and where all vertices of a row are (at a
+// pole), they become copies of one vertex with the average color and normal.
+// The normals of pole rows, which are often null or point every which way,
+// are taken from the rows next to them instead.  Vertices count as in one
+// place if they are closer than tolerance times the size of their band.
+// Unlike weld_vertices(), this keeps the grid as it is, so the merged
+// vertices are still there, just equal.  Along the way it finds out whether
+// the welded grid is closed.
+class GridWelder
+{
+public:
+    GridWelder(int res_u, int res_v, float tolerance);
+
+    // Welds the n_rows rows starting with row j0 in place.  Bands must come in
+    // the order of their rows.
+    void weld_rows(int j0, int n_rows, glm::vec3* positions, glm::vec3* colors, glm::vec3* normals);
+
+    const GridWeldStats& get_stats() const { return stats; }
+    // Once all rows are welded:
+    GridTopology get_topology() const;
+
+private:
+    int res_u, res_v;
+    float tolerance;
+    GridWeldStats stats;
+    std::vector<glm::vec3> last_positions, last_normals;  // of the last row of the last band
+    std::vector<glm::vec3> first_row;  // positions, to compare the last row with
+    bool finite;
+    size_t n_closed_rows;  // seam or pole rows
+    bool first_pole, last_pole, v_seam;  // for the v=0 and v=1 rows
+    bool west_point, east_point;  // whether the u=0 and u=1 columns are collapsed
+    double volume;  // see GridTopology
+};
+
+// Result of orient_mesh().
+struct TopologyStats
+{
+    size_t n_edges;
+    size_t n_boundary_edges;  // used by only one triangle
+    size_t n_nonmanifold_edges;  // used by more than two triangles
+    size_t n_inconsistent_edges;  // used by two triangles which face opposite ways
+    size_t n_components;  // of triangles connected by their vertices
+    size_t n_flipped;  // components turned around
+
+    // Whether the mesh consists of closed surfaces whose triangles all face
+    // outwards, so that backface culling doesn't change how it looks from
+    // outside.
+    bool is_closed() const { return n_boundary_edges == 0 && n_nonmanifold_edges == 0 && n_inconsistent_edges == 0; }
+};
+
+// Checks whether the edges of mesh make it the surface of a solid: each one
+// used by exactly two triangles which go along it in opposite directions (so
+// weld the vertices first).  If they do, the components of mesh which enclose
+// a negative volume, and so face inwards, are turned around: the order of
+// their triangles' vertices and their normals are reversed.
+TopologyStats orient_mesh(Mesh& mesh);
+
+// A part of a mesh that can be drawn with 16 bit indices.
+struct MeshBatch
+{
+    size_t first_vertex, n_vertices;
+    size_t first_index, n_indices;
+};
+
+// Splits mesh into batches of at most max_verts vertices, keeping the order of
+// its triangles.  The vertices of all batches are written to out (duplicating
+// the ones used by several batches) and the triangles to indices, relative to
+// the first vertex of their batch.
+std::vector<MeshBatch> split_mesh(const Mesh& mesh, size_t max_verts, Mesh& out, std::vector<uint16_t>& indices);
+
+// Fills elems with the line indices of the edges of n_triangles triangles
+// (2 * 3 * n_triangles entries; shared edges appear twice).
+void gen_wire_indices(const uint16_t* triangles, size_t n_triangles, uint16_t* elems);
+
+#endif  // MESH_HPP
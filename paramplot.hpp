@@ -0,0 +1,30 @@
+#ifndef PARAMPLOT_HPP
+#define PARAMPLOT_HPP
+
+// The parts of the program that don't need a display, for use by other
+// programs, which link with libparamplot.a (built by "make lib") and -pthread.
+// A mesh of a surface is made like this:
+//
+//     Surface surface;
+//     surface.set_formula('x', "cos(2*pi*u)");  // or make_function_surface()
+//     ...
+//     surface.compile();
+//
+//     GridArraySink grid(res_u, res_v);
+//     stream_grid(surface, res_u, res_v, max(1, 16384 / res_u), grid);
+//
+//     Mesh mesh;
+//     append_grid(grid.get_vertices(), res_u, res_v, mesh);
+//     weld_vertices(mesh, 1e-5);
+//     remove_bad_triangles(mesh);
+
+#include "evaluator.hpp"
+#include "surface.hpp"
+#include "funcsurface.hpp"
+#include "implicit.hpp"
+#include "mesh.hpp"
+#include "decimate.hpp"
+#include "gridcache.hpp"
+#include "server.hpp"
+
+#endif  // PARAMPLOT_HPP
@@ -0,0 +1,36 @@
+#include <algorithm>
+#include <cmath>
+#include "rescale.hpp"
+using namespace std;
+
+static const int window = 8;  // frames averaged before each decision
+static const float min_scale = .25f;
+static const float steps = 32;  // scales are multiples of 1/steps
+static const double raise_threshold = .8;  // relative to the target
+static const float headroom = .95f;  // new scales aim at this much of the target
+static const float max_raise = 1.25f;  // per decision
+
+bool ResolutionScaler::add_frame(double time)
+{
+    if(!is_enabled()) return false;
+
+    sum += time;
+    if(++n < window) return false;
+    frame_time = sum / n;
+    sum = 0;
+    n = 0;
+
+    // Frames would take about frame_time * (s / scale)^2 at scale s:
+    const float ideal = scale * sqrt(target / frame_time);
+    float new_scale = scale;
+    if(frame_time > target)
+        new_scale = headroom * ideal;
+    else if(frame_time < raise_threshold * target)
+        new_scale = min(headroom * ideal, max_raise * scale);
+
+    new_scale = max(min_scale, min(1.f, floor(new_scale * steps) / steps));
+    if(new_scale == scale) return false;
+
+    scale = new_scale;
+    return true;
+}
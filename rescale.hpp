@@ -0,0 +1,38 @@
+#ifndef RESCALE_HPP
+#define RESCALE_HPP
+
+// Chooses the fraction of the screen resolution to render at, so that frames
+// take about a target time.  Frames which are bound by fill rate take time in
+// proportion to their number of pixels, so the scale is estimated from that
+// and the average time of a window of frames.  The scale is only lowered when
+// frames take longer than the target, and only raised again when they are
+// clearly faster than that (and then to somewhat below the estimate), so that
+// it doesn't oscillate between two steps.
+class ResolutionScaler
+{
+public:
+    // A target_time of 0 (in seconds) disables scaling.
+    explicit ResolutionScaler(double target_time = 0) : target(target_time), scale(1), sum(0), n(0), frame_time(0) {}
+
+    void set_target(double target_time) { target = target_time;  scale = 1;  sum = 0;  n = 0; }
+    double get_target() const { return target; }
+    bool is_enabled() const { return target > 0; }
+
+    // Records the time a frame took at the current scale.  Returns whether
+    // the scale changed.
+    bool add_frame(double time);
+
+    // Returns the fraction of the screen width and height to render at.
+    float get_scale() const { return scale; }
+    // Returns the average time of the last complete window of frames.
+    double get_frame_time() const { return frame_time; }
+
+private:
+    double target;
+    float scale;
+    double sum;  // of the frame times of the current window
+    int n;  // frames in the current window
+    double frame_time;
+};
+
+#endif  // RESCALE_HPP
@@ -0,0 +1,468 @@
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <thread>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "server.hpp"
+#include "cachedir.hpp"
+#include "decimate.hpp"
+#include "hash.hpp"
+using namespace std;
+
+static const char mesh_magic[4] = { 'P', 'P', 'M', 'S' };
+static const uint32_t mesh_version = 1;
+static const char mesh_suffix[] = ".mesh";
+static const size_t max_formulas = 64;  // kept compiled
+static const size_t max_request_size = 1 << 16;
+
+// Returns the current time of a monotonic clock in seconds.
+static double get_time()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// Writes all of data to fd.  Returns false on failure.
+static bool write_all(int fd, const void *data, size_t size)
+{
+    const char *p = static_cast<const char*>(data);
+    while(size > 0)
+    {
+        const ssize_t n = write(fd, p, size);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Sends size bytes of file_fd, from its start, to fd without copying them
+// through user space.  Returns false on failure.
+static bool send_file(int fd, int file_fd, size_t size)
+{
+    off_t offset = 0;
+    while(size_t(offset) < size)
+    {
+        const ssize_t n = sendfile(fd, file_fd, &offset, size - offset);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+    }
+    return true;
+}
+
+// Writes a response with the given mesh, or with an error message if it isn't
+// empty.
+static bool write_response(int fd, const Mesh& mesh, const string& error = "")
+{
+    MeshHeader header;
+    memcpy(header.magic, mesh_magic, sizeof(mesh_magic));
+    header.version = mesh_version;
+    header.n_vertices = error.empty() ? mesh.positions.size() : 0;
+    header.n_triangles = error.empty() ? mesh.n_triangles() : 0;
+    header.error_length = error.length();
+    if(!write_all(fd, &header, sizeof(header))) return false;
+    if(!error.empty()) return write_all(fd, error.data(), error.length());
+
+    const size_t vertices_size = sizeof(glm::vec3) * mesh.positions.size();
+    return write_all(fd, mesh.positions.data(), vertices_size)
+        && write_all(fd, mesh.colors.data(), vertices_size)
+        && write_all(fd, mesh.normals.data(), vertices_size)
+        && write_all(fd, mesh.triangles.data(), sizeof(uint32_t) * mesh.triangles.size());
+}
+
+MeshServer::MeshServer(const ServerSettings& settings)
+ : settings(settings), listen_fd(-1), n_hits(0)
+{
+    if(settings.mesh_cache_size > 0) mesh_cache_dir = get_cache_dir("meshes");
+    if(pipe(stop_pipe) != 0) stop_pipe[0] = stop_pipe[1] = -1;
+}
+
+MeshServer::~MeshServer()
+{
+    if(listen_fd >= 0)
+    {
+        close(listen_fd);
+        unlink(path.c_str());
+    }
+    if(stop_pipe[0] >= 0)
+    {
+        close(stop_pipe[0]);
+        close(stop_pipe[1]);
+    }
+}
+
+void MeshServer::listen(const string& path)
+{
+    if(stop_pipe[0] < 0) throw string("can't create pipe: ") + strerror(errno);
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(path.length() >= sizeof(addr.sun_path)) throw "socket path \"" + path + "\" is too long";
+    strcpy(addr.sun_path, path.c_str());
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0) throw string("can't create socket: ") + strerror(errno);
+
+    // A socket nobody listens on any more is left over from a server which
+    // didn't exit cleanly:
+    if(connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0)
+    {
+        close(fd);
+        throw "another server is listening on \"" + path + "\"";
+    }
+    unlink(path.c_str());
+
+    if(bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(fd, 64) != 0)
+    {
+        const string reason = strerror(errno);
+        close(fd);
+        throw "can't listen on \"" + path + "\": " + reason;
+    }
+
+    // Clients which disconnect early must not kill the server:
+    signal(SIGPIPE, SIG_IGN);
+
+    listen_fd = fd;
+    this->path = path;
+}
+
+void MeshServer::run()
+{
+    double last_stats_time = get_time();
+    for(;;)
+    {
+        int timeout = -1;
+        if(settings.stats_interval > 0)
+            timeout = max(0, int(1e3 * (last_stats_time + settings.stats_interval - get_time())) + 1);
+
+        pollfd fds[2] = { { listen_fd, POLLIN, 0 }, { stop_pipe[0], POLLIN, 0 } };
+        const int n = poll(fds, 2, timeout);
+        if(n < 0 && errno != EINTR)
+        {
+            cerr << "WARNING: poll() failed: " << strerror(errno) << "\n";
+            break;
+        }
+        if(n > 0 && fds[1].revents) break;
+
+        if(n > 0 && fds[0].revents)
+        {
+            const int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if(fd >= 0)
+            {
+                lock_guard<std::mutex> lock(mutex);
+                connections.insert(fd);
+                std::thread(&MeshServer::serve_connection, this, fd).detach();
+            }
+            else if(errno != EINTR && errno != ECONNABORTED)
+                cerr << "WARNING: accept() failed: " << strerror(errno) << "\n";
+        }
+
+        const double now = get_time();
+        if(settings.stats_interval > 0 && now >= last_stats_time + settings.stats_interval)
+        {
+            print_stats(now - last_stats_time);
+            last_stats_time = now;
+        }
+    }
+
+    // Close the connections, so that their threads finish:
+    unique_lock<std::mutex> lock(mutex);
+    for(set<int>::const_iterator it = connections.begin(); it != connections.end(); ++it)
+        shutdown(*it, SHUT_RDWR);
+    while(!connections.empty()) connection_closed.wait(lock);
+    lock.unlock();
+
+    if(settings.stats_interval > 0) print_stats(get_time() - last_stats_time);
+}
+
+void MeshServer::stop()
+{
+    const char c = 0;
+    while(write(stop_pipe[1], &c, 1) < 0 && errno == EINTR);
+}
+
+void MeshServer::serve_connection(int fd)
+{
+    string buffer;
+    vector<string> lines;
+    size_t request_size = 0;
+    for(;;)
+    {
+        // Take a request from the buffer if there is a complete one:
+        size_t pos = 0, end;
+        bool complete = false;
+        while((end = buffer.find('\n', pos)) != string::npos)
+        {
+            const string line = buffer.substr(pos, end - pos);
+            pos = end + 1;
+            if(line.empty())
+            {
+                complete = true;
+                break;
+            }
+            lines.push_back(line);
+        }
+        buffer.erase(0, pos);
+
+        if(complete)
+        {
+            if(!serve_request(fd, lines)) break;
+            lines.clear();
+            request_size = 0;
+            continue;
+        }
+
+        char data[4096];
+        const ssize_t n = read(fd, data, sizeof(data));
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) break;
+
+        request_size += n;
+        if(request_size > max_request_size)
+        {
+            write_response(fd, Mesh(), "request too long");
+            break;
+        }
+        buffer.append(data, n);
+    }
+
+    lock_guard<std::mutex> lock(mutex);
+    connections.erase(fd);
+    close(fd);
+    connection_closed.notify_all();
+}
+
+bool MeshServer::serve_request(int fd, const vector<string>& lines)
+{
+    const double t0 = get_time();
+
+    int res_u = 64, res_v = 64;
+    size_t max_triangles = 0;
+    double max_error = 0;
+    shared_ptr<const Formulas> formulas;
+    try
+    {
+        string formula_lines;
+        for(size_t k=0; k<lines.size(); ++k)
+        {
+            const string& line = lines[k];
+            if(line.length() < 3 || line[1] != ' ')
+                throw "expected \"<option> <argument>\" instead of \"" + line + "\"";
+
+            const char *arg = line.c_str() + 2;
+            switch(line[0])
+            {
+            case 'u':
+                res_u = atoi(arg);
+                break;
+
+            case 'v':
+                res_v = atoi(arg);
+                break;
+
+            case 'd':
+                max_triangles = max(atoi(arg), 0);
+                break;
+
+            case 'D':
+                max_error = atof(arg);
+                break;
+
+            case 'e':
+            case 'x': case 'y': case 'z':
+            case 'r': case 'g': case 'b':
+            case 'f':
+                formula_lines += line + '\n';
+                break;
+
+            default:
+                throw "unknown option \"" + line.substr(0, 1) + "\"";
+            }
+        }
+
+        formulas = get_formulas(formula_lines);
+        // Multiply in 64 bits, as clients may send any int:
+        if(formulas->implicit.has_formula() ? !(res_u > 1 && res_u <= 1024)
+                                            : !(res_u > 1 && res_v > 1 && int64_t(res_u) * res_v <= 256 * 256))
+            throw string("resolution out of range");
+    }
+    catch(const string& e)
+    {
+        return write_response(fd, Mesh(), e);
+    }
+    catch(const exception& e)
+    {
+        return write_response(fd, Mesh(), e.what());
+    }
+
+    // Send the mesh from the cache if it is there:
+    string mesh_path;
+    if(!mesh_cache_dir.empty())
+    {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "\n%d %d %zu %.17g", res_u, res_v, max_triangles, max_error);
+        snprintf(buf, sizeof(buf), "/%016" PRIx64, fnv1a(formulas->definition + buf));
+        mesh_path = mesh_cache_dir + buf + mesh_suffix;
+
+        const int file_fd = open(mesh_path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if(file_fd >= 0 && fstat(file_fd, &st) == 0)
+        {
+            // Mark the entry as recently used:
+            utimes(mesh_path.c_str(), NULL);
+
+            const bool ok = send_file(fd, file_fd, st.st_size);
+            close(file_fd);
+            record_request(get_time() - t0, true);
+            return ok;
+        }
+        if(file_fd >= 0) close(file_fd);
+    }
+
+    // An exception escaping this thread would end the whole server, so
+    // failures (like running out of memory) are sent to the client instead:
+    Mesh mesh;
+    try
+    {
+        if(formulas->implicit.has_formula())
+        {
+            int depth = 1;
+            while((1 << depth) < res_u) ++ depth;
+            formulas->implicit.polygonize(depth, settings.implicit_size, mesh);
+        }
+        else
+        {
+            Surface surface = formulas->surface;
+            GridArraySink grid(res_u, res_v);
+            stream_grid(surface, res_u, res_v, max(1, 16384 / res_u), grid);
+            append_grid(grid.get_vertices(), res_u, res_v, mesh);
+        }
+        weld_vertices(mesh, settings.weld_tolerance);
+        remove_bad_triangles(mesh);
+        if(max_triangles > 0 || max_error > 0)
+            decimate_mesh(mesh, max_triangles, max_error > 0 ? max_error : HUGE_VAL);
+    }
+    catch(const exception& e)
+    {
+        return write_response(fd, Mesh(), e.what());
+    }
+
+    // Write the response into a new cache entry and send it from there, or
+    // directly if that fails:
+    bool ok;
+    string tmp_path = mesh_path + ".XXXXXX";
+    const int file_fd = mesh_path.empty() ? -1 : mkostemp(&tmp_path[0], O_CLOEXEC);
+    if(file_fd >= 0 && write_response(file_fd, mesh) && rename(tmp_path.c_str(), mesh_path.c_str()) == 0)
+    {
+        ok = send_file(fd, file_fd, lseek(file_fd, 0, SEEK_CUR));
+        close(file_fd);
+        evict_cache_files(mesh_cache_dir, mesh_suffix, settings.mesh_cache_size);
+    }
+    else
+    {
+        if(file_fd >= 0)
+        {
+            cerr << "WARNING: Can't write mesh cache entry \"" << tmp_path << "\"\n";
+            close(file_fd);
+            remove(tmp_path.c_str());
+        }
+        ok = write_response(fd, mesh);
+    }
+
+    record_request(get_time() - t0, false);
+    return ok;
+}
+
+shared_ptr<const MeshServer::Formulas> MeshServer::get_formulas(const string& formula_lines)
+{
+    {
+        lock_guard<std::mutex> lock(formula_mutex);
+        map<string, formula_list_t::iterator>::iterator it = formula_index.find(formula_lines);
+        if(it != formula_index.end())
+        {
+            formula_cache.splice(formula_cache.begin(), formula_cache, it->second);
+            return it->second->second;
+        }
+    }
+
+    // Parse them without holding the lock, so that other requests don't have
+    // to wait:
+    shared_ptr<Formulas> formulas(new Formulas);
+    size_t pos = 0, end;
+    while((end = formula_lines.find('\n', pos)) != string::npos)
+    {
+        const char opt = formula_lines[pos];
+        const string arg = formula_lines.substr(pos + 2, end - pos - 2);
+        pos = end + 1;
+
+        if(opt == 'e')
+        {
+            if(arg.length() < 3 || arg[1] != '=')
+                throw string("auxiliary variables must be defined as \"<varchar>=<definition>\"");
+            formulas->surface.add_aux(arg);
+        }
+        else if(opt == 'f')
+            formulas->implicit.set_formula(arg);
+        else
+            formulas->surface.set_formula(opt, arg);
+    }
+    formulas->surface.compile();
+    formulas->surface.set_fast_math(settings.fast_math);
+    formulas->implicit.set_fast_math(settings.fast_math);
+    formulas->definition = formulas->implicit.has_formula() ? formula_lines + (settings.fast_math ? "fast math\n" : "")
+                                                            : formulas->surface.get_definition();
+
+    lock_guard<std::mutex> lock(formula_mutex);
+    map<string, formula_list_t::iterator>::iterator it = formula_index.find(formula_lines);
+    if(it != formula_index.end()) return it->second->second;  // parsed by another request meanwhile
+
+    formula_cache.push_front(make_pair(formula_lines, formulas));
+    formula_index[formula_lines] = formula_cache.begin();
+    if(formula_cache.size() > max_formulas)
+    {
+        formula_index.erase(formula_cache.back().first);
+        formula_cache.pop_back();
+    }
+    return formulas;
+}
+
+void MeshServer::record_request(double latency, bool cache_hit)
+{
+    lock_guard<std::mutex> lock(mutex);
+    latencies.push_back(latency);
+    if(cache_hit) ++ n_hits;
+}
+
+void MeshServer::print_stats(double dt)
+{
+    lock_guard<std::mutex> lock(mutex);
+    if(latencies.empty()) return;
+
+    sort(latencies.begin(), latencies.end());
+    const size_t n = latencies.size();
+    cout << "* " << (n / dt) << " requests/s, latency " << 1e3 * latencies[n / 2] << " ms median, "
+         << 1e3 * latencies[min(n - 1, n * 99 / 100)] << " ms 99th percentile, " << 1e3 * latencies[n - 1]
+         << " ms max, " << (100.0 * n_hits / n) << "% from the mesh cache, "
+         << connections.size() << " connection(s)\n";
+    cout.flush();
+
+    latencies.clear();
+    n_hits = 0;
+}
@@ -0,0 +1,114 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include <cinttypes>
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include "surface.hpp"
+#include "implicit.hpp"
+
+// Header of every response of MeshServer.  An error response has error_length
+// bytes of message after it and no mesh; otherwise the mesh follows: the
+// positions, colors and normals of all vertices (3 floats each, one array
+// after the other) and then the triangles (3 uint32_t vertex indices each).
+// All numbers are in the byte order of the server.
+struct MeshHeader
+{
+    char magic[4];  // "PPMS"
+    uint32_t version;
+    uint32_t n_vertices, n_triangles;
+    uint32_t error_length;
+};
+
+struct ServerSettings
+{
+    ServerSettings() : fast_math(false), mesh_cache_size(0), weld_tolerance(1e-5), implicit_size(2), stats_interval(0) {}
+
+    bool fast_math;
+    size_t mesh_cache_size;  // in bytes, 0 disables the mesh cache
+    float weld_tolerance;  // see weld_vertices()
+    double implicit_size;  // half the edge length of the implicit surface cube
+    double stats_interval;  // seconds between printed statistics, 0 for none
+};
+
+// Headless mode: generates meshes of surfaces for other processes, which send
+// requests over a Unix domain socket.  A request consists of lines of the form
+// "<option> <argument>", with the options -e, -x, -y, -z, -r, -g, -b, -f, -u,
+// -v, -d and -D of the command line, and ends with an empty line.  Each is
+// answered with a MeshHeader and a welded mesh.  A connection may send any
+// number of requests, and every connection is served by its own thread.
+//
+// Compiled formulas are kept for the next request with the same ones.
+// Meshes are stored in a cache directory (evicted like the grid cache) and
+// sent from there with sendfile(), so a repeated request costs hardly more
+// than a lookup.
+class MeshServer
+{
+public:
+    explicit MeshServer(const ServerSettings& settings);
+    ~MeshServer();
+
+    // Creates the socket at path, replacing a stale one.  Throws a string on
+    // failure.
+    void listen(const std::string& path);
+
+    // Accepts and serves connections until stop() is called, then waits for
+    // the connections to be closed.
+    void run();
+
+    // Makes run() return.  Can be called from other threads and from signal
+    // handlers.
+    void stop();
+
+private:
+    MeshServer(const MeshServer&);
+    MeshServer& operator=(const MeshServer&);
+
+    // Parsed formulas of a request.  Surface isn't thread-safe, so requests
+    // work on copies.
+    struct Formulas
+    {
+        Surface surface;
+        ImplicitSurface implicit;
+        std::string definition;  // identifies the meshes of these formulas
+    };
+
+    void serve_connection(int fd);
+
+    // Handles one request.  Returns false if the response couldn't be sent.
+    bool serve_request(int fd, const std::vector<std::string>& lines);
+
+    // Returns the compiled formulas of the given request lines, parsing them
+    // only if they aren't cached yet.  Throws a string on parse errors.
+    std::shared_ptr<const Formulas> get_formulas(const std::string& formula_lines);
+
+    void record_request(double latency, bool cache_hit);
+    void print_stats(double dt);
+
+    ServerSettings settings;
+    std::string path;
+    std::string mesh_cache_dir;  // empty if disabled
+    int listen_fd;
+    int stop_pipe[2];
+
+    // Compiled formulas, the most recently used ones at the front:
+    typedef std::list<std::pair<std::string, std::shared_ptr<const Formulas> > > formula_list_t;
+    formula_list_t formula_cache;
+    std::map<std::string, formula_list_t::iterator> formula_index;
+    std::mutex formula_mutex;
+
+    // Open connections, and statistics since they were last printed:
+    std::set<int> connections;
+    std::vector<double> latencies;  // of all requests, in seconds
+    size_t n_hits;  // requests answered from the mesh cache
+    std::mutex mutex;
+    std::condition_variable connection_closed;
+};
+
+#endif  // SERVER_HPP
@@ -0,0 +1,134 @@
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <EGL/egl.h>
+#include "shadercache.hpp"
+#include "hash.hpp"
+#include "cachedir.hpp"
+using namespace std;
+
+static const char cache_magic[4] = { 'P', 'P', 'S', 'B' };
+static const uint32_t cache_version = 1;
+
+struct CacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t format;
+    uint32_t length;
+};
+
+void ShaderCache::init()
+{
+    supported = false;
+
+    const char *extensions = reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS));
+    if(!extensions || !strstr(extensions, "GL_OES_get_program_binary")) return;
+
+    GLint n_formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &n_formats);
+    if(n_formats <= 0) return;
+
+    get_program_binary = reinterpret_cast<PFNGLGETPROGRAMBINARYOESPROC>(eglGetProcAddress("glGetProgramBinaryOES"));
+    program_binary = reinterpret_cast<PFNGLPROGRAMBINARYOESPROC>(eglGetProcAddress("glProgramBinaryOES"));
+    if(!get_program_binary || !program_binary) return;
+
+    dir = get_cache_dir("shaders");
+    if(dir.empty()) return;
+
+    // Identify the driver, as binaries are only valid for the one that made them:
+    const GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+    for(int k=0; k<3; ++k)
+    {
+        const char *str = reinterpret_cast<const char*>(glGetString(names[k]));
+        driver_id += str ? str : "";
+        driver_id += '\n';
+    }
+
+    supported = true;
+}
+
+string ShaderCache::get_key(const vector<string>& sources) const
+{
+    uint64_t h = fnv1a(driver_id);
+    for(size_t k=0; k<sources.size(); ++k) h = fnv1a(sources[k], h);
+
+    char key[17];
+    snprintf(key, sizeof(key), "%016" PRIx64, h);
+    return key;
+}
+
+string ShaderCache::get_path(const string& key) const
+{
+    return dir + "/" + key + ".bin";
+}
+
+GLuint ShaderCache::load(const string& key) const
+{
+    if(!supported) return 0;
+
+    ifstream file(get_path(key).c_str(), ios::binary);
+    if(!file) return 0;
+
+    CacheHeader header;
+    if(!file.read(reinterpret_cast<char*>(&header), sizeof(header))
+       || memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0
+       || header.version != cache_version || header.length == 0)
+    {
+        return 0;
+    }
+
+    vector<char> binary(header.length);
+    if(!file.read(&binary[0], binary.size())) return 0;
+
+    const GLuint handle = glCreateProgram();
+    program_binary(handle, header.format, &binary[0], binary.size());
+
+    // The driver may reject the binary, for example after an update:
+    GLint status;
+    glGetProgramiv(handle, GL_LINK_STATUS, &status);
+    if(status == GL_FALSE)
+    {
+        glDeleteProgram(handle);
+        return 0;
+    }
+
+    return handle;
+}
+
+void ShaderCache::store(const string& key, GLuint program) const
+{
+    if(!supported) return;
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+    if(length <= 0) return;
+
+    vector<char> binary(length);
+    GLenum format;
+    get_program_binary(program, length, NULL, &format, &binary[0]);
+
+    CacheHeader header;
+    memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.version = cache_version;
+    header.format = format;
+    header.length = length;
+
+    // Write to a temporary file first, so that there are never half-written
+    // entries in the cache:
+    const string path = get_path(key), tmp_path = path + ".tmp";
+    {
+        ofstream file(tmp_path.c_str(), ios::binary);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(&binary[0], binary.size());
+        if(!file)
+        {
+            cerr << "WARNING: Can't write shader cache entry \"" << tmp_path << "\"\n";
+            remove(tmp_path.c_str());
+            return;
+        }
+    }
+    rename(tmp_path.c_str(), path.c_str());
+}
@@ -0,0 +1,45 @@
+#ifndef SHADERCACHE_HPP
+#define SHADERCACHE_HPP
+
+#include <string>
+#include <vector>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+// On-disk cache of linked shader program binaries, using the
+// GL_OES_get_program_binary extension if the driver has it.
+// Entries are keyed by a hash of the shader sources and the GL vendor,
+// renderer and version strings, so changing a shader or updating the driver
+// simply misses the cache.
+class ShaderCache
+{
+public:
+    ShaderCache() : supported(false) {}
+
+    // Checks for the extension and sets up the cache directory.  Requires a
+    // current GL context.
+    void init();
+
+    bool is_supported() const { return supported; }
+
+    // Returns the key of a program linked from the given shader sources.
+    std::string get_key(const std::vector<std::string>& sources) const;
+
+    // Creates a program from the cached binary for key.  Returns 0 if there
+    // is no usable entry.
+    GLuint load(const std::string& key) const;
+
+    // Stores the binary of a linked program under key.
+    void store(const std::string& key, GLuint program) const;
+
+private:
+    std::string get_path(const std::string& key) const;
+
+    bool supported;
+    std::string dir;
+    std::string driver_id;
+    PFNGLGETPROGRAMBINARYOESPROC get_program_binary;
+    PFNGLPROGRAMBINARYOESPROC program_binary;
+};
+
+#endif  // SHADERCACHE_HPP
@@ -0,0 +1,55 @@
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include <atomic>
+
+// Passes the latest value of T from one producer thread to one consumer
+// thread without locks (triple buffering): the producer always has a slot of
+// its own to write the next value into, the consumer always has one to read
+// the last value from, and the third slot holds the newest published value
+// until one of them swaps it for its own.  Neither side ever waits for the
+// other, and the consumer skips values which were overwritten before it took
+// them.
+template <typename T>
+class Snapshot
+{
+public:
+    explicit Snapshot(const T& value = T()) : write_slot(0), read_slot(1), middle(2)
+    {
+        slots[0] = slots[1] = slots[2] = value;
+    }
+
+    // Publishes value.  Must only be called by the producer.  Returns true if
+    // the consumer had taken the previous value (so it may need to be told
+    // that there is a new one).
+    bool publish(const T& value)
+    {
+        slots[write_slot] = value;
+        const int old = middle.exchange(write_slot | fresh, std::memory_order_acq_rel);
+        write_slot = old & ~fresh;
+        return !(old & fresh);
+    }
+
+    // If a value was published since the last call, stores the newest one in
+    // value and returns true.  Must only be called by the consumer.
+    bool take(T& value)
+    {
+        if(!(middle.load(std::memory_order_relaxed) & fresh)) return false;
+        read_slot = middle.exchange(read_slot, std::memory_order_acq_rel) & ~fresh;
+        value = slots[read_slot];
+        return true;
+    }
+
+private:
+    Snapshot(const Snapshot&);
+    Snapshot& operator=(const Snapshot&);
+
+    enum { fresh = 4 };  // flag of middle
+
+    T slots[3];
+    int write_slot;  // only used by the producer
+    int read_slot;  // only used by the consumer
+    std::atomic<int> middle;  // index of the third slot, plus fresh if it holds a value nobody has taken
+};
+
+#endif  // SNAPSHOT_HPP
@@ -0,0 +1,204 @@
+#include <cassert>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include "surface.hpp"
+using namespace std;
+
+static const char outputs[] = "xyzrgb";
+
+Surface::Surface()
+ : vars(2), fast_math(false)
+{
+    varlist.push_back("u");
+    varlist.push_back("v");
+
+    constmap["pi"] = M_PI;
+    constmap["e"] = M_E;
+
+    out_strs[0] = "2*u-1";
+    out_strs[1] = "0";
+    out_strs[2] = "2*v-1";
+    out_strs[3] = out_strs[4] = out_strs[5] = "1";
+}
+
+void Surface::add_aux(const std::string& vardef)
+{
+    assert(vardef.length() >= 3);
+    string varname;
+    varname += vardef[0];
+    varlist.push_back(varname);
+    extra_strs.push_back(vardef);
+    extra_etors.push_back(Evaluator(vardef.substr(2), varlist, constmap));
+    vars.push_back(0.0);
+}
+
+void Surface::redefine_aux(size_t k, const std::string& def)
+{
+    assert(k < extra_strs.size());
+    const Evaluator::varlist_t prev_vars(varlist.begin(), varlist.begin() + 2 + k);
+    extra_etors[k] = Evaluator(def, prev_vars, constmap);
+    extra_etors[k].set_fast_math(fast_math);
+    extra_strs[k] = extra_strs[k].substr(0, 2) + def;
+    if(!out_etors.empty()) schedule_aux();
+}
+
+void Surface::set_aux_value(size_t k, double value)
+{
+    // Formulas can't hold every double (they have no exponents, for one), so
+    // the value goes into a named constant:
+    char name[32];
+    snprintf(name, sizeof(name), "aux%zu_value", k);
+    constmap[name] = value;
+    redefine_aux(k, name);
+}
+
+void Surface::set_formula(char output, const std::string& def)
+{
+    const char *p = strchr(outputs, output);
+    assert(p && *p);
+    out_strs[p - outputs] = def;
+}
+
+void Surface::compile()
+{
+    out_etors.clear();
+    for(int k=0; k<6; ++k)
+        out_etors.push_back(Evaluator(out_strs[k], varlist, constmap));
+    schedule_aux();
+}
+
+// Adds mask to the entries of needed for the variables used by etor.
+static void mark_vars(const Evaluator& etor, int mask, vector<int>& needed)
+{
+    const vector<Operation>& ops = etor.get_operations();
+    for(size_t k=0; k<ops.size(); ++k)
+    {
+        if(ops[k].op == Operation::PUSH_VAR) needed[ops[k].var_idx] |= mask;
+    }
+}
+
+void Surface::schedule_aux()
+{
+    // Bit 0 for the positions, bit 1 for the colors, by index into varlist:
+    vector<int> needed(varlist.size(), 0);
+    for(int k=0; k<6; ++k) mark_vars(out_etors[k], k < 3 ? 1 : 2, needed);
+
+    // Variables only use those defined before them (or themselves), so the
+    // users of each one have been seen when going backwards:
+    for(size_t k=extra_etors.size(); k-- > 0; )
+    {
+        int& mask = needed[2 + k];
+        if(!mask) continue;
+
+        // A variable that uses itself sees its value at the point before,
+        // so it must be evaluated everywhere, as ever:
+        vector<int> uses(varlist.size(), 0);
+        mark_vars(extra_etors[k], 1, uses);
+        if(uses[2 + k]) mask |= 1;
+        mark_vars(extra_etors[k], mask, needed);
+    }
+
+    position_aux.clear();
+    color_aux.clear();
+    for(size_t k=0; k<extra_etors.size(); ++k)
+    {
+        if(needed[2 + k] & 1)
+            position_aux.push_back(k);
+        else if(needed[2 + k])
+            color_aux.push_back(k);
+    }
+}
+
+AuxStats Surface::get_aux_stats() const
+{
+    AuxStats stats;
+    stats.n_aux = extra_etors.size();
+    stats.n_color_only = color_aux.size();
+    stats.n_unused = stats.n_aux - position_aux.size() - color_aux.size();
+    return stats;
+}
+
+void Surface::set_fast_math(bool fast)
+{
+    fast_math = fast;
+    for(size_t k=0; k<extra_etors.size(); ++k) extra_etors[k].set_fast_math(fast);
+    for(size_t k=0; k<out_etors.size(); ++k) out_etors[k].set_fast_math(fast);
+}
+
+// Appends str to def without blanks, which never change the meaning of a valid formula.
+static void append_stripped(string& def, const string& str)
+{
+    for(size_t k=0; k<str.length(); ++k)
+    {
+        if(!isblank(str[k])) def += str[k];
+    }
+    def += '\n';
+}
+
+string Surface::get_definition() const
+{
+    string def;
+    for(size_t k=0; k<extra_strs.size(); ++k) append_stripped(def, extra_strs[k]);
+    for(int k=0; k<6; ++k)
+    {
+        def += outputs[k];
+        def += '=';
+        append_stripped(def, out_strs[k]);
+    }
+
+    char buf[64];
+    for(Evaluator::constmap_t::const_iterator it = constmap.begin(); it != constmap.end(); ++it)
+    {
+        snprintf(buf, sizeof(buf), "=%.17g\n", it->second);
+        def += it->first + buf;
+    }
+
+    if(fast_math) def += "fast math\n";
+    return def;
+}
+
+void Surface::eval_grid(int res_u, int res_v, glm::vec3* positions, glm::vec3* colors)
+{
+    for(int j=-1; j<res_v+1; ++j)
+    {
+        eval_row(res_u, res_v, j, positions + (res_u + 2) * (j + 1),
+                 j >= 0 && j < res_v ? colors + res_u * j : NULL);
+    }
+}
+
+void Surface::eval_row(int res_u, int res_v, int j, glm::vec3* positions, glm::vec3* colors)
+{
+    assert(out_etors.size() == 6);
+
+    vars[1] = 1.0 * j / (res_v - 1);  // v
+    for(int i=-1; i<res_u+1; ++i)
+    {
+        vars[0] = 1.0 * i / (res_u - 1);  // u
+
+        // Calculate the auxiliary variables needed for the position; the
+        // color-only ones follow below:
+        for(size_t k=0; k<position_aux.size(); ++k)
+        {
+            vars[2 + position_aux[k]] = extra_etors[position_aux[k]].evaluate(vars);
+        }
+
+        // Evaluate position:
+        positions[i + 1] = glm::vec3(out_etors[0].evaluate(vars),
+                                     out_etors[1].evaluate(vars),
+                                     out_etors[2].evaluate(vars));
+
+        // Evaluate colors:
+        if(i >= 0 && i < res_u && j >= 0 && j < res_v)
+        {
+            for(size_t k=0; k<color_aux.size(); ++k)
+            {
+                vars[2 + color_aux[k]] = extra_etors[color_aux[k]].evaluate(vars);
+            }
+            colors[i] = glm::vec3(out_etors[3].evaluate(vars),
+                                  out_etors[4].evaluate(vars),
+                                  out_etors[5].evaluate(vars));
+        }
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef SURFACE_HPP
+#define SURFACE_HPP
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "evaluator.hpp"
+#include "mesh.hpp"
+
+// Work on auxiliary variables that Surface::compile() found it can skip.
+struct AuxStats
+{
+    size_t n_aux;  // auxiliary variables
+    size_t n_unused;  // not needed by any output, so never evaluated
+    size_t n_color_only;  // only needed by colors, so not evaluated at the sentinel vertices
+};
+
+// A parametric surface: formulas for position (x,y,z) and color (r,g,b) in
+// terms of u, v and auxiliary variables.
+class Surface : public GridSource
+{
+public:
+    Surface();
+
+    // Defines an auxiliary variable which can be used in all following
+    // definitions.  vardef must be of the form "<varchar>=<definition>".
+    void add_aux(const std::string& vardef);
+
+    // Replaces the definition of the k-th auxiliary variable, which may only
+    // use the variables defined before it.  Throws a string on parse errors.
+    void redefine_aux(size_t k, const std::string& def);
+
+    // Makes the k-th auxiliary variable a constant with the given value.
+    void set_aux_value(size_t k, double value);
+    size_t get_n_aux() const { return extra_strs.size(); }
+
+    // Sets the formula of one output (one of 'x', 'y', 'z', 'r', 'g', 'b').
+    void set_formula(char output, const std::string& def);
+
+    // Parses the output formulas and finds out which auxiliary variables they
+    // need.  Must be called after the last set_formula().
+    void compile();
+    AuxStats get_aux_stats() const;
+
+    // Switches all formulas to fast-math mode (see Evaluator::set_fast_math).
+    // Must be called after compile().
+    void set_fast_math(bool fast);
+
+    // Returns the auxiliary variables, output formulas and constants (without
+    // blanks) and the fast-math setting as one string, which identifies the
+    // grids this surface evaluates to.
+    std::string get_definition() const;
+
+    // Evaluates positions and colors on a res_u*res_v grid.  As expected by
+    // calc_normals, positions get a frame of sentinel vertices and
+    // must have (res_u+2)*(res_v+2) entries; colors has res_u*res_v entries.
+    void eval_grid(int res_u, int res_v, glm::vec3* positions, glm::vec3* colors);
+
+    // Evaluates a single row of such a grid (see GridSource).
+    void eval_row(int res_u, int res_v, int j, glm::vec3* positions, glm::vec3* colors);
+
+private:
+    // Fills position_aux and color_aux from the variables used by the
+    // formulas.
+    void schedule_aux();
+
+    Evaluator::varlist_t varlist;
+    Evaluator::constmap_t constmap;
+    std::vector<double> vars;
+
+    std::vector<std::string> extra_strs;  // "<varchar>=<definition>"
+    std::vector<Evaluator> extra_etors;
+    std::string out_strs[6];  // x, y, z, r, g, b
+    std::vector<Evaluator> out_etors;
+    // Indices of the auxiliary variables to evaluate, in the order of their
+    // definitions (so each comes after those it uses):
+    std::vector<size_t> position_aux;  // needed by positions (and maybe colors)
+    std::vector<size_t> color_aux;  // only needed by colors
+    bool fast_math;
+};
+
+#endif  // SURFACE_HPP